@@ -0,0 +1,86 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+
+#include <swegl/swegl.hpp>
+#include <swegl/data/model.hpp>
+#include <swegl/misc/image.hpp>
+#include <swegl/render/viewport.hpp>
+#include <swegl/render/post_shaders.hpp>
+
+// What the bench_*.cpp programs share: the screen they draw to, their viewports and how they time things.
+
+// a textured tore, a box and a textured sphere, lit by the sun and a point light: test_1's scene without its
+// transparent and untextured parts
+inline swegl::scene_t build_textured_scene()
+{
+	swegl::scene_t s;
+
+	s.images.emplace_back(swegl::read_image_file("resources/dice.bmp"));
+	s.images.emplace_back(swegl::read_image_file("resources/tex.bmp"));
+
+	s.materials.push_back(swegl::material_t{swegl::pixel_colors{128,128,128,255}, 1, 1,  0});
+	s.materials.push_back(swegl::material_t{swegl::pixel_colors{128,128,128,255}, 1, 1,  1});
+
+	s.ambient_light_intensity = 0.2f;
+	s.sun_direction = swegl::normal_t{1.0, -1.0, -1.0};
+	s.sun_intensity = 0.3;
+	s.point_source_lights.emplace_back(swegl::point_source_light{{0.5, 2.0, 0}, 100});
+
+	auto tore = swegl::make_tore(100, 1);
+	tore.rotation.rotate_z(0.5);
+	tore.translation = swegl::vertex_t(0.0f, 0.0f, -2.5f);
+	s.nodes.emplace_back(std::move(tore));
+
+	auto cube = swegl::make_cube(1.0f, 0);
+	cube.scale.x() = 2;
+	s.nodes.emplace_back(std::move(cube));
+
+	auto sphere = swegl::make_sphere(100, 2.0f, 1);
+	sphere.translation = swegl::vertex_t(3.0f, 0.0f, -1.0f);
+	s.nodes.emplace_back(std::move(sphere));
+
+	for (int i=0 ; i<(int)s.nodes.size() ; i++)
+		s.root_nodes.push_back(i);
+
+	return s;
+}
+
+// 800x600, off screen
+struct bench_screen_t
+{
+	SDL_Surface * surface = SDL_CreateRGBSurface(0, 800, 600, 32, 0, 0, 0, 0);
+	swegl::post_shader_t post_shader_null;
+
+	bench_screen_t() = default;
+	bench_screen_t(const bench_screen_t &) = delete;
+	~bench_screen_t() { SDL_FreeSurface(surface); }
+};
+
+// the whole screen, without post processing: frame times are the renderer's alone
+struct bench_viewport_t : swegl::viewport_t
+{
+	bench_viewport_t(bench_screen_t & screen, std::shared_ptr<swegl::pixel_shader_t> & pixel_shader)
+		: swegl::viewport_t(0, 0, screen.surface->w, screen.surface->h, screen.surface, pixel_shader, 0)
+	{
+		set_post_shader(screen.post_shader_null);
+	}
+};
+
+// seconds f() takes
+template<typename F>
+inline double seconds(F && f)
+{
+	auto begin = std::chrono::steady_clock::now();
+	f();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// milliseconds per call of f() over count calls, after one more that warms up caches and lets levels of detail settle
+template<typename F>
+inline double ms_per_call(int count, F && f)
+{
+	f();
+	return 1000 * seconds([&]() { for (int i=0 ; i<count ; i++) f(); }) / count;
+}
@@ -0,0 +1,195 @@
+
+#include "headers.hpp"
+
+#include <string>
+#include <vector>
+
+#include <swegl/swegl.hpp>
+#include <swegl/data/model.hpp>
+#include <swegl/render/renderer.hpp>
+#include <swegl/render/pixel_shaders.hpp>
+#include <swegl/render/post_shaders.hpp>
+
+#include "bench_common.hpp"
+
+// Many point lights: a floor covered with spheres, lit by small lights scattered over it.
+// Frame times going through all the lights for each pixel (phong), vertex (gouraud) or triangle (flat), and through those of the light clusters,
+// with the average number of lights per non-empty cluster, and the pixels that differ: only by rounding, lights are
+// summed in a different order.
+// Then flat frame times with the light of the triangles computed every frame, kept from frame to frame with nothing
+// moving, and with the camera moving: only the specular light is computed again.
+// Then the lighting of a point alone with 4, 16 and 64 lights: one light at a time as the shaders used to, and
+// point_lights_intensity(), 4 lights at a time, with the largest relative difference.
+// usage: bench_lights [frames] [lights]
+
+swegl::scene_t build_scene(int lights)
+{
+	swegl::scene_t s;
+
+	s.materials.push_back(swegl::material_t{swegl::pixel_colors{200,200,200,255}, 1, 1, -1});
+
+	s.ambient_light_intensity = 0.1f;
+	s.sun_direction = swegl::normal_t{1.0, -1.0, -1.0};
+	s.sun_intensity = 0.1;
+
+	unsigned int seed = 12345;
+	auto random = [&](float min, float max) { seed = seed * 1103515245 + 12345; return min + (max - min) * (seed >> 8) / float(1 << 24); };
+	for (int i=0 ; i<lights ; i++)
+		s.point_source_lights.emplace_back(swegl::point_source_light{{random(-20, 20), random(0.2f, 2), random(-20, 20)}, random(0.05f, 0.2f)});
+
+	auto floor = swegl::make_cube(1.0f, 0);
+	floor.scale = swegl::vertex_t(40.0f, 0.1f, 40.0f);
+	floor.translation = swegl::vertex_t(0.0f, -0.6f, 0.0f);
+	s.nodes.emplace_back(std::move(floor));
+	for (int x=-10 ; x<10 ; x++)
+		for (int z=-10 ; z<10 ; z++)
+		{
+			auto sphere = swegl::make_sphere(16, 0.5f, 0);
+			sphere.translation = swegl::vertex_t(x * 2.0f + 1, 0.0f, z * 2.0f + 1);
+			s.nodes.emplace_back(std::move(sphere));
+		}
+	for (int i=0 ; i<(int)s.nodes.size() ; i++)
+		s.root_nodes.push_back(i);
+
+	return s;
+}
+
+// what the shaders did for each light before point_lights_intensity()
+float point_lights_intensity_reference(const std::vector<swegl::point_source_light> & lights, const swegl::vertex_t & point, const swegl::normal_t & normal, const swegl::vector_t & camera_vector)
+{
+	float intensity = 0.0f;
+	for (const auto & psl : lights)
+	{
+		swegl::vector_t light_direction = point - psl.position;
+		float light_distance_squared = light_direction.len_squared();
+		float diffuse = psl.intensity / light_distance_squared;
+		if (diffuse < swegl::point_source_light::cutoff)
+			continue;
+		light_direction.normalize();
+		float alignment = - normal.dot(light_direction);
+		if (alignment < 0.0f)
+			continue;
+		diffuse *= alignment;
+		swegl::vector_t reflection = light_direction + normal * (alignment * 2);
+		float specular = reflection.dot(camera_vector);
+		if (specular > 0)
+			intensity += diffuse + std::pow(specular, 32) * 32 / 2 / light_distance_squared;
+		else
+			intensity += diffuse;
+	}
+	return intensity;
+}
+
+int main(int argc, char ** argv)
+{
+	int frames = argc > 1 ? std::stoi(argv[1]) :   10;
+	int lights = argc > 2 ? std::stoi(argv[2]) : 1000;
+
+	swegl::scene_t scene = build_scene(lights);
+
+	bench_screen_t screen;
+
+	std::pair<const char *, std::shared_ptr<swegl::pixel_shader_t>> shaders[] = {
+		{"flat",  std::make_shared<swegl::pixel_shader_lights_flat >()},
+		{"gouraud", std::make_shared<swegl::pixel_shader_lights_gouraud>()},
+		{"phong", std::make_shared<swegl::pixel_shader_lights_phong>()},
+	};
+	for (auto & [name, pixel_shader] : shaders)
+	{
+		printf("%-7s %d lights", name, lights);
+		std::vector<unsigned int> images[2];
+		for (bool clustered : {false, true})
+		{
+			bench_viewport_t viewport(screen, pixel_shader);
+			viewport.set_light_clusters(clustered);
+			viewport.set_face_light_cache(false);
+			viewport.m_camera.translate(0, 3, -12);
+			viewport.m_camera.rotate_x(-0.4);
+
+			double ms = ms_per_call(frames, [&]() { swegl::render(scene, viewport); });
+			printf("  %s %9.3f ms", clustered ? "clustered" : "all lights", ms);
+
+			const swegl::light_clusters_t & clusters = viewport.m_light_clusters;
+			if (clustered)
+			{
+				size_t non_empty = 0;
+				for (size_t c=0 ; c+1<clusters.m_offsets.size() ; c++)
+					non_empty += clusters.m_offsets[c+1] > clusters.m_offsets[c];
+				printf(" (%.1f lights per cluster)", non_empty ? clusters.m_lights.size() / (double)non_empty : 0.0);
+			}
+
+			const unsigned int * pixels = (const unsigned int *) screen.surface->pixels;
+			images[clustered].assign(pixels, pixels + screen.surface->w * screen.surface->h);
+		}
+		size_t differences = 0;
+		for (size_t i=0 ; i<images[0].size() ; i++)
+			differences += images[0][i] != images[1][i];
+		printf("  %zu pixels differ\n", differences);
+	}
+
+	{
+		std::shared_ptr<swegl::pixel_shader_t> pixel_shader = std::make_shared<swegl::pixel_shader_lights_flat>();
+		printf("flat    %d lights", lights);
+		const char * names[] = {"every frame", "kept", "camera moving"};
+		for (int mode=0 ; mode<3 ; mode++)
+		{
+			bench_viewport_t viewport(screen, pixel_shader);
+			viewport.set_face_light_cache(mode > 0);
+			viewport.m_camera.translate(0, 3, -12);
+			viewport.m_camera.rotate_x(-0.4);
+
+			double ms = ms_per_call(frames, [&]()
+				{
+					if (mode == 2)
+						viewport.m_camera.translate(0.01f, 0, 0);
+					swegl::render(scene, viewport);
+				});
+			printf("  %s %9.3f ms", names[mode], ms);
+		}
+		printf("\n");
+	}
+
+	for (int light_count : {4, 16, 64})
+	{
+		// points on the floor under lights close enough to all reach them
+		swegl::scene_t s;
+		unsigned int seed = 12345;
+		auto random = [&](float min, float max) { seed = seed * 1103515245 + 12345; return min + (max - min) * (seed >> 8) / float(1 << 24); };
+		for (int i=0 ; i<light_count ; i++)
+			s.point_source_lights.emplace_back(swegl::point_source_light{{random(-1, 1), random(0.2f, 1), random(-1, 1)}, random(0.5f, 2)});
+		s.point_source_light_streams.assign(s.point_source_lights);
+		const int count = 1 << 14;
+		std::vector<swegl::vertex_t> points;
+		std::vector<swegl::normal_t> normals;
+		std::vector<swegl::vector_t> camera_vectors;
+		for (int i=0 ; i<count ; i++)
+		{
+			points.emplace_back(random(-1, 1), 0, random(-1, 1));
+			normals.emplace_back(random(-0.2f, 0.2f), -1, random(-0.2f, 0.2f));
+			camera_vectors.emplace_back(swegl::normal_t(random(-1, 1), 1, random(-1, 1)));
+		}
+		std::vector<float> reference(count), simd(count);
+		const int repeat = frames * 10;
+
+		double reference_seconds = seconds([&]()
+			{
+				for (int r=0 ; r<repeat ; r++)
+					for (int i=0 ; i<count ; i++)
+						reference[i] = point_lights_intensity_reference(s.point_source_lights, points[i], normals[i], camera_vectors[i]);
+			});
+		double simd_seconds = seconds([&]()
+			{
+				for (int r=0 ; r<repeat ; r++)
+					for (int i=0 ; i<count ; i++)
+						simd[i] = swegl::point_lights_intensity(s.point_source_light_streams.all(), points[i], normals[i], camera_vectors[i]);
+			});
+
+		float difference = 0;
+		for (int i=0 ; i<count ; i++)
+			difference = std::max(difference, std::abs(reference[i] - simd[i]) / std::max(reference[i], 1e-6f));
+		printf("%2d lights  one at a time %7.2f Mpixels/s  4 at a time %7.2f Mpixels/s  largest difference %.2e\n"
+		      , light_count, (double)count * repeat / reference_seconds / 1e6, (double)count * repeat / simd_seconds / 1e6, difference);
+	}
+
+	return 0;
+}
@@ -0,0 +1,68 @@
+
+#include "headers.hpp"
+
+#include <string>
+
+#include <swegl/swegl.hpp>
+#include <swegl/data/model.hpp>
+#include <swegl/data/gltf.hpp>
+#include <swegl/render/renderer.hpp>
+#include <swegl/render/vertex_shaders.hpp>
+#include <swegl/render/pixel_shaders.hpp>
+#include <swegl/render/post_shaders.hpp>
+
+#include "bench_common.hpp"
+
+// Levels of detail: a glTF scene seen from farther and farther away, rendered at full resolution and with levels of detail.
+// Reports the levels built at load time, then the triangles drawn and the frame time at each distance.
+// usage: bench_lod [frames] [scene.glb]
+
+int main(int argc, char ** argv)
+{
+	int frames = argc > 1 ? std::stoi(argv[1]) : 50;
+	const char * scene_path = argc > 2 ? argv[2] : "resources/BrainStem.glb";
+
+	swegl::scene_t scene;
+	printf("loaded in %.3f ms\n", 1000*seconds([&]() { scene = swegl::load_scene(scene_path); }));
+	size_t full_triangles = 0;
+	for (const auto & node : scene.nodes)
+		for (const auto & primitive : node.primitives)
+		{
+			size_t count = primitive.mode == swegl::primitive_t::index_mode_t::TRIANGLES ? primitive.indices.size() / 3 : primitive.indices.size() - 2;
+			full_triangles += count;
+			if (primitive.lods.empty())
+				continue;
+			printf("  %7zu triangles", count);
+			for (const auto & lod : primitive.lods)
+				printf(" -> %6zu (error %.4f)", lod.indices.size() / 3, lod.error);
+			printf("\n");
+		}
+
+	bench_screen_t screen;
+	std::shared_ptr<swegl::pixel_shader_t> pixel_shader = std::make_shared<swegl::pixel_shader_lights_flat>();
+
+	for (float distance : {3.0f, 6.0f, 12.0f, 24.0f})
+	{
+		printf("distance %5.1f\n", distance);
+		for (float pixel_error : {0.0f, 0.5f, 1.0f, 2.0f})
+		{
+			bench_viewport_t viewport(screen, pixel_shader);
+			viewport.set_level_of_detail(pixel_error);
+			viewport.m_camera.translate(0, 1, -distance);
+
+			double ms = ms_per_call(frames, [&]() { swegl::render(scene, viewport); });
+
+			size_t triangles = 0;
+			for (auto [node_idx, primitive_idx] : viewport.m_transformed_scene.visible_primitives)
+			{
+				const auto & primitive = scene.nodes[node_idx].primitives[primitive_idx];
+				const auto & transformed_primitive = viewport.m_transformed_scene.nodes[node_idx].primitives[primitive_idx];
+				const auto & indices = swegl::drawn_indices(primitive, transformed_primitive);
+				triangles += swegl::drawn_mode(primitive, transformed_primitive) == swegl::primitive_t::index_mode_t::TRIANGLES ? indices.size() / 3 : indices.size() - 2;
+			}
+			printf("  max error %3.1f px %8zu / %zu triangles  frame %8.3f ms\n", pixel_error, triangles, full_triangles, ms);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,142 @@
+
+#include "headers.hpp"
+
+#include <bitset>
+#include <string>
+
+#include <swegl/swegl.hpp>
+#include <swegl/data/model.hpp>
+#include <swegl/data/gltf.hpp>
+#include <swegl/data/mesh_optimizer.hpp>
+#include <swegl/render/renderer.hpp>
+#include <swegl/render/vertex_shaders.hpp>
+#include <swegl/render/pixel_shaders.hpp>
+#include <swegl/render/post_shaders.hpp>
+
+#include "bench_common.hpp"
+
+// Load-time mesh optimization: the same meshes rendered in file/generation order, after optimize_scene(), and glTF ones
+// as load_scene() leaves them: optimized, with levels of detail whose triangles are reordered too.
+// Reports the vertex cache miss ratio of the full meshes and of their levels of detail, the vertex stage and whole frame times, and the overdraw
+// (pixels shaded per pixel covered, with the scanline rasterizer shading as it goes), averaged over 8 points of view around the meshes.
+// usage: bench_meshes [frames] [scene.glb]
+
+// counts the pixels that passed the z-test at the time they were drawn, clones share the count
+struct counting_pixel_shader : swegl::pixel_shader_lights_flat
+{
+	std::shared_ptr<std::atomic<size_t>> shaded = std::make_shared<std::atomic<size_t>>(0);
+
+	int shade(float progress) override
+	{
+		(*shaded)++;
+		return swegl::pixel_shader_lights_flat::shade(progress);
+	}
+	void shade_span(const float * progress, std::uint32_t coverage, int count, int * colors) override
+	{
+		(*shaded) += std::bitset<32>(coverage).count();
+		swegl::pixel_shader_lights_flat::shade_span(progress, coverage, count, colors);
+	}
+	std::shared_ptr<swegl::pixel_shader_t> clone() const override { return std::make_shared<counting_pixel_shader>(*this); }
+};
+
+swegl::scene_t build_scene()
+{
+	swegl::scene_t s;
+
+	s.materials.push_back(swegl::material_t{swegl::pixel_colors{128,128,128,255}, 1, 1, -1});
+
+	s.ambient_light_intensity = 0.2f;
+	s.sun_direction = swegl::normal_t{1.0, -1.0, -1.0};
+	s.sun_intensity = 0.8;
+
+	auto tore = swegl::make_tore(100, 0);
+	tore.rotation.rotate_z(0.5);
+	tore.translation = swegl::vertex_t(0.0f, 0.0f, -2.5f);
+	s.nodes.emplace_back(std::move(tore));
+
+	auto sphere = swegl::make_sphere(100, 2.0f, 0);
+	sphere.translation = swegl::vertex_t(3.0f, 0.0f, -1.0f);
+	s.nodes.emplace_back(std::move(sphere));
+
+	for (int i=0 ; i<(int)s.nodes.size() ; i++)
+		s.root_nodes.push_back(i);
+
+	return s;
+}
+
+int main(int argc, char ** argv)
+{
+	int frames = argc > 1 ? std::stoi(argv[1]) : 50;
+	const char * scene_path = argc > 2 ? argv[2] : "resources/BrainStem.glb";
+
+	bench_screen_t screen;
+
+	const int views = 8;
+	auto run = [&](const char * name, swegl::scene_t & scene, float distance)
+		{
+			float acmr = 0, lod_acmr = 0;
+			size_t triangles = 0, lod_triangles = 0;
+			for (const auto & node : scene.nodes)
+				for (const auto & primitive : node.primitives)
+				{
+					size_t count = swegl::triangle_count(primitive.indices, primitive.mode);
+					acmr += swegl::average_cache_miss_ratio(primitive) * count;
+					triangles += count;
+					for (const auto & lod : primitive.lods)
+					{
+						lod_acmr += swegl::average_cache_miss_ratio(lod.indices) * (lod.indices.size() / 3);
+						lod_triangles += lod.indices.size() / 3;
+					}
+				}
+
+			double vertex_seconds = 0;
+			double frame_seconds = 0;
+			size_t shaded = 0;
+			size_t covered = 0;
+			for (int view=0 ; view<views ; view++)
+			{
+				auto pixel_shader = std::make_shared<counting_pixel_shader>();
+				std::shared_ptr<swegl::pixel_shader_t> viewport_shader = pixel_shader;
+				bench_viewport_t viewport(screen, viewport_shader);
+				viewport.set_hierarchical_z(false);
+				viewport.m_camera.rotate_y(6.28f * view / views);
+				viewport.m_camera.translate(0, 1, -distance);
+
+				swegl::render(scene, viewport); // warm up
+				*pixel_shader->shaded = 0;
+
+				for (int i=0 ; i<frames ; i++)
+				{
+					vertex_seconds += seconds([&]() { swegl::vertex_shader_t::world_to_viewport(scene, viewport.m_transformed_scene, viewport); });
+					frame_seconds  += seconds([&]() { swegl::render(scene, viewport); });
+					for (int k=0 ; k<viewport.m_w*viewport.m_h ; k++)
+						if (viewport.zbuffer()[k] < 1e30f)
+							covered++;
+				}
+				shaded += pixel_shader->shaded->load();
+			}
+			printf("%-28s %8zu triangles  acmr %5.3f  levels of detail acmr %5.3f  vertex stage %8.3f ms  frame %8.3f ms  overdraw %5.3f\n"
+			      , name, triangles, triangles ? acmr / triangles : 0, lod_triangles ? lod_acmr / lod_triangles : 0
+			      , 1000*vertex_seconds/frames/views, 1000*frame_seconds/frames/views
+			      , covered ? (double)shaded / covered : 0);
+		};
+
+	{
+		swegl::scene_t scene = build_scene();
+		run("procedural, as generated", scene, 7);
+		swegl::optimize_scene(scene);
+		run("procedural, optimized", scene, 7);
+	}
+	{
+		swegl::scene_t scene = swegl::load_scene(scene_path, {.optimize_meshes = false});
+		run("glTF, file order", scene, 3);
+		swegl::optimize_scene(scene);
+		run("glTF, optimized", scene, 3);
+	}
+	{
+		swegl::scene_t scene = swegl::load_scene(scene_path);
+		run("glTF, as loaded", scene, 3);
+	}
+
+	return 0;
+}
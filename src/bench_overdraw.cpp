@@ -0,0 +1,81 @@
+
+#include "headers.hpp"
+
+#include <string>
+
+#include <swegl/swegl.hpp>
+#include <swegl/data/model.hpp>
+#include <swegl/misc/image.hpp>
+#include <swegl/render/renderer.hpp>
+#include <swegl/render/pixel_shaders.hpp>
+#include <swegl/render/post_shaders.hpp>
+
+#include "bench_common.hpp"
+
+// Forward vs deferred shading on a scene with heavy overdraw: a stack of screen-filling slabs submitted back to front,
+// lit by many point lights with the phong shader, so that every hidden layer costs a full shading.
+// usage: bench_overdraw [frames] [layers] [lights]
+
+swegl::scene_t build_scene(int layers, int lights)
+{
+	swegl::scene_t s;
+
+	s.images.emplace_back(swegl::read_image_file("resources/tex.bmp"));
+	s.materials.push_back(swegl::material_t{swegl::pixel_colors{128,128,128,255}, 1, 1,  0});
+
+	s.ambient_light_intensity = 0.2f;
+	s.sun_direction = swegl::normal_t{1.0, -1.0, 1.0};
+	s.sun_intensity = 0.3;
+	for (int i=0 ; i<lights ; i++)
+		s.point_source_lights.emplace_back(swegl::point_source_light{{(i%4)*2.0f-3.0f, (i/4%4)*2.0f-3.0f, -1.0f}, 2});
+
+	// farthest first
+	for (int i=layers-1 ; i>=0 ; i--)
+	{
+		auto slab = swegl::make_cube(1.0f, 0);
+		slab.scale.x() = 8;
+		slab.scale.y() = 6;
+		slab.scale.z() = 0.1;
+		slab.translation = swegl::vertex_t(0.0f, 0.0f, -0.5f * i);
+		s.nodes.emplace_back(std::move(slab));
+	}
+
+	for (int i=0 ; i<(int)s.nodes.size() ; i++)
+		s.root_nodes.push_back(i);
+
+	return s;
+}
+
+int main(int argc, char ** argv)
+{
+	int frames = argc > 1 ? std::stoi(argv[1]) :  20;
+	int layers = argc > 2 ? std::stoi(argv[2]) :   8;
+	int lights = argc > 3 ? std::stoi(argv[3]) :  16;
+
+	swegl::scene_t scene = build_scene(layers, lights);
+
+	bench_screen_t screen;
+	std::shared_ptr<swegl::pixel_shader_t> pixel_shader = std::make_shared<swegl::pixel_shader_light_and_texture<swegl::pixel_shader_lights_phong, swegl::pixel_shader_texture_bilinear>>();
+	bench_viewport_t viewport(screen, pixel_shader);
+	viewport.m_camera.translate(0,0,-5);
+
+	auto run = [&](const char * name)
+		{
+			printf("%-24s %8.3f ms/frame\n", name, ms_per_call(frames, [&]() { swegl::render(scene, viewport); }));
+		};
+
+	printf("%d layers, %d point lights\n", layers, lights);
+
+	viewport.set_deferred_shading(false);
+	run("forward");
+	viewport.set_deferred_shading(true);
+	run("deferred");
+
+	viewport.set_tiled_rendering(64, std::thread::hardware_concurrency());
+	viewport.set_deferred_shading(false);
+	run("forward, tiled");
+	viewport.set_deferred_shading(true);
+	run("deferred, tiled");
+
+	return 0;
+}
@@ -0,0 +1,78 @@
+
+#include "headers.hpp"
+
+#include <string>
+
+#include <swegl/swegl.hpp>
+#include <swegl/data/model.hpp>
+#include <swegl/data/gltf.hpp>
+#include <swegl/render/renderer.hpp>
+#include <swegl/render/pixel_shaders.hpp>
+#include <swegl/render/post_shaders.hpp>
+
+#include "bench_common.hpp"
+
+// Rasterizer throughput: renders the same frames with each rasterizer, without and with hi-z, on the calling thread and
+// tiled, and reports frame time and filled pixels/sec.
+// usage: bench_raster [frames] [scene.glb]
+
+int main(int argc, char ** argv)
+{
+	swegl::scene_t scene = [&]()
+		{
+			if (argc < 3)
+				return build_textured_scene();
+			swegl::scene_t scene = swegl::load_scene(argv[2]);
+			scene.ambient_light_intensity = 0.3f;
+			scene.sun_direction = swegl::normal_t(1.0, -2.0, -1.0);
+			scene.sun_intensity = 0.7;
+			return scene;
+		}();
+	int frames = argc > 1 ? std::stoi(argv[1]) : 100;
+
+	bench_screen_t screen;
+	std::shared_ptr<swegl::pixel_shader_t> pixel_shader = std::make_shared<swegl::pixel_shader_light_and_texture<swegl::pixel_shader_lights_flat, swegl::pixel_shader_texture>>();
+	bench_viewport_t viewport(screen, pixel_shader);
+	viewport.m_camera.translate(1,2,-5);
+	viewport.m_camera.rotate_y(-0.2);
+	viewport.m_camera.rotate_x(-0.3);
+
+	auto run = [&](const char * name)
+		{
+			swegl::render(scene, viewport); // warm up
+
+			size_t pixels = 0;
+			double total_seconds = 0;
+			for (int i=0 ; i<frames ; i++)
+			{
+				scene.animate(i / 30.0f);
+				total_seconds += seconds([&]() { swegl::render(scene, viewport); });
+				// pixels that received a depth
+				for (int k=0 ; k<viewport.m_w*viewport.m_h ; k++)
+					if (viewport.zbuffer()[k] < 1e30f)
+						pixels++;
+			}
+			printf("%-24s %8.3f ms/frame %10.2f Mpixels/s %8zu triangles %8zu spans rejected by hi-z (last frame)\n", name, 1000*total_seconds/frames, pixels/total_seconds/1000000
+			      , viewport.m_hierarchical_z.m_rejected_triangles.load(), viewport.m_hierarchical_z.m_rejected_spans.load());
+		};
+
+	for (bool tiled : {false, true})
+	{
+		if (tiled)
+			viewport.set_tiled_rendering(64, std::thread::hardware_concurrency());
+		for (auto rasterizer : {swegl::viewport_t::SCANLINE, swegl::viewport_t::HALFSPACE})
+			for (bool hierarchical_z : {false, true})
+			{
+				viewport.set_rasterizer(rasterizer);
+				viewport.set_hierarchical_z(hierarchical_z);
+				std::string name = rasterizer == swegl::viewport_t::SCANLINE ? "scanline" : "halfspace";
+				if (tiled)
+					name += ", tiled";
+				if (hierarchical_z)
+					name += ", hi-z";
+				run(name.c_str());
+			}
+	}
+
+	return 0;
+}
@@ -0,0 +1,116 @@
+
+#include "headers.hpp"
+
+#include <string>
+#include <vector>
+
+#include <swegl/swegl.hpp>
+#include <swegl/data/model.hpp>
+#include <swegl/render/renderer.hpp>
+#include <swegl/render/pixel_shaders.hpp>
+#include <swegl/render/post_shaders.hpp>
+
+#include "bench_common.hpp"
+
+// The depth-only rasterizer, as a z-prepass and for the sun's shadows: a floor covered with spheres under the sun.
+// - the depth of a frame alone, render_depth(), then frame times without and with a z-prepass for each shader, with the
+//   pixels that differ: a few, where triangles are as near: the last one drawn shows rather than the first.
+// - frame times without sun shadows, then with 1 and 3 cascades of maps of 512 to 2048 texels, the maps alone, and the
+//   pixels that got darker.
+// usage: bench_shadows [frames]
+
+swegl::scene_t build_scene()
+{
+	swegl::scene_t s;
+
+	s.materials.push_back(swegl::material_t{swegl::pixel_colors{200,200,200,255}, 1, 1, -1});
+
+	s.ambient_light_intensity = 0.2f;
+	s.sun_direction = swegl::normal_t{1.0, -2.0, -0.5};
+	s.sun_intensity = 0.8;
+	s.point_source_lights.emplace_back(swegl::point_source_light{{0, 3, 0}, 1});
+
+	auto floor = swegl::make_cube(1.0f, 0);
+	floor.scale = swegl::vertex_t(40.0f, 0.1f, 40.0f);
+	floor.translation = swegl::vertex_t(0.0f, -0.6f, 0.0f);
+	s.nodes.emplace_back(std::move(floor));
+	for (int x=-10 ; x<10 ; x++)
+		for (int z=-10 ; z<10 ; z++)
+		{
+			auto sphere = swegl::make_sphere(16, 0.5f, 0);
+			sphere.translation = swegl::vertex_t(x * 2.0f + 1, (x + z) % 3 * 0.5f, z * 2.0f + 1);
+			s.nodes.emplace_back(std::move(sphere));
+		}
+	for (int i=0 ; i<(int)s.nodes.size() ; i++)
+		s.root_nodes.push_back(i);
+
+	return s;
+}
+
+int main(int argc, char ** argv)
+{
+	int frames = argc > 1 ? std::stoi(argv[1]) : 10;
+
+	swegl::scene_t scene = build_scene();
+
+	bench_screen_t screen;
+
+	std::pair<const char *, std::shared_ptr<swegl::pixel_shader_t>> shaders[] = {
+		{"flat",    std::make_shared<swegl::pixel_shader_lights_flat   >()},
+		{"gouraud", std::make_shared<swegl::pixel_shader_lights_gouraud>()},
+		{"phong",   std::make_shared<swegl::pixel_shader_lights_phong  >()},
+	};
+	auto make_viewport = [&](std::shared_ptr<swegl::pixel_shader_t> & pixel_shader)
+		{
+			auto viewport = std::make_unique<bench_viewport_t>(screen, pixel_shader);
+			viewport->m_camera.translate(0, 3, -12);
+			viewport->m_camera.rotate_x(-0.4);
+			return viewport;
+		};
+	auto ms_per_frame = [&](auto && f) { return ms_per_call(frames, f); };
+	auto image = [&]()
+		{
+			const unsigned int * pixels = (const unsigned int *) screen.surface->pixels;
+			return std::vector<unsigned int>(pixels, pixels + screen.surface->w * screen.surface->h);
+		};
+
+	for (auto & [name, pixel_shader] : shaders)
+	{
+		printf("%-7s", name);
+		std::vector<unsigned int> images[2];
+		for (bool z_prepass : {false, true})
+		{
+			auto viewport = make_viewport(pixel_shader);
+			viewport->set_z_prepass(z_prepass);
+			if (z_prepass)
+				printf("  depth only %8.3f ms", ms_per_frame([&]() { swegl::render_depth(scene, *viewport); }));
+			printf("  %s %8.3f ms", z_prepass ? "z-prepass" : "frame", ms_per_frame([&]() { swegl::render(scene, *viewport); }));
+			images[z_prepass] = image();
+		}
+		size_t differences = 0;
+		for (size_t i=0 ; i<images[0].size() ; i++)
+			differences += images[0][i] != images[1][i];
+		printf("  %zu pixels differ\n", differences);
+	}
+
+	for (auto & [name, pixel_shader] : shaders)
+	{
+		auto viewport = make_viewport(pixel_shader);
+		printf("%-7s  no shadows %8.3f ms\n", name, ms_per_frame([&]() { swegl::render(scene, *viewport); }));
+		std::vector<unsigned int> unshadowed = image();
+		for (int cascades : {1, 3})
+			for (int size : {512, 1024, 2048})
+			{
+				viewport->set_sun_shadows(size, cascades, 30);
+				double frame_ms = ms_per_frame([&]() { swegl::render(scene, *viewport); });
+				std::vector<unsigned int> shadowed = image();
+				size_t darker = 0;
+				for (size_t i=0 ; i<shadowed.size() ; i++)
+					darker += shadowed[i] != unshadowed[i];
+				printf("%-7s  %d x %4d %8.3f ms  maps %8.3f ms  %5.1f%% pixels darker\n", name, cascades, size, frame_ms
+				      , ms_per_frame([&]() { swegl::render_sun_shadows(scene, *viewport); }), 100.0 * darker / shadowed.size());
+			}
+	}
+
+	return 0;
+}
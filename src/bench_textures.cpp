@@ -0,0 +1,224 @@
+
+#include "headers.hpp"
+
+#include <cmath>
+#include <vector>
+#include <string>
+
+#include <swegl/swegl.hpp>
+#include <swegl/data/model.hpp>
+#include <swegl/render/renderer.hpp>
+#include <swegl/render/pixel_shaders.hpp>
+#include <swegl/render/post_shaders.hpp>
+
+#include "bench_common.hpp"
+
+// Texture sampling, for nearest and bilinear sampling:
+// - a sphere wrapped in a 2048x1024 texture, like a mercator map, seen from farther and farther away.
+//   Frame times with the full mipmap chain and with level 0 only.
+// - the same sphere with a 1500x750 texture, wrapped with divisions, and resampled to 2048x1024, wrapped with masks.
+// - the same sphere with the texture compressed to BC1 and BC3: memory, mean error and frame times.
+// - texel fetches alone for a 800x600 view of a 2048x2048 texture, about a texel per pixel, rolled by different angles:
+//   rows of pixels go across rows of texels. Pixels per second with row-major and 4x4 tiled texels.
+// - bilinear filtering alone, in floats as the shader used to and with bilinear_filter(), and the largest difference.
+// usage: bench_textures [frames]
+
+swegl::texture_t make_texture(int w, int h)
+{
+	unsigned int * data = new unsigned int[w * h];
+	unsigned int seed = 12345;
+	for (int y=0 ; y<h ; y++)
+		for (int x=0 ; x<w ; x++)
+		{
+			seed = seed * 1103515245 + 12345;
+			unsigned char noise = seed >> 24;
+			unsigned char checker = ((x / 32) + (y / 32)) % 2 ? 200 : 60;
+			data[y*w + x] = swegl::pixel_colors(checker, noise, (unsigned char)(x * 255 / w), 255).to_int();
+		}
+	return swegl::texture_t(data, w, h);
+}
+
+// what the samplers fetch for each pixel of a w x h view rolled by angle, 1 texel per pixel, wrapping around
+template<bool bilinear>
+unsigned int fetch(const swegl::mipmap_t & mipmap, float angle, int w, int h)
+{
+	const swegl::texel_addressing_t & addressing = mipmap.m_addressing;
+	const float du = std::cos(angle), dv = std::sin(angle);
+	unsigned int sum = 0;
+	for (int y=0 ; y<h ; y++)
+	{
+		float u = 1000 - y * dv;
+		float v = 1000 + y * du;
+		for (int x=0 ; x<w ; x++, u+=du, v+=dv)
+		{
+			unsigned int u1 = (unsigned int)u % mipmap.m_width;
+			unsigned int v1 = (unsigned int)v % mipmap.m_height;
+			if ( ! bilinear)
+			{
+				sum += mipmap.m_bitmap[addressing.row(v1) + addressing.column(u1)];
+				continue;
+			}
+			unsigned int u2 = u1+1 == mipmap.m_width  ? 0 : u1+1;
+			unsigned int v2 = v1+1 == mipmap.m_height ? 0 : v1+1;
+			unsigned int r1 = addressing.row(v1), r2 = addressing.row(v2);
+			unsigned int c1 = addressing.column(u1), c2 = addressing.column(u2);
+			sum += mipmap.m_bitmap[r1 + c1] + mipmap.m_bitmap[r1 + c2] + mipmap.m_bitmap[r2 + c1] + mipmap.m_bitmap[r2 + c2];
+		}
+	}
+	return sum;
+}
+
+swegl::scene_t build_scene(swegl::texture_t && texture)
+{
+	swegl::scene_t s;
+
+	s.images.emplace_back(std::move(texture));
+	s.materials.push_back(swegl::material_t{swegl::pixel_colors{128,128,128,255}, 1, 1, 0});
+
+	s.ambient_light_intensity = 0.2f;
+	s.sun_direction = swegl::normal_t{1.0, -1.0, -1.0};
+	s.sun_intensity = 0.8;
+
+	auto sphere = swegl::make_sphere(100, 2.0f, 0);
+	s.nodes.emplace_back(std::move(sphere));
+	s.root_nodes.push_back(0);
+
+	return s;
+}
+
+int main(int argc, char ** argv)
+{
+	int frames = argc > 1 ? std::stoi(argv[1]) : 50;
+
+	bench_screen_t screen;
+
+	std::pair<const char *, std::shared_ptr<swegl::pixel_shader_t>> shaders[] = {
+		{"nearest",  std::make_shared<swegl::pixel_shader_light_and_texture<swegl::pixel_shader_lights_flat, swegl::pixel_shader_texture         >>()},
+		{"bilinear", std::make_shared<swegl::pixel_shader_light_and_texture<swegl::pixel_shader_lights_flat, swegl::pixel_shader_texture_bilinear>>()},
+	};
+	auto frame_ms = [&](swegl::scene_t & scene, std::shared_ptr<swegl::pixel_shader_t> & pixel_shader, float distance)
+		{
+			bench_viewport_t viewport(screen, pixel_shader);
+			viewport.m_camera.translate(0, 0, -distance);
+			return ms_per_call(frames, [&]() { swegl::render(scene, viewport); });
+		};
+
+	{
+		swegl::texture_t level_0 = make_texture(2048, 1024);
+		level_0.m_mipmaps.resize(1);
+		swegl::scene_t scenes[] = { build_scene(std::move(level_0)), build_scene(make_texture(2048, 1024)) };
+		for (auto & [name, pixel_shader] : shaders)
+			for (float distance : {5.0f, 10.0f, 20.0f, 40.0f})
+				printf("%-8s distance %4.0f  level 0 %8.3f ms  mipmaps %8.3f ms\n", name, distance, frame_ms(scenes[0], pixel_shader, distance), frame_ms(scenes[1], pixel_shader, distance));
+	}
+	{
+		swegl::texture_t resampled = make_texture(1500, 750);
+		resampled.resample_to_power_of_two();
+		swegl::scene_t scenes[] = { build_scene(make_texture(1500, 750)), build_scene(std::move(resampled)) };
+		for (auto & [name, pixel_shader] : shaders)
+			for (float distance : {5.0f, 10.0f})
+				printf("%-8s distance %4.0f  1500x750 %8.3f ms  2048x1024 %8.3f ms\n", name, distance, frame_ms(scenes[0], pixel_shader, distance), frame_ms(scenes[1], pixel_shader, distance));
+	}
+	{
+		swegl::mipmap_t::layout_t layouts[] = { swegl::mipmap_t::ROW_MAJOR, swegl::mipmap_t::BC1, swegl::mipmap_t::BC3 };
+		const char * layout_names[] = { "BGRA", "BC1", "BC3" };
+		swegl::texture_t original = make_texture(2048, 1024);
+		for (int l=0 ; l<3 ; l++)
+		{
+			swegl::texture_t texture = make_texture(2048, 1024);
+			texture.set_layout(layouts[l]);
+			size_t bytes = texture.bytes();
+
+			// error of level 0
+			const swegl::mipmap_t & a = *original.m_mipmaps[0];
+			const swegl::mipmap_t & b = *texture.m_mipmaps[0];
+			swegl::block_cache_t cache;
+			double error = 0;
+			for (unsigned int y=0 ; y<a.m_height ; y++)
+				for (unsigned int x=0 ; x<a.m_width ; x++)
+				{
+					unsigned int texel = b.compressed() ? cache.texel(b, x, y) : b.texel(x, y);
+					for (int c=0 ; c<3 ; c++)
+						error += std::abs(((const unsigned char*)&a.texel(x, y))[c] - ((const unsigned char*)&texel)[c]);
+				}
+
+			swegl::scene_t scene = build_scene(std::move(texture));
+			printf("%-4s %6.2f MB  mean error %5.2f", layout_names[l], bytes / 1048576.0, error / (3.0 * a.m_width * a.m_height));
+			for (auto & [name, pixel_shader] : shaders)
+				for (float distance : {5.0f, 10.0f})
+					printf("  %s %2.0f %7.3f ms", name, distance, frame_ms(scene, pixel_shader, distance));
+			printf("\n");
+		}
+	}
+
+	swegl::texture_t textures[] = { make_texture(2048, 2048), make_texture(2048, 2048) };
+	textures[1].set_layout(swegl::mipmap_t::TILED_4X4);
+	unsigned int checksum[2] = {0, 0};
+	for (bool bilinear : {false, true})
+		for (float degrees : {0.0f, 30.0f, 60.0f, 90.0f})
+		{
+			printf("%-8s roll %3.0f", bilinear ? "bilinear" : "nearest", degrees);
+			for (int t=0 ; t<2 ; t++)
+			{
+				const swegl::mipmap_t & mipmap = *textures[t].m_mipmaps[0];
+				float angle = degrees * 3.14159265f / 180;
+				const int w = screen.surface->w, h = screen.surface->h;
+				double fetch_seconds = seconds([&]()
+					{
+						for (int i=0 ; i<frames ; i++)
+							checksum[t] += bilinear ? fetch<true>(mipmap, angle, w, h) : fetch<false>(mipmap, angle, w, h);
+					});
+				printf("  %s %7.1f Mpixels/s", t == 0 ? "row-major" : "tiled 4x4", (double)w * h * frames / fetch_seconds / 1e6);
+			}
+			printf("\n");
+		}
+	if (checksum[0] != checksum[1])
+		printf("layouts fetched different texels\n");
+
+	{
+		const int count = 1 << 16;
+		std::vector<swegl::pixel_colors> texels(count + 3);
+		std::vector<std::pair<float,float>> weights(count);
+		unsigned int seed = 12345;
+		for (auto & texel : texels)
+			texel = swegl::pixel_colors(seed = seed * 1103515245 + 12345);
+		for (auto & [fx, fy] : weights)
+		{
+			fx = ((seed = seed * 1103515245 + 12345) >> 8) / float(1 << 24);
+			fy = ((seed = seed * 1103515245 + 12345) >> 8) / float(1 << 24);
+		}
+		std::vector<swegl::pixel_colors> floats(count), fixed(count);
+		const int repeat = frames * 10;
+
+		double float_seconds = seconds([&]()
+			{
+				for (int r=0 ; r<repeat ; r++)
+					for (int i=0 ; i<count ; i++)
+					{
+						auto [fx, fy] = weights[i];
+						floats[i] = (texels[i  ] * ((1-fx) * (1-fy)))
+						          + (texels[i+1] * (   fx  * (1-fy)))
+						          + (texels[i+2] * ((1-fx) *    fy ))
+						          + (texels[i+3] * (   fx  *    fy ));
+					}
+			});
+		double fixed_seconds = seconds([&]()
+			{
+				for (int r=0 ; r<repeat ; r++)
+					for (int i=0 ; i<count ; i++)
+					{
+						auto [fx, fy] = weights[i];
+						fixed[i] = swegl::bilinear_filter(texels[i], texels[i+1], texels[i+2], texels[i+3], fx, fy);
+					}
+			});
+
+		int max_difference = 0;
+		for (int i=0 ; i<count ; i++)
+			for (int c=0 ; c<4 ; c++)
+				max_difference = std::max(max_difference, std::abs(((unsigned char*)&floats[i])[c] - ((unsigned char*)&fixed[i])[c]));
+		printf("bilinear filter  floats %7.1f Mtexels/s  fixed point %7.1f Mtexels/s  largest difference %d\n"
+		      , (double)count * repeat / float_seconds / 1e6, (double)count * repeat / fixed_seconds / 1e6, max_difference);
+	}
+
+	return 0;
+}
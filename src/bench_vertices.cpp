@@ -0,0 +1,93 @@
+
+#include "headers.hpp"
+
+#include <string>
+
+#include <swegl/swegl.hpp>
+#include <swegl/data/model.hpp>
+#include <swegl/data/gltf.hpp>
+#include <swegl/render/viewport.hpp>
+#include <swegl/render/vertex_shaders.hpp>
+#include <swegl/render/pixel_shaders.hpp>
+
+#include "bench_common.hpp"
+
+// Vertex transform throughput: every vertex of a mesh to viewport coordinates, one at a time with transform_vertex()
+// versus 4 at a time with transform_vertices(). Checks that both give the same results.
+// usage: bench_vertices [iterations] [scene.glb]
+
+int main(int argc, char ** argv)
+{
+	int iterations = argc > 1 ? std::stoi(argv[1]) : 200;
+	const char * scene_path = argc > 2 ? argv[2] : "resources/BrainStem.glb";
+
+	swegl::scene_t sphere_scene;
+	sphere_scene.nodes.emplace_back(swegl::make_sphere(100, 2.0f, 0));
+	sphere_scene.root_nodes.push_back(0);
+
+	swegl::scene_t gltf_scene = swegl::load_scene(scene_path);
+
+	bench_screen_t screen;
+	std::shared_ptr<swegl::pixel_shader_t> pixel_shader = std::make_shared<swegl::pixel_shader_lights_flat>();
+	bench_viewport_t viewport(screen, pixel_shader);
+	viewport.m_camera.translate(1,2,-5);
+	viewport.m_camera.rotate_y(-0.2);
+	viewport.m_camera.rotate_x(-0.3);
+
+	auto run = [&](const char * name, swegl::scene_t & scene)
+		{
+			swegl::vertex_shader_t::original_to_world(scene);
+
+			size_t vertex_count = 0;
+			for (const auto & node : scene.nodes)
+				for (const auto & primitive : node.primitives)
+					vertex_count += primitive.vertices.size();
+			std::vector<swegl::transformed_vertex_t> scalar(vertex_count);
+			std::vector<swegl::transformed_vertex_t> batch (vertex_count);
+
+			auto time = [&](auto && transform_primitive)
+				{
+					auto transform_scene = [&]()
+						{
+							size_t offset = 0;
+							for (const auto & node : scene.nodes)
+							{
+								const swegl::matrix44_t normal_matrix = swegl::scale(node.rotation, node.scale);
+								for (const auto & primitive : node.primitives)
+								{
+									transform_primitive(node, normal_matrix, primitive.vertices, offset);
+									offset += primitive.vertices.size();
+								}
+							}
+						};
+					return ms_per_call(iterations, transform_scene) / 1000;
+				};
+
+			double scalar_seconds = time([&](const swegl::node_t & node, const swegl::matrix44_t & normal_matrix, const swegl::vertex_streams_t & vertices, size_t offset)
+				{
+					for (size_t i=0 ; i<vertices.size() ; i++)
+						swegl::vertex_shader_t::transform_vertex(vertices, i, node.original_to_world_matrix, normal_matrix, viewport, scalar[offset+i]);
+				});
+			double batch_seconds = time([&](const swegl::node_t & node, const swegl::matrix44_t & normal_matrix, const swegl::vertex_streams_t & vertices, size_t offset)
+				{
+					swegl::vertex_shader_t::transform_vertices(vertices, 0, vertices.size(), node.original_to_world_matrix, normal_matrix, viewport, &batch[offset]);
+				});
+
+			auto same = [](const auto & a, const auto & b) { return a.x() == b.x() && a.y() == b.y() && a.z() == b.z(); };
+			size_t mismatches = 0;
+			for (size_t i=0 ; i<vertex_count ; i++)
+				if ( ! (same(scalar[i].v_world, batch[i].v_world) && same(scalar[i].v_viewport, batch[i].v_viewport) && same(scalar[i].normal_world, batch[i].normal_world)))
+					mismatches++;
+
+			printf("%-12s %8zu vertices  scalar %8.3f ms %8.2f Mvertices/s  batch %8.3f ms %8.2f Mvertices/s  speedup %5.2fx  %zu mismatches\n"
+			      , name, vertex_count
+			      , 1000*scalar_seconds, vertex_count/scalar_seconds/1000000
+			      , 1000*batch_seconds , vertex_count/batch_seconds /1000000
+			      , scalar_seconds / batch_seconds, mismatches);
+		};
+
+	run("sphere(100)", sphere_scene);
+	run(scene_path, gltf_scene);
+
+	return 0;
+}
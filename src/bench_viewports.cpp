@@ -0,0 +1,105 @@
+
+#include "headers.hpp"
+
+#include <string>
+#include <vector>
+
+#include <swegl/swegl.hpp>
+#include <swegl/data/model.hpp>
+#include <swegl/misc/worker_pool.hpp>
+#include <swegl/render/renderer.hpp>
+#include <swegl/render/pixel_shaders.hpp>
+#include <swegl/render/post_shaders.hpp>
+
+#include "bench_common.hpp"
+
+// Multi-camera rendering: N small viewports looking at the scene from different angles, rendered in one render() call
+// on the worker pool, versus the sum of rendering each of them alone. Each viewport transforms the vertices it sees
+// from model to screen coordinates itself, world coordinates included: render() shares the node matrices, the lights
+// and the bounding volume hierarchy between them, not the vertices.
+// Then the same with 3 transparency layers and a translucent sphere. After each, the pixels of the viewports drawn in
+// one render() that differ from the same cameras drawn alone at the origin of another screen: a few dozen on triangle
+// edges, where screen coordinates away from the origin keep fewer bits of their fraction. Not more with transparency
+// layers: each viewport flattens them and post shades into its own part of the screen only.
+// usage: bench_viewports [frames] [viewports]
+
+int main(int argc, char ** argv)
+{
+	int frames = argc > 1 ? std::stoi(argv[1]) : 50;
+	int count  = argc > 2 ? std::stoi(argv[2]) :  4;
+
+	swegl::scene_t scene = build_textured_scene();
+	scene.materials.push_back(swegl::material_t{swegl::pixel_colors{128,255,128,100}, 1, 1, -1});
+	auto glass = swegl::make_sphere(40, 1.0f, scene.materials.size() - 1);
+	glass.translation = swegl::vertex_t(0.0f, 1.0f, 1.0f);
+	scene.nodes.emplace_back(std::move(glass));
+	scene.root_nodes.push_back(scene.nodes.size() - 1);
+
+	// all viewports share the pixel shader, the post shader and the screen
+	bench_screen_t screen;
+	std::shared_ptr<swegl::pixel_shader_t> pixel_shader = std::make_shared<swegl::pixel_shader_light_and_texture<swegl::pixel_shader_lights_phong, swegl::pixel_shader_texture_bilinear>>();
+
+	int columns = 1;
+	while (columns * columns < count)
+		columns++;
+	int rows = (count + columns - 1) / columns;
+	int w = screen.surface->w / columns;
+	int h = screen.surface->h / rows;
+
+	auto time = [&](auto && render_frame)
+		{
+			int i = 0;
+			return ms_per_call(frames, [&]()
+				{
+					scene.animate(i++ / 30.0f);
+					render_frame();
+				});
+		};
+	auto pixel = [](const SDL_Surface * surface, int x, int y) { return ((const unsigned int *) surface->pixels)[y * surface->pitch / 4 + x]; };
+
+	printf("%d viewports of %dx%d, %d pool threads + caller\n", count, w, h, swegl::worker_pool().thread_count());
+
+	for (int layers : {0, 3})
+	{
+		std::vector<std::unique_ptr<swegl::viewport_t>> owned_viewports;
+		std::vector<swegl::viewport_t*> viewports;
+		for (int i=0 ; i<count ; i++)
+		{
+			auto & viewport = owned_viewports.emplace_back(std::make_unique<swegl::viewport_t>((i%columns)*w, (i/columns)*h, w, h, screen.surface, pixel_shader, layers));
+			viewport->set_post_shader(screen.post_shader_null);
+			viewport->m_camera.rotate_y(6.28f * i / count);
+			viewport->m_camera.translate(1,2,-6);
+			viewport->m_camera.rotate_x(-0.3);
+			viewports.push_back(viewport.get());
+		}
+
+		double alone = 0;
+		for (auto * viewport : viewports)
+			alone += time([&]() { swegl::render(scene, *viewport); });
+		double together = time([&]() { swegl::render(scene, viewports); });
+
+		// the same frame both ways
+		scene.animate(0);
+		swegl::render(scene, viewports);
+		bench_screen_t reference_screen;
+		size_t differences = 0;
+		for (auto * viewport : viewports)
+		{
+			swegl::viewport_t reference(0, 0, w, h, reference_screen.surface, pixel_shader, layers);
+			reference.set_post_shader(reference_screen.post_shader_null);
+			reference.m_camera = viewport->m_camera;
+			swegl::render(scene, reference);
+			for (int y=0 ; y<h ; y++)
+				for (int x=0 ; x<w ; x++)
+					differences += pixel(reference_screen.surface, x, y) != pixel(screen.surface, viewport->m_x + x, viewport->m_y + y);
+		}
+
+		printf("%d transparency layers\n", layers);
+		printf("  %-24s %8.3f ms/frame\n", "each alone, summed", alone);
+		printf("  %-24s %8.3f ms/frame\n", "all in one render()", together);
+		printf("  %-24s %8.2fx\n", "speedup", alone / together);
+		printf("  %-24s %8zu\n", "pixels that differ", differences);
+	}
+
+	return 0;
+}
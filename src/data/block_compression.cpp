@@ -0,0 +1,227 @@
+
+#include <algorithm>
+#include <cstring>
+
+#include <swegl/data/block_compression.hpp>
+#include <swegl/render/colors.hpp>
+
+namespace swegl
+{
+
+namespace
+{
+
+inline std::uint16_t to_565(int r, int g, int b)
+{
+	return ((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | ((b * 31 + 127) / 255);
+}
+inline pixel_colors from_565(std::uint16_t c)
+{
+	int r = c >> 11, g = (c >> 5) & 0x3F, b = c & 0x1F;
+	return pixel_colors((b << 3) | (b >> 2), (g << 2) | (g >> 4), (r << 3) | (r >> 2), 255);
+}
+
+// the 4 colors of a 4-color block
+void color_palette(std::uint16_t c0, std::uint16_t c1, pixel_colors palette[4])
+{
+	palette[0] = from_565(c0);
+	palette[1] = from_565(c1);
+	palette[2] = palette[3] = pixel_colors(0, 0, 0, 255);
+	for (int c=0 ; c<3 ; c++)
+	{
+		unsigned char e0 = ((unsigned char*)&palette[0])[c];
+		unsigned char e1 = ((unsigned char*)&palette[1])[c];
+		((unsigned char*)&palette[2])[c] = (2*e0 + e1 + 1) / 3;
+		((unsigned char*)&palette[3])[c] = (e0 + 2*e1 + 1) / 3;
+	}
+}
+
+// the indices of the nearest colors of the block between c0 > c1, returns the sum of the squared errors
+int color_indices(const pixel_colors texels[16], std::uint16_t c0, std::uint16_t c1, std::uint32_t & indices)
+{
+	pixel_colors palette[4];
+	color_palette(c0, c1, palette);
+	int error = 0;
+	indices = 0;
+	for (int i=15 ; i>=0 ; i--)
+	{
+		int best = 0, best_distance = 1 << 30;
+		for (int p=0 ; p<4 ; p++)
+		{
+			int distance = 0;
+			for (int c=0 ; c<3 ; c++)
+			{
+				int d = ((const unsigned char*)&texels[i])[c] - ((unsigned char*)&palette[p])[c];
+				distance += d * d;
+			}
+			if (distance < best_distance)
+			{
+				best_distance = distance;
+				best = p;
+			}
+		}
+		indices = indices << 2 | best;
+		error += best_distance;
+	}
+	return error;
+}
+
+// BC1 with 4 colors only: c0 > c1, as BC3 always reads it
+void encode_color_block(const unsigned int texels[16], std::uint8_t block[8])
+{
+	const pixel_colors * pc = (const pixel_colors*) texels;
+
+	// the colors spread along one of the 4 diagonals of their bounding box:
+	// the channels that vary against the widest one swap ends
+	int min[3] = {255, 255, 255}, max[3] = {0, 0, 0};
+	int mean[3] = {0, 0, 0};
+	for (int i=0 ; i<16 ; i++)
+		for (int c=0 ; c<3 ; c++)
+		{
+			int value = ((const unsigned char*)&pc[i])[c];
+			min[c] = std::min(min[c], value);
+			max[c] = std::max(max[c], value);
+			mean[c] += value;
+		}
+	int widest = 0;
+	for (int c=1 ; c<3 ; c++)
+		if (max[c] - min[c] > max[widest] - min[widest])
+			widest = c;
+	bool flipped[3] = {false, false, false};
+	for (int c=0 ; c<3 ; c++)
+	{
+		if (c == widest)
+			continue;
+		int covariance = 0;
+		for (int i=0 ; i<16 ; i++)
+			covariance += (16 * ((const unsigned char*)&pc[i])[c] - mean[c]) * (16 * ((const unsigned char*)&pc[i])[widest] - mean[widest]) / 256;
+		flipped[c] = covariance < 0;
+	}
+
+	// the box itself, best for blocks of 2 colors, and the box inset by 1/16th like J.M.P. van Waveren's
+	// real-time DXT compression, best for gradients: whichever is closer
+	std::uint16_t best_c0 = 0, best_c1 = 0;
+	std::uint32_t best_indices = 0;
+	int best_error = -1;
+	for (int inset_shift : {0, 4})
+	{
+		int end0[3], end1[3];
+		for (int c=0 ; c<3 ; c++)
+		{
+			int inset = inset_shift ? (max[c] - min[c]) >> inset_shift : 0;
+			end0[c] = max[c] - inset;
+			end1[c] = min[c] + inset;
+			if (flipped[c])
+				std::swap(end0[c], end1[c]);
+		}
+		std::uint16_t c0 = to_565(end0[2], end0[1], end0[0]);
+		std::uint16_t c1 = to_565(end1[2], end1[1], end1[0]);
+		if (c0 < c1)
+			std::swap(c0, c1);
+		if (c0 == c1)
+		{
+			// indices 0, all texels on c0
+			if (c0 == 0)
+				c0 = 1; // c0 > c1 must hold, the nearest color is black anyway
+			c1 = c0 - 1;
+		}
+		std::uint32_t indices;
+		int error = color_indices(pc, c0, c1, indices);
+		if (best_error < 0 || error < best_error)
+		{
+			best_error = error;
+			best_c0 = c0;
+			best_c1 = c1;
+			best_indices = indices;
+		}
+	}
+
+	block[0] = best_c0 & 0xFF; block[1] = best_c0 >> 8;
+	block[2] = best_c1 & 0xFF; block[3] = best_c1 >> 8;
+	std::memcpy(block + 4, &best_indices, 4);
+}
+
+void decode_color_block(const std::uint8_t block[8], unsigned int texels[16], bool bc1)
+{
+	std::uint16_t c0 = block[0] | block[1] << 8;
+	std::uint16_t c1 = block[2] | block[3] << 8;
+	pixel_colors palette[4];
+	color_palette(c0, c1, palette);
+	if (bc1 && c0 <= c1)
+	{
+		// 3 colors and transparent black
+		for (int c=0 ; c<3 ; c++)
+			((unsigned char*)&palette[2])[c] = (((unsigned char*)&palette[0])[c] + ((unsigned char*)&palette[1])[c]) / 2;
+		palette[3] = pixel_colors(0, 0, 0, 0);
+	}
+	std::uint32_t indices;
+	std::memcpy(&indices, block + 4, 4);
+	for (int i=0 ; i<16 ; i++, indices >>= 2)
+		texels[i] = palette[indices & 0x3].i;
+}
+
+} // namespace
+
+void encode_bc1_block(const unsigned int texels[16], std::uint8_t block[bc1_block_bytes])
+{
+	encode_color_block(texels, block);
+}
+
+void encode_bc3_block(const unsigned int texels[16], std::uint8_t block[bc3_block_bytes])
+{
+	int a_min = 255, a_max = 0;
+	for (int i=0 ; i<16 ; i++)
+	{
+		a_min = std::min(a_min, (int)(texels[i] >> 24));
+		a_max = std::max(a_max, (int)(texels[i] >> 24));
+	}
+	// 8 alphas when a0 > a1
+	std::uint64_t indices = 0;
+	if (a_max == a_min)
+		a_min = a_max > 0 ? a_max - 1 : 0; // indices 0: all on a0
+	if (a_max > a_min)
+		for (int i=15 ; i>=0 ; i--)
+		{
+			int a = texels[i] >> 24;
+			// a0, a1, then 6 alphas from a0 to a1
+			int step = ((a_max - a) * 7 + (a_max - a_min) / 2) / (a_max - a_min);
+			int index = step == 0 ? 0 : step == 7 ? 1 : step + 1;
+			indices = indices << 3 | index;
+		}
+	block[0] = a_max;
+	block[1] = a_min;
+	for (int b=0 ; b<6 ; b++)
+		block[2+b] = (indices >> (8*b)) & 0xFF;
+
+	encode_color_block(texels, block + 8);
+}
+
+void decode_bc1_block(const std::uint8_t block[bc1_block_bytes], unsigned int texels[16])
+{
+	decode_color_block(block, texels, true);
+}
+
+void decode_bc3_block(const std::uint8_t block[bc3_block_bytes], unsigned int texels[16])
+{
+	decode_color_block(block + 8, texels, false);
+
+	int a0 = block[0], a1 = block[1];
+	unsigned char alphas[8] = {(unsigned char)a0, (unsigned char)a1};
+	if (a0 > a1)
+		for (int i=1 ; i<7 ; i++)
+			alphas[i+1] = ((7-i) * a0 + i * a1 + 3) / 7;
+	else
+	{
+		for (int i=1 ; i<5 ; i++)
+			alphas[i+1] = ((5-i) * a0 + i * a1 + 2) / 5;
+		alphas[6] = 0;
+		alphas[7] = 255;
+	}
+	std::uint64_t indices = 0;
+	for (int b=5 ; b>=0 ; b--)
+		indices = indices << 8 | block[2+b];
+	for (int i=0 ; i<16 ; i++, indices >>= 3)
+		texels[i] = (texels[i] & 0x00FFFFFF) | (unsigned int)alphas[indices & 0x7] << 24;
+}
+
+} // namespace
@@ -0,0 +1,176 @@
+
+#include <algorithm>
+
+#include <swegl/data/bvh.hpp>
+#include <swegl/data/model.hpp>
+
+namespace swegl
+{
+
+namespace
+{
+	inline float coordinate(const vertex_t & v, int axis)
+	{
+		return axis == 0 ? v.x() : axis == 1 ? v.y() : v.z();
+	}
+	inline vertex_t min(const vertex_t & a, const vertex_t & b)
+	{
+		return vertex_t(std::min(a.x(), b.x()), std::min(a.y(), b.y()), std::min(a.z(), b.z()));
+	}
+	inline vertex_t max(const vertex_t & a, const vertex_t & b)
+	{
+		return vertex_t(std::max(a.x(), b.x()), std::max(a.y(), b.y()), std::max(a.z(), b.z()));
+	}
+	inline bool operator!=(const vertex_t & a, const vertex_t & b)
+	{
+		return a.x() != b.x() || a.y() != b.y() || a.z() != b.z();
+	}
+	inline const bounding_sphere_t & bounds(const scene_t & scene, const bvh_t::item_t & item)
+	{
+		return scene.nodes[item.node_idx].primitives[item.primitive_idx].bounds_world;
+	}
+}
+
+void bvh_t::build(const scene_t & scene)
+{
+	m_nodes.clear();
+	m_items.clear();
+	m_unbounded.clear();
+	m_primitive_count = 0;
+
+	for (int node_idx=0 ; node_idx<(int)scene.nodes.size() ; node_idx++)
+		for (int primitive_idx=0 ; primitive_idx<(int)scene.nodes[node_idx].primitives.size() ; primitive_idx++)
+		{
+			m_primitive_count++;
+			item_t item{node_idx, primitive_idx};
+			if (bounds(scene, item).radius < 0)
+				m_unbounded.push_back(item);
+			else
+				m_items.push_back(item);
+		}
+
+	if ( ! m_items.empty())
+		build(scene, 0, m_items.size());
+	m_changed.resize(m_nodes.size());
+}
+
+// top-down, splitting at the median of the widest axis of the items' centers
+int bvh_t::build(const scene_t & scene, int first, int count)
+{
+	int idx = m_nodes.size();
+	m_nodes.emplace_back();
+
+	if (count <= max_leaf_size)
+	{
+		m_nodes[idx].first = first;
+		m_nodes[idx].count = count;
+		fit_leaf(scene, m_nodes[idx]);
+		return idx;
+	}
+
+	vertex_t centers_min = bounds(scene, m_items[first]).center;
+	vertex_t centers_max = centers_min;
+	for (int i=first+1 ; i<first+count ; i++)
+	{
+		centers_min = min(centers_min, bounds(scene, m_items[i]).center);
+		centers_max = max(centers_max, bounds(scene, m_items[i]).center);
+	}
+	int axis = 0;
+	for (int a=1 ; a<3 ; a++)
+		if (coordinate(centers_max, a) - coordinate(centers_min, a) > coordinate(centers_max, axis) - coordinate(centers_min, axis))
+			axis = a;
+	std::nth_element(m_items.begin()+first, m_items.begin()+first+count/2, m_items.begin()+first+count,
+		[&](const item_t & left, const item_t & right)
+		{
+			return coordinate(bounds(scene, left).center, axis) < coordinate(bounds(scene, right).center, axis);
+		});
+
+	build(scene, first, count/2);
+	int second = build(scene, first+count/2, count-count/2);
+
+	bvh_node_t & node = m_nodes[idx];
+	node.first = second;
+	node.count = 0;
+	node.min = min(m_nodes[idx+1].min, m_nodes[second].min);
+	node.max = max(m_nodes[idx+1].max, m_nodes[second].max);
+	return idx;
+}
+
+void bvh_t::fit_leaf(const scene_t & scene, bvh_node_t & node) const
+{
+	const bounding_sphere_t & b = bounds(scene, m_items[node.first]);
+	node.min = b.center + (-b.radius);
+	node.max = b.center + ( b.radius);
+	for (int i=node.first+1 ; i<node.first+node.count ; i++)
+	{
+		const bounding_sphere_t & b = bounds(scene, m_items[i]);
+		node.min = min(node.min, b.center + (-b.radius));
+		node.max = max(node.max, b.center + ( b.radius));
+	}
+}
+
+void bvh_t::refit(const scene_t & scene)
+{
+	size_t primitive_count = 0;
+	for (const auto & node : scene.nodes)
+		primitive_count += node.primitives.size();
+	if (primitive_count != m_primitive_count || m_nodes.empty())
+	{
+		build(scene);
+		return;
+	}
+
+	// children are stored after their parent
+	for (int i=(int)m_nodes.size()-1 ; i>=0 ; i--)
+	{
+		bvh_node_t & node = m_nodes[i];
+		vertex_t old_min = node.min;
+		vertex_t old_max = node.max;
+		if (node.count > 0)
+			fit_leaf(scene, node);
+		else if (m_changed[i+1] || m_changed[node.first])
+		{
+			node.min = min(m_nodes[i+1].min, m_nodes[node.first].min);
+			node.max = max(m_nodes[i+1].max, m_nodes[node.first].max);
+		}
+		m_changed[i] = node.min != old_min || node.max != old_max;
+	}
+}
+
+void bvh_t::query(const frustum_t & frustum, const scene_t & scene, std::vector<item_t> & result) const
+{
+	size_t begin = result.size();
+
+	if ( ! m_nodes.empty())
+	{
+		std::vector<int> stack{0};
+		while ( ! stack.empty())
+		{
+			int idx = stack.back();
+			stack.pop_back();
+			const bvh_node_t & node = m_nodes[idx];
+			if ( ! frustum.sees_box(node.min, node.max))
+				continue;
+			if (node.count == 0)
+			{
+				stack.push_back(node.first);
+				stack.push_back(idx+1);
+				continue;
+			}
+			for (int i=node.first ; i<node.first+node.count ; i++)
+			{
+				const bounding_sphere_t & b = bounds(scene, m_items[i]);
+				if (frustum.sees_sphere(b.center, b.radius))
+					result.push_back(m_items[i]);
+			}
+		}
+	}
+	result.insert(result.end(), m_unbounded.begin(), m_unbounded.end());
+
+	std::sort(result.begin()+begin, result.end(), [](const item_t & left, const item_t & right)
+		{
+			return left.node_idx < right.node_idx || (left.node_idx == right.node_idx && left.primitive_idx < right.primitive_idx);
+		});
+}
+
+} // namespace
@@ -3,6 +3,8 @@
 #include <cassert>
 
 #include <swegl/data/gltf.hpp>
+#include <swegl/data/mesh_optimizer.hpp>
+#include <swegl/data/lod.hpp>
 #include <json.hpp>
 
 #define assertm(exp, msg) assert(((void)msg, exp))
@@ -172,14 +174,13 @@ swegl::scene_t load_scene_json(const std::string & filename, char * file_beginni
 				assert(mesh["primitives"][i]["attributes"]["POSITION"].template get<int>() >= 0);
 				accessor_t & accessor_vertices = accessors[mesh["primitives"][i]["attributes"]["POSITION"].template get<int>()];
 
-				primitive.vertices.resize(accessor_vertices.count + 2);
-				primitive.vertices.reserve(accessor_vertices.count + 2);
+				auto & vertices = primitive.vertices;
+				vertices.resize(accessor_vertices.count);
 				for (int i=0 ; i<accessor_vertices.count ; i++)
 				{
-					auto & vertex = primitive.vertices[i];
-					vertex.v.x() = *(float*)&accessor_vertices.buffer_view.data[0+i*accessor_vertices.stride];
-					vertex.v.y() = *(float*)&accessor_vertices.buffer_view.data[4+i*accessor_vertices.stride];
-					vertex.v.z() = *(float*)&accessor_vertices.buffer_view.data[8+i*accessor_vertices.stride];
+					vertices.x[i] = *(float*)&accessor_vertices.buffer_view.data[0+i*accessor_vertices.stride];
+					vertices.y[i] = *(float*)&accessor_vertices.buffer_view.data[4+i*accessor_vertices.stride];
+					vertices.z[i] = *(float*)&accessor_vertices.buffer_view.data[8+i*accessor_vertices.stride];
 				}
 				if (mesh["primitives"][i]["attributes"].contains("NORMAL"))
 				{
@@ -188,10 +189,9 @@ swegl::scene_t load_scene_json(const std::string & filename, char * file_beginni
 					accessor_t & accessor_normals = accessors[mesh["primitives"][i]["attributes"]["NORMAL"  ].template get<int>()];
 					for (int i=0 ; i<accessor_normals.count ; i++)
 					{
-						auto & vertex = primitive.vertices[i];
-						vertex.normal.x() = *(float*)&accessor_normals.buffer_view.data[0+i*accessor_normals.stride];
-						vertex.normal.y() = *(float*)&accessor_normals.buffer_view.data[4+i*accessor_normals.stride];
-						vertex.normal.z() = *(float*)&accessor_normals.buffer_view.data[8+i*accessor_normals.stride];
+						vertices.nx[i] = *(float*)&accessor_normals.buffer_view.data[0+i*accessor_normals.stride];
+						vertices.ny[i] = *(float*)&accessor_normals.buffer_view.data[4+i*accessor_normals.stride];
+						vertices.nz[i] = *(float*)&accessor_normals.buffer_view.data[8+i*accessor_normals.stride];
 					}
 				}
 				if (mesh["primitives"][i]["attributes"].contains("TEXCOORD_0"))
@@ -201,9 +201,8 @@ swegl::scene_t load_scene_json(const std::string & filename, char * file_beginni
 					accessor_t & accessor_texcoords = accessors[mesh["primitives"][i]["attributes"]["TEXCOORD_0"].template get<int>()];
 					for (int i=0 ; i<accessor_texcoords.count ; i++)
 					{
-						auto & vertex = primitive.vertices[i];
-						vertex.tex_coords.x() = *(float*)&accessor_texcoords.buffer_view.data[4+i*accessor_texcoords.stride];
-						vertex.tex_coords.y() = *(float*)&accessor_texcoords.buffer_view.data[0+i*accessor_texcoords.stride];				
+						vertices.u[i] = *(float*)&accessor_texcoords.buffer_view.data[4+i*accessor_texcoords.stride];
+						vertices.v[i] = *(float*)&accessor_texcoords.buffer_view.data[0+i*accessor_texcoords.stride];
 					}
 				}
 
@@ -219,6 +218,8 @@ swegl::scene_t load_scene_json(const std::string & filename, char * file_beginni
 						primitive.indices.push_back(*(std::uint16_t*)&accessor_indices.buffer_view.data[i*accessor_indices.stride]);
 					}
 				}
+
+				calculate_bounds(primitive);
 			}
 		}
 	}
@@ -455,12 +456,35 @@ swegl::scene_t load_scene_gltf(const std::string & filename)
 	return load_scene_json(filename, nullptr, j, buffers);
 }
 
-swegl::scene_t load_scene(std::string filename)
+bool opaque(const texture_t & image)
+{
+	const mipmap_t & mipmap = *image.m_mipmaps[0];
+	for (unsigned int y=0 ; y<mipmap.m_height ; y++)
+		for (unsigned int x=0 ; x<mipmap.m_width ; x++)
+			if (pixel_colors(mipmap.texel(x, y)).o.a != 255)
+				return false;
+	return true;
+}
+
+swegl::scene_t load_scene(std::string filename, const load_options_t & options)
 {
 	std::string filename_lower = to_lower(filename);
-	     if (ends_with(filename_lower, "glb" )) return load_scene_glb (filename);
-	else if (ends_with(filename_lower, "gltf")) return load_scene_gltf(filename);
-	else                                        return scene_t();
+	scene_t result;
+	     if (ends_with(filename_lower, "glb" )) result = load_scene_glb (filename);
+	else if (ends_with(filename_lower, "gltf")) result = load_scene_gltf(filename);
+	// bounds are kept: the vertices dropped by the optimization were not drawn
+	if (options.optimize_meshes)
+	{
+		optimize_scene(result);
+		build_lods(result);
+	}
+	if (options.power_of_two_textures)
+		for (texture_t & image : result.images)
+			image.resample_to_power_of_two();
+	if (options.compressed_textures)
+		for (texture_t & image : result.images)
+			image.set_layout(opaque(image) ? mipmap_t::BC1 : mipmap_t::BC3);
+	return result;
 }
 
 
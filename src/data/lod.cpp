@@ -0,0 +1,312 @@
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+
+#include <swegl/data/lod.hpp>
+#include <swegl/data/mesh_optimizer.hpp>
+
+namespace swegl
+{
+
+namespace
+{
+
+// symmetric 4x4 matrix, sum of the squared distances to planes
+struct quadric_t
+{
+	double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+	double          a11 = 0, a12 = 0, a13 = 0;
+	double                   a22 = 0, a23 = 0;
+	double                            a33 = 0;
+
+	// plane n.p + d = 0, n normalized
+	void add_plane(double nx, double ny, double nz, double d)
+	{
+		a00 += nx*nx; a01 += nx*ny; a02 += nx*nz; a03 += nx*d;
+		              a11 += ny*ny; a12 += ny*nz; a13 += ny*d;
+		                            a22 += nz*nz; a23 += nz*d;
+		                                          a33 += d *d;
+	}
+	quadric_t & operator+=(const quadric_t & o)
+	{
+		a00 += o.a00; a01 += o.a01; a02 += o.a02; a03 += o.a03;
+		              a11 += o.a11; a12 += o.a12; a13 += o.a13;
+		                            a22 += o.a22; a23 += o.a23;
+		                                          a33 += o.a33;
+		return *this;
+	}
+	double error(const vertex_t & v) const
+	{
+		double x = v.x(), y = v.y(), z = v.z();
+		return std::max(0.0,   a00*x*x + 2*a01*x*y + 2*a02*x*z + 2*a03*x
+		                     + a11*y*y + 2*a12*y*z + 2*a13*y
+		                     + a22*z*z + 2*a23*z
+		                     + a33);
+	}
+};
+
+struct collapse_t
+{
+	double cost;
+	vertex_idx from, to;
+	unsigned int from_version, to_version;
+
+	bool operator<(const collapse_t & other) const { return cost > other.cost; } // cheapest first in a priority_queue
+};
+
+// Collapses the cheapest edges one at a time, a level of detail can be taken whenever enough triangles are gone.
+struct simplifier_t
+{
+	const vertex_streams_t & vertices;
+	std::vector<vertex_idx> triangles; // 3 indices per triangle, updated as vertices collapse
+	std::vector<bool> alive;
+	int alive_count;
+	std::vector<std::vector<int>> triangles_of; // may list dead triangles
+	std::vector<quadric_t> quadrics;
+	std::vector<bool> locked;
+	std::vector<bool> collapsed;
+	std::vector<unsigned int> version;
+	std::priority_queue<collapse_t> candidates;
+	double max_cost = 0;
+
+	simplifier_t(const vertex_streams_t & vertices, std::vector<vertex_idx> && triangle_list)
+		: vertices(vertices)
+		, triangles(std::move(triangle_list))
+		, alive(triangles.size()/3, true)
+		, alive_count(triangles.size()/3)
+		, triangles_of(vertices.size())
+		, quadrics(vertices.size())
+		, locked(vertices.size(), false)
+		, collapsed(vertices.size(), false)
+		, version(vertices.size(), 0)
+	{
+		std::vector<std::pair<vertex_idx,vertex_idx>> edges;
+		edges.reserve(triangles.size());
+		for (int t=0 ; t<(int)triangles.size()/3 ; t++)
+		{
+			vertex_idx * v = &triangles[3*t];
+			vector_t n = cross_product(vertices.position(v[0]), vertices.position(v[1]), vertices.position(v[2]));
+			double len = n.len();
+			quadric_t q;
+			if (len > 0)
+			{
+				double nx = n.x()/len, ny = n.y()/len, nz = n.z()/len;
+				q.add_plane(nx, ny, nz, -(nx*vertices.x[v[0]] + ny*vertices.y[v[0]] + nz*vertices.z[v[0]]));
+			}
+			for (int k=0 ; k<3 ; k++)
+			{
+				triangles_of[v[k]].push_back(t);
+				quadrics[v[k]] += q;
+				edges.emplace_back(std::min(v[k], v[(k+1)%3]), std::max(v[k], v[(k+1)%3]));
+			}
+		}
+
+		// an edge of a single triangle is on a border
+		std::sort(edges.begin(), edges.end());
+		for (size_t i=0 ; i<edges.size() ; )
+		{
+			size_t j = i;
+			while (j < edges.size() && edges[j] == edges[i])
+				j++;
+			if (j - i == 1)
+			{
+				locked[edges[i].first ] = true;
+				locked[edges[i].second] = true;
+			}
+			i = j;
+		}
+		edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+		for (auto [a, b] : edges)
+		{
+			push(a, b);
+			push(b, a);
+		}
+	}
+
+	static vector_t cross_product(const vertex_t & v0, const vertex_t & v1, const vertex_t & v2)
+	{
+		vector_t a = v1 - v0;
+		vector_t b = v2 - v0;
+		return vector_t(a.y()*b.z() - a.z()*b.y(), a.z()*b.x() - a.x()*b.z(), a.x()*b.y() - a.y()*b.x());
+	}
+
+	void push(vertex_idx from, vertex_idx to)
+	{
+		if (locked[from])
+			return;
+		quadric_t q = quadrics[from];
+		q += quadrics[to];
+		candidates.push(collapse_t{q.error(vertices.position(to)), from, to, version[from], version[to]});
+	}
+
+	// moving from onto to must not fold any triangle over
+	bool can_collapse(vertex_idx from, vertex_idx to) const
+	{
+		bool adjacent = false;
+		for (int t : triangles_of[from])
+		{
+			if ( ! alive[t])
+				continue;
+			const vertex_idx * v = &triangles[3*t];
+			if (v[0] == to || v[1] == to || v[2] == to)
+			{
+				adjacent = true;
+				continue;
+			}
+			vertex_t p[3], moved[3];
+			for (int k=0 ; k<3 ; k++)
+			{
+				p[k] = vertices.position(v[k]);
+				moved[k] = v[k] == from ? vertices.position(to) : p[k];
+			}
+			vector_t before = cross_product(p[0], p[1], p[2]);
+			vector_t after  = cross_product(moved[0], moved[1], moved[2]);
+			if (before.dot(after) <= 0)
+				return false;
+		}
+		return adjacent;
+	}
+
+	void collapse(vertex_idx from, vertex_idx to)
+	{
+		collapsed[from] = true;
+		version[from]++;
+		version[to]++;
+		quadrics[to] += quadrics[from];
+		for (int t : triangles_of[from])
+		{
+			if ( ! alive[t])
+				continue;
+			vertex_idx * v = &triangles[3*t];
+			if (v[0] == to || v[1] == to || v[2] == to)
+			{
+				alive[t] = false;
+				alive_count--;
+				continue;
+			}
+			for (int k=0 ; k<3 ; k++)
+				if (v[k] == from)
+					v[k] = to;
+			triangles_of[to].push_back(t);
+		}
+		triangles_of[from].clear();
+
+		// drop the dead triangles, the costs of the edges around to changed
+		auto & around = triangles_of[to];
+		around.erase(std::remove_if(around.begin(), around.end(), [&](int t) { return ! alive[t]; }), around.end());
+		for (int t : around)
+			for (int k=0 ; k<3 ; k++)
+			{
+				vertex_idx w = triangles[3*t+k];
+				if (w == to)
+					continue;
+				push(w, to);
+				push(to, w);
+			}
+	}
+
+	// collapses edges until at most target triangles are left, or nothing can collapse anymore
+	void simplify(int target)
+	{
+		while (alive_count > target && ! candidates.empty())
+		{
+			collapse_t c = candidates.top();
+			candidates.pop();
+			if (collapsed[c.from] || collapsed[c.to] || c.from_version != version[c.from] || c.to_version != version[c.to])
+				continue;
+			if ( ! can_collapse(c.from, c.to))
+				continue;
+			max_cost = std::max(max_cost, c.cost);
+			collapse(c.from, c.to);
+		}
+	}
+
+	std::vector<vertex_idx> alive_triangles() const
+	{
+		std::vector<vertex_idx> result;
+		result.reserve(alive_count*3);
+		for (size_t t=0 ; t<alive.size() ; t++)
+			if (alive[t])
+				result.insert(result.end(), &triangles[3*t], &triangles[3*t+3]);
+		return result;
+	}
+};
+
+// vertices used by the coarsest level first, then the ones the next level adds, and so on,
+// each level's in the order its triangles first use them like optimize_primitive() does
+void renumber_vertices(primitive_t & primitive)
+{
+	auto & vertices = primitive.vertices;
+	std::vector<vertex_idx> remap(vertices.size(), (vertex_idx)-1);
+	vertex_idx used = 0;
+	auto number = [&](const std::vector<vertex_idx> & indices)
+		{
+			for (vertex_idx idx : indices)
+				if (remap[idx] == (vertex_idx)-1)
+					remap[idx] = used++;
+		};
+	for (auto lod = primitive.lods.rbegin() ; lod != primitive.lods.rend() ; ++lod)
+	{
+		number(lod->indices);
+		lod->vertex_count = used;
+	}
+	number(primitive.indices);
+	for (size_t i=0 ; i<remap.size() ; i++)
+		if (remap[i] == (vertex_idx)-1)
+			remap[i] = used++;
+
+	for (auto & idx : primitive.indices)
+		idx = remap[idx];
+	for (auto & lod : primitive.lods)
+		for (auto & idx : lod.indices)
+			idx = remap[idx];
+	vertices.for_each_stream([&](auto & stream)
+		{
+			std::remove_reference_t<decltype(stream)> renumbered(stream.size());
+			for (size_t i=0 ; i<remap.size() ; i++)
+				renumbered[remap[i]] = stream[i];
+			stream.swap(renumbered);
+		});
+}
+
+} // namespace
+
+void build_lods(primitive_t & primitive, const lod_options_t & options)
+{
+	primitive.lods.clear();
+	primitive.geometry_version++;
+	std::vector<vertex_idx> triangles = triangle_list(primitive);
+	int triangle_count = triangles.size() / 3;
+	if (triangle_count < options.min_triangles)
+		return;
+
+	simplifier_t simplifier(primitive.vertices, std::move(triangles));
+	while ((int)primitive.lods.size() < options.max_levels && triangle_count >= options.min_triangles)
+	{
+		simplifier.simplify(std::max(1, (int)(triangle_count * options.ratio)));
+		// not worth a level
+		if (simplifier.alive_count > triangle_count * 0.9f)
+			break;
+		triangle_count = simplifier.alive_count;
+		primitive.lods.push_back(primitive_lod_t{optimize_triangles(simplifier.alive_triangles(), primitive.vertices, options.optimization)
+		                                        ,0
+		                                        ,(float)std::sqrt(simplifier.max_cost)
+		                                        });
+	}
+
+	if ( ! primitive.lods.empty())
+		renumber_vertices(primitive);
+}
+void build_lods(node_t & node, const lod_options_t & options)
+{
+	for (auto & primitive : node.primitives)
+		build_lods(primitive, options);
+}
+void build_lods(scene_t & scene, const lod_options_t & options)
+{
+	for (auto & node : scene.nodes)
+		build_lods(node, options);
+}
+
+} // namespace
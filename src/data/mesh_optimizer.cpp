@@ -0,0 +1,303 @@
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#include <swegl/data/mesh_optimizer.hpp>
+
+namespace swegl
+{
+
+std::vector<vertex_idx> triangle_list(const primitive_t & primitive)
+{
+	const auto & indices = primitive.indices;
+	std::vector<vertex_idx> result;
+	result.reserve(indices.size() < 3 ? 0 : 3 * (indices.size() - 2));
+	auto add = [&](vertex_idx i0, vertex_idx i1, vertex_idx i2)
+		{
+			if (i0 == i1 || i1 == i2 || i0 == i2)
+				return;
+			result.push_back(i0);
+			result.push_back(i1);
+			result.push_back(i2);
+		};
+	if (primitive.mode == primitive_t::index_mode_t::TRIANGLE_STRIP)
+		for (unsigned int i=2 ; i<indices.size() ; i++)
+			add(indices[i-2], indices[i-1+(i&0x1)], indices[i-(i&0x1)]);
+	if (primitive.mode == primitive_t::index_mode_t::TRIANGLE_FAN)
+		for (unsigned int i=2 ; i<indices.size() ; i++)
+			add(indices[0], indices[i-1], indices[i]);
+	if (primitive.mode == primitive_t::index_mode_t::TRIANGLES)
+		for (unsigned int i=2 ; i<indices.size() ; i+=3)
+			add(indices[i-2], indices[i-1], indices[i]);
+	return result;
+}
+
+namespace
+{
+
+// Tom Forsyth, Linear-speed vertex cache optimisation.
+// Greedily emits the triangle whose vertices score best: recently used vertices, and vertices with few triangles left,
+// so that no vertex is left behind with a lone triangle to be drawn much later.
+std::vector<vertex_idx> order_for_cache(const std::vector<vertex_idx> & indices, size_t vertex_count, int cache_size)
+{
+	const int triangle_count = indices.size() / 3;
+	cache_size = std::max(cache_size, 4);
+
+	// triangles of each vertex, the ones still to be emitted first
+	std::vector<int> first(vertex_count+1, 0);
+	for (int t=0 ; t<triangle_count*3 ; t++)
+		first[indices[t]+1]++;
+	std::partial_sum(first.begin(), first.end(), first.begin());
+	std::vector<int> remaining(vertex_count);
+	for (size_t v=0 ; v<vertex_count ; v++)
+		remaining[v] = first[v+1] - first[v];
+	std::vector<int> triangles_of(triangle_count*3);
+	{
+		std::vector<int> fill(first.begin(), first.end()-1);
+		for (int t=0 ; t<triangle_count*3 ; t++)
+			triangles_of[fill[indices[t]]++] = t/3;
+	}
+
+	std::vector<int> cache_position(vertex_count, -1);
+	std::vector<float> vertex_score(vertex_count);
+	auto score = [&](int v)
+		{
+			if (remaining[v] == 0)
+				return -1.0f;
+			float s = 0;
+			int p = cache_position[v];
+			if (p >= 0)
+				// the last triangle's vertices get a fixed score, not to favour a triangle using them
+				s = p < 3 ? 0.75f : std::pow(1.0f - (p-3) / float(cache_size-3), 1.5f);
+			return s + 2.0f / std::sqrt((float)remaining[v]);
+		};
+	for (size_t v=0 ; v<vertex_count ; v++)
+		vertex_score[v] = score(v);
+
+	std::vector<float> triangle_score(triangle_count);
+	std::vector<bool> emitted(triangle_count, false);
+	for (int t=0 ; t<triangle_count ; t++)
+		triangle_score[t] = vertex_score[indices[3*t]] + vertex_score[indices[3*t+1]] + vertex_score[indices[3*t+2]];
+
+	std::vector<int> cache, next_cache;
+	cache.reserve(cache_size+3);
+	next_cache.reserve(cache_size+3);
+
+	std::vector<vertex_idx> result;
+	result.reserve(triangle_count*3);
+
+	int best = triangle_count > 0 ? std::max_element(triangle_score.begin(), triangle_score.end()) - triangle_score.begin() : -1;
+	int cursor = 0; // no triangle before it is left to emit
+	while (best >= 0)
+	{
+		emitted[best] = true;
+		next_cache.clear();
+		for (int k=0 ; k<3 ; k++)
+		{
+			vertex_idx v = indices[3*best+k];
+			result.push_back(v);
+			next_cache.push_back(v);
+			// move best past the triangles left to emit
+			int * tris = &triangles_of[first[v]];
+			int n = remaining[v]--;
+			std::swap(*std::find(tris, tris+n, best), tris[n-1]);
+		}
+		for (int v : cache)
+			if (std::find(next_cache.begin(), next_cache.begin()+3, v) == next_cache.begin()+3)
+				next_cache.push_back(v);
+		std::swap(cache, next_cache);
+
+		// the evicted vertices are still in next_cache
+		for (int i=0 ; i<(int)cache.size() ; i++)
+			cache_position[cache[i]] = i < cache_size ? i : -1;
+		for (int v : cache)
+		{
+			float s = score(v);
+			float delta = s - vertex_score[v];
+			vertex_score[v] = s;
+			for (int i=0 ; i<remaining[v] ; i++)
+				triangle_score[triangles_of[first[v]+i]] += delta;
+		}
+
+		best = -1;
+		float best_score = -1;
+		for (int i=0 ; i<std::min((int)cache.size(), cache_size) ; i++)
+		{
+			int v = cache[i];
+			for (int k=0 ; k<remaining[v] ; k++)
+			{
+				int t = triangles_of[first[v]+k];
+				if (triangle_score[t] > best_score)
+				{
+					best_score = triangle_score[t];
+					best = t;
+				}
+			}
+		}
+		if ((int)cache.size() > cache_size)
+			cache.resize(cache_size);
+		if (best < 0)
+		{
+			// nothing left around the cache, start over anywhere
+			while (cursor < triangle_count && emitted[cursor])
+				cursor++;
+			if (cursor < triangle_count)
+				best = cursor;
+		}
+	}
+	return result;
+}
+
+// Sander, Nehab & Barczak, Fast triangle reordering for vertex locality and reduced overdraw.
+// The cache-ordered triangles are cut into clusters, clusters whose surface faces away from the mesh's center come first:
+// from most points of view they hide the others.
+std::vector<vertex_idx> order_for_overdraw(const std::vector<vertex_idx> & indices, const vertex_streams_t & vertices, int cluster_size)
+{
+	const int triangle_count = indices.size() / 3;
+	cluster_size = std::max(cluster_size, 1);
+	const int cluster_count = (triangle_count + cluster_size - 1) / cluster_size;
+	if (cluster_count < 2)
+		return indices;
+
+	// area weighted centroids and normals
+	const vertex_t origin(0,0,0);
+	std::vector<vertex_t> centroids(cluster_count, origin);
+	std::vector<vector_t> normals  (cluster_count, vector_t(0,0,0));
+	std::vector<float>    areas    (cluster_count, 0);
+	vertex_t center = origin;
+	float total_area = 0;
+	for (int t=0 ; t<triangle_count ; t++)
+	{
+		vertex_t v0 = vertices.position(indices[3*t  ]);
+		vertex_t v1 = vertices.position(indices[3*t+1]);
+		vertex_t v2 = vertices.position(indices[3*t+2]);
+		vector_t a = v1 - v0;
+		vector_t b = v2 - v0;
+		vector_t n(a.y()*b.z() - a.z()*b.y(), a.z()*b.x() - a.x()*b.z(), a.x()*b.y() - a.y()*b.x());
+		float area = n.len();
+		vertex_t centroid = (v0 + v1 + v2) / 3;
+		int c = t / cluster_size;
+		centroids[c] = centroids[c] + (centroid - origin) * area;
+		normals  [c] = normals  [c] + n;
+		areas    [c] += area;
+		center = center + (centroid - origin) * area;
+		total_area += area;
+	}
+	if (total_area == 0)
+		return indices;
+	center = center / total_area;
+
+	std::vector<float> key(cluster_count, 0);
+	float orientation = 0;
+	for (int c=0 ; c<cluster_count ; c++)
+	{
+		if (areas[c] == 0)
+			continue;
+		vector_t outwards = centroids[c] / areas[c] - center;
+		orientation += outwards.dot(normals[c]);
+		key[c] = outwards.dot(vector_t(normals[c]).normalize());
+	}
+	// the winding decides whether normals point outwards, the whole mesh tells which
+	if (orientation < 0)
+		for (float & k : key)
+			k = -k;
+
+	std::vector<int> order(cluster_count);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return key[a] > key[b]; });
+
+	std::vector<vertex_idx> result;
+	result.reserve(indices.size());
+	for (int c : order)
+		result.insert(result.end(), indices.begin() + 3*c*cluster_size, indices.begin() + 3*std::min(triangle_count, (c+1)*cluster_size));
+	return result;
+}
+
+void reorder_vertices(primitive_t & primitive)
+{
+	auto & vertices = primitive.vertices;
+	std::vector<vertex_idx> remap(vertices.size(), (vertex_idx)-1);
+	vertex_idx used = 0;
+	for (auto & idx : primitive.indices)
+	{
+		if (remap[idx] == (vertex_idx)-1)
+			remap[idx] = used++;
+		idx = remap[idx];
+	}
+	vertices.for_each_stream([&](auto & stream)
+		{
+			std::remove_reference_t<decltype(stream)> reordered(used);
+			for (size_t i=0 ; i<remap.size() ; i++)
+				if (remap[i] != (vertex_idx)-1)
+					reordered[remap[i]] = stream[i];
+			stream.swap(reordered);
+		});
+}
+
+} // namespace
+
+void optimize_primitive(primitive_t & primitive, const mesh_optimization_t & options)
+{
+	if (primitive.indices.empty())
+		return;
+	if (primitive.mode != primitive_t::index_mode_t::TRIANGLES)
+	{
+		if ( ! options.strips_to_lists)
+			return;
+		primitive.indices = triangle_list(primitive);
+		primitive.mode = primitive_t::index_mode_t::TRIANGLES;
+	}
+	primitive.indices.resize(primitive.indices.size() - primitive.indices.size() % 3);
+
+	primitive.indices = optimize_triangles(std::move(primitive.indices), primitive.vertices, options);
+	if (options.reorder_vertices)
+		reorder_vertices(primitive);
+	primitive.geometry_version++;
+}
+std::vector<vertex_idx> optimize_triangles(std::vector<vertex_idx> triangles, const vertex_streams_t & vertices, const mesh_optimization_t & options)
+{
+	if (options.reorder_triangles)
+	{
+		std::vector<vertex_idx> ordered = order_for_cache(triangles, vertices.size(), options.cache_size);
+		// generated strips are often already as good as it gets
+		if (average_cache_miss_ratio(ordered, options.cache_size) < average_cache_miss_ratio(triangles, options.cache_size))
+			triangles.swap(ordered);
+	}
+	if (options.reduce_overdraw)
+		triangles = order_for_overdraw(triangles, vertices, options.cluster_size);
+	return triangles;
+}
+void optimize_node(node_t & node, const mesh_optimization_t & options)
+{
+	for (auto & primitive : node.primitives)
+		optimize_primitive(primitive, options);
+}
+void optimize_scene(scene_t & scene, const mesh_optimization_t & options)
+{
+	for (auto & node : scene.nodes)
+		optimize_node(node, options);
+}
+
+float average_cache_miss_ratio(const primitive_t & primitive, int cache_size)
+{
+	return average_cache_miss_ratio(triangle_list(primitive), cache_size);
+}
+float average_cache_miss_ratio(const std::vector<vertex_idx> & indices, int cache_size)
+{
+	if (indices.size() < 3)
+		return 0;
+	std::vector<vertex_idx> fifo(cache_size, (vertex_idx)-1);
+	int head = 0;
+	int misses = 0;
+	for (vertex_idx idx : indices)
+		if (std::find(fifo.begin(), fifo.end(), idx) == fifo.end())
+		{
+			misses++;
+			fifo[head] = idx;
+			head = (head+1) % cache_size;
+		}
+	return misses / float(indices.size() / 3);
+}
+
+} // namespace
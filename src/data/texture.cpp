@@ -1,7 +1,10 @@
 
 #include <memory>
+#include <algorithm>
+#include <cmath>
 #include <stdio.h>
 #include <swegl/data/texture.hpp>
+#include <swegl/data/block_compression.hpp>
 
 namespace swegl
 {
@@ -19,65 +22,208 @@ namespace swegl
 	texture_t::texture_t(unsigned int * data, int w, int h)
 	{
 		m_mipmaps.push_back(std::make_shared<mipmap_t>(data, (unsigned int)w, (unsigned int)h));
+		produce_mipmaps();
 	}
 
 	void texture_t::produce_mipmaps()
 	{
-		/*
-		//Calculating mipmaps
-		unsigned int *previousbitmap;	
-		for (int mm=1 ; mm<MIPMAPS_COUNT ; mm++)
+		m_mipmaps.resize(1);
+		if (m_mipmaps[0]->m_bitmap == nullptr)
+			return;
+		// levels are built from raw texels
+		mipmap_t::layout_t layout = m_mipmaps[0]->m_layout;
+		if (m_mipmaps[0]->compressed())
+			m_mipmaps[0]->set_layout(mipmap_t::ROW_MAJOR);
+
+		while (m_mipmaps.back()->m_width > 1 || m_mipmaps.back()->m_height > 1)
 		{
-			width /= 2;
-			height /= 2;
-
-			if (mm==8)
-				mm=8;
-			if (width < 2 || height < 2) {
-				for ( ; mm<MIPMAPS_COUNT ; mm++) {
-					m_mipmaps[mm].m_width = 0;
-					m_mipmaps[mm].m_height = 0;
-					m_mipmaps[mm].m_bitmap = NULL;
+			const mipmap_t & previous = *m_mipmaps.back();
+			unsigned int sw = previous.m_width;
+			unsigned int sh = previous.m_height;
+			unsigned int width  = std::max(1u, sw / 2);
+			unsigned int height = std::max(1u, sh / 2);
+			unsigned int * bitmap = new unsigned int[width * height];
+
+			// box filter: each texel averages the 2x2 texels it covers, 3 texels wide or high
+			// on the last column or row of odd sizes so that no texel of the previous level is left out
+			for (unsigned int y=0 ; y<height ; y++)
+			{
+				unsigned int y_begin = y * sh / height;
+				unsigned int y_end   = (y+1) * sh / height;
+				for (unsigned int x=0 ; x<width ; x++)
+				{
+					unsigned int x_begin = x * sw / width;
+					unsigned int x_end   = (x+1) * sw / width;
+					unsigned int sum[4] = {0, 0, 0, 0};
+					for (unsigned int sy=y_begin ; sy<y_end ; sy++)
+						for (unsigned int sx=x_begin ; sx<x_end ; sx++)
+						{
+							const unsigned char * texel = (const unsigned char*) &previous.texel(sx, sy);
+							for (int c=0 ; c<4 ; c++)
+								sum[c] += texel[c];
+						}
+					unsigned int count = (y_end - y_begin) * (x_end - x_begin);
+					unsigned char * texel = (unsigned char*) &bitmap[y*width + x];
+					for (int c=0 ; c<4 ; c++)
+						texel[c] = (sum[c] + count/2) / count;
 				}
-				break;
 			}
+			m_mipmaps.push_back(std::make_shared<mipmap_t>(bitmap, width, height));
+		}
+		set_layout(layout);
+	}
 
-			texel_count = width*height;
-			m_mipmaps[mm].m_bitmap = new unsigned int[texel_count];
-			if (m_mipmaps[mm].m_bitmap == NULL)
+	bool texture_t::resample_to_power_of_two(float max_growth)
+	{
+		mipmap_t & base = *m_mipmaps[0];
+		if (base.m_bitmap == nullptr || base.power_of_two())
+			return false;
+		unsigned int width = 1, height = 1;
+		while (width  < base.m_width ) width  *= 2;
+		while (height < base.m_height) height *= 2;
+		if (width * height > max_growth * base.m_width * base.m_height)
+			return false;
+		mipmap_t::layout_t layout = base.m_layout;
+		if (base.compressed())
+			base.set_layout(mipmap_t::ROW_MAJOR);
+
+		// bilinear, texel centers to texel centers, wrapping around like the samplers
+		unsigned int * bitmap = new unsigned int[width * height];
+		for (unsigned int y=0 ; y<height ; y++)
+		{
+			float sy = (y + 0.5f) * base.m_height / height - 0.5f;
+			int y1 = (int)std::floor(sy);
+			float fy = sy - y1;
+			for (unsigned int x=0 ; x<width ; x++)
 			{
-				free(bitmap);
-				return texture_t(nullptr, 0, 0);;
+				float sx = (x + 0.5f) * base.m_width / width - 0.5f;
+				int x1 = (int)std::floor(sx);
+				float fx = sx - x1;
+				const unsigned char * t00 = (const unsigned char*) &base.texel(wrap_texel<false>(x1  , base.m_width), wrap_texel<false>(y1  , base.m_height));
+				const unsigned char * t10 = (const unsigned char*) &base.texel(wrap_texel<false>(x1+1, base.m_width), wrap_texel<false>(y1  , base.m_height));
+				const unsigned char * t01 = (const unsigned char*) &base.texel(wrap_texel<false>(x1  , base.m_width), wrap_texel<false>(y1+1, base.m_height));
+				const unsigned char * t11 = (const unsigned char*) &base.texel(wrap_texel<false>(x1+1, base.m_width), wrap_texel<false>(y1+1, base.m_height));
+				unsigned char * texel = (unsigned char*) &bitmap[y*width + x];
+				for (int c=0 ; c<4 ; c++)
+					texel[c] = (unsigned char)(  (t00[c] * (1-fx) + t10[c] * fx) * (1-fy)
+					                           + (t01[c] * (1-fx) + t11[c] * fx) *    fy  + 0.5f);
 			}
-			m_mipmaps[mm].m_width = width;
-			m_mipmaps[mm].m_height = height;
-			previousbitmap = m_mipmaps[mm-1].m_bitmap;
-			bitmap = m_mipmaps[mm].m_bitmap;
-				//memset(bitmap, 0, texel_count*sizeof(unsigned int));
-			for (int y=0 ; y<height ; y++)
-			{
-				for (int x=0 ; x<width ; x++)
+		}
+
+		m_mipmaps.clear();
+		m_mipmaps.push_back(std::make_shared<mipmap_t>(bitmap, width, height));
+		m_mipmaps[0]->set_layout(layout);
+		produce_mipmaps();
+		return true;
+	}
+
+	void texture_t::set_layout(mipmap_t::layout_t layout)
+	{
+		for (auto & mipmap : m_mipmaps)
+			mipmap->set_layout(layout);
+	}
+
+	size_t texture_t::bytes() const
+	{
+		size_t result = 0;
+		for (const auto & mipmap : m_mipmaps)
+			result += mipmap->bytes();
+		return result;
+	}
+
+	size_t mipmap_t::bytes() const
+	{
+		if (m_bitmap == nullptr)
+			return 0;
+		size_t blocks = blocks_x() * ((m_height + 3) / 4);
+		switch (m_layout)
+		{
+			case BC1:       return blocks * bc1_block_bytes;
+			case BC3:       return blocks * bc3_block_bytes;
+			case TILED_4X4: return blocks * 16 * sizeof(unsigned int);
+			default:        return m_width * m_height * sizeof(unsigned int);
+		}
+	}
+
+	void mipmap_t::decode_block(unsigned int block, unsigned int texels[16]) const
+	{
+		if (m_layout == BC1)
+			decode_bc1_block((const std::uint8_t*)m_bitmap + block * bc1_block_bytes, texels);
+		else
+			decode_bc3_block((const std::uint8_t*)m_bitmap + block * bc3_block_bytes, texels);
+	}
+
+	void mipmap_t::set_layout(layout_t layout)
+	{
+		if (layout == m_layout || m_bitmap == nullptr)
+			return;
+
+		if (compressed())
+		{
+			unsigned int * bitmap = new unsigned int[m_width * m_height];
+			unsigned int texels[16];
+			for (unsigned int by=0 ; by<(m_height+3)/4 ; by++)
+				for (unsigned int bx=0 ; bx<blocks_x() ; bx++)
 				{
-					r = (int) ( (previousbitmap[(y*2  )*width*2+(x*2)] >> 16)
-							   +(previousbitmap[(y*2+1)*width*2+(x*2)] >> 16)
-							   +(previousbitmap[(y*2  )*width*2+(x*2+1)] >> 16)
-							   +(previousbitmap[(y*2+1)*width*2+(x*2+1)] >> 16)
-							  ) / 4;
-					g = (int) ( ((previousbitmap[(y*2  )*width*2+(x*2)] >> 8) & 0xFF)
-							   +((previousbitmap[(y*2+1)*width*2+(x*2)] >> 8) & 0xFF)
-							   +((previousbitmap[(y*2  )*width*2+(x*2+1)] >> 8) & 0xFF)
-							   +((previousbitmap[(y*2+1)*width*2+(x*2+1)] >> 8) & 0xFF)
-							  ) / 4;
-					b = (int) ( (previousbitmap[(y*2  )*width*2+(x*2)] & 0xFF)
-							   +(previousbitmap[(y*2+1)*width*2+(x*2)] & 0xFF)
-							   +(previousbitmap[(y*2  )*width*2+(x*2+1)] & 0xFF)
-							   +(previousbitmap[(y*2+1)*width*2+(x*2+1)] & 0xFF)
-							  ) / 4;
-				
-					bitmap[y*width+x] = (r<<16)|(g<<8)|b;
+					decode_block(by * blocks_x() + bx, texels);
+					for (unsigned int y=4*by ; y<std::min(4*by+4, m_height) ; y++)
+						for (unsigned int x=4*bx ; x<std::min(4*bx+4, m_width) ; x++)
+							bitmap[y*m_width + x] = texels[(y & 3) << 2 | (x & 3)];
 				}
-			}
+			delete[] m_bitmap;
+			m_bitmap = bitmap;
+			m_layout = ROW_MAJOR;
+			m_addressing = texel_addressing_t{0, 0, m_width};
+			if (layout == ROW_MAJOR)
+				return;
 		}
-		*/
+
+		if (layout == BC1 || layout == BC3)
+		{
+			const int block_bytes = layout == BC1 ? bc1_block_bytes : bc3_block_bytes;
+			const unsigned int blocks = blocks_x() * ((m_height + 3) / 4);
+			unsigned int * bitmap = new unsigned int[blocks * block_bytes / sizeof(unsigned int)];
+			unsigned int texels[16];
+			for (unsigned int by=0 ; by<(m_height+3)/4 ; by++)
+				for (unsigned int bx=0 ; bx<blocks_x() ; bx++)
+				{
+					// blocks over the edge repeat the last row and column
+					for (unsigned int i=0 ; i<16 ; i++)
+						texels[i] = texel(std::min(4*bx + (i & 3), m_width-1), std::min(4*by + (i >> 2), m_height-1));
+					std::uint8_t * block = (std::uint8_t*)bitmap + (by * blocks_x() + bx) * block_bytes;
+					if (layout == BC1)
+						encode_bc1_block(texels, block);
+					else
+						encode_bc3_block(texels, block);
+				}
+			delete[] m_bitmap;
+			m_bitmap = bitmap;
+			m_layout = layout;
+			return;
+		}
+
+		texel_addressing_t addressing;
+		size_t size;
+		if (layout == TILED_4X4)
+		{
+			unsigned int tiles_x = (m_width  + 3) / 4;
+			unsigned int tiles_y = (m_height + 3) / 4;
+			addressing = texel_addressing_t{2, 3, tiles_x * 16, 4, 16};
+			size = tiles_x * tiles_y * 16;
+		}
+		else
+		{
+			addressing = texel_addressing_t{0, 0, m_width};
+			size = m_width * m_height;
+		}
+
+		unsigned int * bitmap = new unsigned int[size]();
+		for (unsigned int y=0 ; y<m_height ; y++)
+			for (unsigned int x=0 ; x<m_width ; x++)
+				bitmap[addressing.row(y) + addressing.column(x)] = texel(x, y);
+		delete[] m_bitmap;
+		m_bitmap = bitmap;
+		m_layout = layout;
+		m_addressing = addressing;
 	}
 }
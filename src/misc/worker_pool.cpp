@@ -0,0 +1,101 @@
+
+#include <algorithm>
+
+#include <swegl/misc/worker_pool.hpp>
+
+namespace swegl
+{
+
+worker_pool_t::worker_pool_t(int thread_count)
+	: m_stopping(false)
+{
+	m_threads.reserve(thread_count);
+	for (int i=0 ; i<thread_count ; i++)
+		m_threads.emplace_back([this]() { worker(); });
+}
+
+worker_pool_t::~worker_pool_t()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_job_available.notify_all();
+	for (auto & t : m_threads)
+		t.join();
+}
+
+void worker_pool_t::run(int count, const std::function<void(int)> & f)
+{
+	if (count <= 0)
+		return;
+	if (count == 1 || m_threads.empty())
+	{
+		for (int i=0 ; i<count ; i++)
+			f(i);
+		return;
+	}
+
+	job_t job(f, count);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_jobs.push_back(&job);
+	}
+	m_job_available.notify_all();
+
+	work_on(job);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_job_done.wait(lock, [&]() { return job.done == job.count && job.users == 0; });
+	auto it = std::find(m_jobs.begin(), m_jobs.end(), &job);
+	if (it != m_jobs.end())
+		m_jobs.erase(it);
+}
+
+void worker_pool_t::work_on(job_t & job)
+{
+	int finished = 0;
+	for (int i = job.next++ ; i < job.count ; i = job.next++)
+	{
+		(*job.f)(i);
+		finished++;
+	}
+	if (finished > 0 && job.done.fetch_add(finished) + finished == job.count)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_job_done.notify_all();
+	}
+}
+
+void worker_pool_t::worker()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;)
+	{
+		m_job_available.wait(lock, [&]() { return m_stopping || ! m_jobs.empty(); });
+		if (m_stopping)
+			return;
+
+		job_t * job = m_jobs.front();
+		if (job->next >= job->count)
+		{
+			// every call has been started, the job's owner waits for them
+			m_jobs.pop_front();
+			continue;
+		}
+		job->users++;
+		lock.unlock();
+		work_on(*job);
+		lock.lock();
+		if (--job->users == 0)
+			m_job_done.notify_all();
+	}
+}
+
+worker_pool_t & worker_pool()
+{
+	static worker_pool_t pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+	return pool;
+}
+
+} // namespace
@@ -47,6 +47,61 @@ namespace swegl
 		this->m_viewmatrix.rotate_z(-a);
 	}
 
+	bool frustum_t::sees_sphere(const vertex_t & center, float radius) const
+	{
+		for (const plane_t & plane : planes)
+			if (plane.distance(center) < -radius)
+				return false;
+		return true;
+	}
+
+	bool frustum_t::sees_box(const vertex_t & min, const vertex_t & max) const
+	{
+		for (const plane_t & plane : planes)
+		{
+			// the corner farthest on the inner side
+			vertex_t v(plane.a > 0 ? max.x() : min.x()
+			          ,plane.b > 0 ? max.y() : min.y()
+			          ,plane.c > 0 ? max.z() : min.z());
+			if (plane.distance(v) < 0)
+				return false;
+		}
+		return true;
+	}
+
+	// After projection, pixels are drawn where z >= 0.001 and |x| <= z and |y| <= z.
+	// These are planes in camera space, moved into world space through the view matrix (a rotation and a translation).
+	frustum_t camera_t::frustum() const
+	{
+		const auto & p = m_projectionmatrix;
+		const auto & v = m_viewmatrix;
+		float camera_planes[5][4] =
+			{
+				{p[2][0]        , p[2][1]        , p[2][2]        , p[2][3] - 0.001f},
+				{p[2][0]+p[0][0], p[2][1]+p[0][1], p[2][2]+p[0][2], p[2][3]+p[0][3] },
+				{p[2][0]-p[0][0], p[2][1]-p[0][1], p[2][2]-p[0][2], p[2][3]-p[0][3] },
+				{p[2][0]+p[1][0], p[2][1]+p[1][1], p[2][2]+p[1][2], p[2][3]+p[1][3] },
+				{p[2][0]-p[1][0], p[2][1]-p[1][1], p[2][2]-p[1][2], p[2][3]-p[1][3] },
+			};
+
+		frustum_t result;
+		for (int k=0 ; k<5 ; k++)
+		{
+			const float * cp = camera_planes[k];
+			plane_t & plane = result.planes[k];
+			plane.a = cp[0]*v[0][0] + cp[1]*v[1][0] + cp[2]*v[2][0];
+			plane.b = cp[0]*v[0][1] + cp[1]*v[1][1] + cp[2]*v[2][1];
+			plane.c = cp[0]*v[0][2] + cp[1]*v[1][2] + cp[2]*v[2][2];
+			plane.d = cp[0]*v[0][3] + cp[1]*v[1][3] + cp[2]*v[2][3] + cp[3];
+			float length = sqrt(plane.a*plane.a + plane.b*plane.b + plane.c*plane.c);
+			plane.a /= length;
+			plane.b /= length;
+			plane.c /= length;
+			plane.d /= length;
+		}
+		return result;
+	}
+
 	void camera_t::translate(float x, float y, float z)
 	{
 		this->m_viewmatrix.translate(-x,-y,-z);
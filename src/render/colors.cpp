@@ -1,6 +1,7 @@
 
 #include <cassert>
 #include <cmath>
+#include <swegl/misc/fast_math.hpp>
 #include <swegl/render/colors.hpp>
 #include <xmmintrin.h>
 
@@ -17,11 +18,7 @@ pixel_colors_f operator+(const pixel_colors_f & left, const pixel_colors_f & rig
 
 
 pixel_colors::pixel_colors(const pixel_colors_f & pcf)
-	:o{(unsigned char)round(pcf.o.b)
-	  ,(unsigned char)round(pcf.o.g)
-	  ,(unsigned char)round(pcf.o.r)
-	  ,(unsigned char)round(pcf.o.a)
-	  }
+	:i(fast_to_u8(pcf.v))
 {}
 
 pixel_colors_f operator*(const pixel_colors & left, float right)
@@ -4,13 +4,108 @@
 #include <swegl/render/colors.hpp>
 #include <swegl/data/model.hpp>
 
-#ifndef _GLIBCXX_PARALLEL
-#define __gnu_parallel std
-#endif
-
 namespace swegl
 {
 
+	// the mipmap level with about one texel per pixel on the triangle
+	static const mipmap_t & triangle_mipmap(const texture_t & texture, const transformed_vertex_t & mv0, const transformed_vertex_t & mv1, const transformed_vertex_t & mv2)
+	{
+		const mipmap_t & base = *texture.m_mipmaps[0];
+		vec2f_t t1 = mv1.tex_coords - mv0.tex_coords;
+		vec2f_t t2 = mv2.tex_coords - mv0.tex_coords;
+		vector_t v1 = mv1.v_viewport - mv0.v_viewport;
+		vector_t v2 = mv2.v_viewport - mv0.v_viewport;
+		// twice the areas, the ratio is the same
+		float texel_area = fabs(t1.x()*t2.y() - t1.y()*t2.x()) * base.m_width * base.m_height;
+		float pixel_area = fabs(v1.x()*v2.y() - v1.y()*v2.x());
+		return texture.mipmap(texel_area, pixel_area);
+	}
+
+	enum class point_light_terms_t { BOTH, DIFFUSE, SPECULAR };
+
+	template<point_light_terms_t terms>
+	float point_lights(const point_source_light_range_t & lights, const vertex_t & point, const normal_t & normal, const vector_t & camera_vector)
+	{
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 cutoff = _mm_set1_ps(point_source_light::cutoff);
+		const __m128 px = _mm_set1_ps(point.x()), py = _mm_set1_ps(point.y()), pz = _mm_set1_ps(point.z());
+		const __m128 nx = _mm_set1_ps(normal.x()), ny = _mm_set1_ps(normal.y()), nz = _mm_set1_ps(normal.z());
+		const __m128 cx = _mm_set1_ps(camera_vector.x()), cy = _mm_set1_ps(camera_vector.y()), cz = _mm_set1_ps(camera_vector.z());
+		__m128 sum = zero;
+		for (size_t i=0 ; i<lights.count ; i+=point_source_light_streams_t::width)
+		{
+			__m128 dx = _mm_sub_ps(px, _mm_load_ps(lights.x + i));
+			__m128 dy = _mm_sub_ps(py, _mm_load_ps(lights.y + i));
+			__m128 dz = _mm_sub_ps(pz, _mm_load_ps(lights.z + i));
+			__m128 distance_squared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+			__m128 diffuse = _mm_div_ps(_mm_load_ps(lights.intensity + i), distance_squared);
+			__m128 lit = _mm_cmpge_ps(diffuse, cutoff);
+			if (_mm_movemask_ps(lit) == 0)
+				continue;
+
+			__m128 distance = _mm_sqrt_ps(distance_squared);
+			dx = _mm_div_ps(dx, distance);
+			dy = _mm_div_ps(dy, distance);
+			dz = _mm_div_ps(dz, distance);
+			__m128 alignment = _mm_sub_ps(zero, _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, dx), _mm_mul_ps(ny, dy)), _mm_mul_ps(nz, dz)));
+			lit = _mm_and_ps(lit, _mm_cmpge_ps(alignment, zero));
+			diffuse = _mm_mul_ps(diffuse, alignment);
+			if constexpr (terms == point_light_terms_t::DIFFUSE)
+			{
+				sum = _mm_add_ps(sum, _mm_and_ps(lit, diffuse));
+				continue;
+			}
+
+			// specular, its power of 32 by squaring 5 times, times 32/2 to make its integral[0,1] 0.5 again
+			// so that no extra light is generated. should multiply by overall albedo, too so that some light is absorbed.
+			// Under 0.07 the power would be denormal, very slow to compute, for less than 1e-37: 0
+			__m128 twice_alignment = _mm_add_ps(alignment, alignment);
+			__m128 rx = _mm_add_ps(dx, _mm_mul_ps(nx, twice_alignment));
+			__m128 ry = _mm_add_ps(dy, _mm_mul_ps(ny, twice_alignment));
+			__m128 rz = _mm_add_ps(dz, _mm_mul_ps(nz, twice_alignment));
+			__m128 specular = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, cx), _mm_mul_ps(ry, cy)), _mm_mul_ps(rz, cz));
+			specular = _mm_and_ps(specular, _mm_cmpgt_ps(specular, _mm_set1_ps(0.07f)));
+			for (int k=0 ; k<5 ; k++)
+				specular = _mm_mul_ps(specular, specular);
+			specular = _mm_div_ps(_mm_mul_ps(specular, _mm_set1_ps(32 / 2)), distance_squared);
+
+			__m128 light = terms == point_light_terms_t::BOTH ? _mm_add_ps(diffuse, specular) : specular;
+			sum = _mm_add_ps(sum, _mm_and_ps(lit, light));
+		}
+		sum = _mm_hadd_ps(sum, sum);
+		sum = _mm_hadd_ps(sum, sum);
+		return _mm_cvtss_f32(sum);
+	}
+
+	float point_lights_intensity(const point_source_light_range_t & lights, const vertex_t & point, const normal_t & normal, const vector_t & camera_vector)
+	{
+		return point_lights<point_light_terms_t::BOTH>(lights, point, normal, camera_vector);
+	}
+	float point_lights_diffuse(const point_source_light_range_t & lights, const vertex_t & point, const normal_t & normal)
+	{
+		return point_lights<point_light_terms_t::DIFFUSE>(lights, point, normal, vector_t(0, 0, 0));
+	}
+	float point_lights_specular(const point_source_light_range_t & lights, const vertex_t & point, const normal_t & normal, const vector_t & camera_vector)
+	{
+		return point_lights<point_light_terms_t::SPECULAR>(lights, point, normal, camera_vector);
+	}
+
+	float light_intensity(const scene_t & scene, const viewport_t & viewport, const vertex_t & point, const normal_t & normal)
+	{
+		vector_t camera_vector = viewport.camera().position() - point;
+		camera_vector.normalize();
+
+		float face_sun_intensity = - normal.dot(scene.sun_direction);
+		if (face_sun_intensity < 0.0f)
+			face_sun_intensity = 0.0f;
+		else
+			face_sun_intensity *= scene.sun_intensity * viewport.m_sun_shadows.lit(point, normal);
+
+		float dynamic_lights_intensity = point_lights_intensity(viewport.m_light_clusters.lights(point), point, normal, camera_vector);
+
+		return scene.ambient_light_intensity + face_sun_intensity + dynamic_lights_intensity;
+	}
+
 	void pixel_shader_t::prepare_for_primitive(const primitive_t & p, const scene_t & s, const viewport_t & vp)
 	{
 		primitive = &p;
@@ -30,77 +125,77 @@ namespace swegl
 
 	}
 
-	void pixel_shader_lights_flat::prepare_for_triangle(vertex_idx i0, vertex_idx i1, vertex_idx i2, bool inverted)
+	// Ambient and the diffuse light of point source lights only change with the node's matrix and the lights,
+	// the specular light of point source lights with the camera too: each is kept until those change, see cached_face_t.
+	// The sun, whose shadows may change with anything, is added every time, lit as much as the corners of the face are.
+	void pixel_shader_lights_flat::prepare_for_triangle(const transformed_vertex_t & mv0, const transformed_vertex_t & mv1, const transformed_vertex_t & mv2, bool inverted)
 	{
-		normal_t normal_world(cross(primitive->vertices[i1].v_world - primitive->vertices[i0].v_world
-		                           ,primitive->vertices[i2].v_world - primitive->vertices[i0].v_world));
-		if (inverted)
+		const std::uint32_t diffuse_key  = cached_face.diffuse_version  << 1 | inverted;
+		const std::uint32_t specular_key = cached_face.specular_version << 1 | inverted;
+		float diffuse, specular;
+		const bool diffuse_cached  = cached_face.diffuse  && cached_face.diffuse ->get(diffuse_key , diffuse );
+		const bool specular_cached = cached_face.specular && cached_face.specular->get(specular_key, specular);
+
+		vertex_t center_vertex = (mv0.v_world + mv1.v_world + mv2.v_world) / 3;
+		vector_t camera_vector = viewport->camera().position() - center_vertex;
+		camera_vector.normalize();
+
+		// the vertices come sorted by screen y, whatever their winding: the lit face is the one facing the camera
+		normal_t normal_world(cross(mv1.v_world - mv0.v_world
+		                           ,mv2.v_world - mv0.v_world));
+		if (normal_world.dot(camera_vector) < 0)
 			normal_world = - normal_world;
 
+		if ( ! diffuse_cached || ! specular_cached)
+		{
+			const point_source_light_range_t lights = viewport->m_light_clusters.lights(center_vertex);
+			if ( ! diffuse_cached)
+			{
+				diffuse = scene->ambient_light_intensity + point_lights_diffuse(lights, center_vertex, normal_world);
+				if (cached_face.diffuse)
+					cached_face.diffuse->set(diffuse_key, diffuse);
+			}
+			if ( ! specular_cached)
+			{
+				specular = point_lights_specular(lights, center_vertex, normal_world, camera_vector);
+				if (cached_face.specular)
+					cached_face.specular->set(specular_key, specular);
+			}
+		}
+
 		float face_sun_intensity = - normal_world.dot(scene->sun_direction);
 		if (face_sun_intensity < 0.0f)
 			face_sun_intensity = 0.0f;
 		else
-			face_sun_intensity *= scene->sun_intensity;
-
-		vertex_t center_vertex = (primitive->vertices[i0].v_world + primitive->vertices[i1].v_world + primitive->vertices[i2].v_world) / 3;
-		vector_t camera_vector = viewport->camera().position() - center_vertex;
-		camera_vector.normalize();
+		{
+			// in the shadows of the corners rather than of the center, big faces are not all dark or all lit
+			const sun_shadows_t & shadows = viewport->m_sun_shadows;
+			face_sun_intensity *= scene->sun_intensity
+			                    * (shadows.lit(mv0.v_world, normal_world) + shadows.lit(mv1.v_world, normal_world) + shadows.lit(mv2.v_world, normal_world)) / 3;
+		}
 
-		float dynamic_lights_intensity = 0.0f;
-		__gnu_parallel::for_each(scene->point_source_lights.begin(), scene->point_source_lights.end(),
-			[&](const auto & psl)
-			{
-				vector_t light_direction = center_vertex - psl.position;
-				float light_distance_squared = light_direction.len_squared();
-				float diffuse = psl.intensity / light_distance_squared;
-				if (diffuse < 0.05)
-					return;
-				light_direction.normalize();
-				float alignment = -normal_world.dot(light_direction);
-				if (alignment < 0.0f)
-					return;
-				diffuse *= alignment;
-
-				// specular
-				vector_t reflection = light_direction + normal_world * (alignment * 2);
-				float specular = reflection.dot(camera_vector);
-				if (specular > 0)
-				{
-					static const int p = 32;
-					specular = pow(specular, p);
-					specular = specular * p / 2; // make the integral[0,1] of specular 0.5 again so that no extra light is generated
-					// should multiply by overall albedo, too so that some light is absorbed
-					dynamic_lights_intensity += diffuse + specular / light_distance_squared;
-				}
-				else
-				{
-					dynamic_lights_intensity += diffuse;
-				}
-			});
-
-		light = scene->ambient_light_intensity + face_sun_intensity + dynamic_lights_intensity;
+		light = diffuse + face_sun_intensity + specular;
 		light *= 65536;
 	}
 
 
 
-	void pixel_shader_lights_phong::prepare_for_triangle(vertex_idx i0, vertex_idx i1, vertex_idx i2, bool inverted)
+	void pixel_shader_lights_phong::prepare_for_triangle(const transformed_vertex_t & mv0, const transformed_vertex_t & mv1, const transformed_vertex_t & mv2, bool inverted)
 	{
-		v0 = primitive->vertices[i0].v_world;
-		v1 = primitive->vertices[i1].v_world;
-		v2 = primitive->vertices[i2].v_world;
+		v0 = mv0.v_world;
+		v1 = mv1.v_world;
+		v2 = mv2.v_world;
 		if ( ! inverted)
 		{
-			n0 = (vector_t)primitive->vertices[i0].normal_world;
-			n1 = (vector_t)primitive->vertices[i1].normal_world;
-			n2 = (vector_t)primitive->vertices[i2].normal_world;
+			n0 = (vector_t)mv0.normal_world;
+			n1 = (vector_t)mv1.normal_world;
+			n2 = (vector_t)mv2.normal_world;
 		}
 		else
 		{
-			n0 = - (vector_t)primitive->vertices[i0].normal_world;
-			n1 = - (vector_t)primitive->vertices[i1].normal_world;
-			n2 = - (vector_t)primitive->vertices[i2].normal_world;
+			n0 = - (vector_t)mv0.normal_world;
+			n1 = - (vector_t)mv1.normal_world;
+			n2 = - (vector_t)mv2.normal_world;
 		}
 	}
 	void pixel_shader_lights_phong::prepare_for_upper_triangle(bool long_line_on_right)
@@ -160,48 +255,58 @@ namespace swegl
 	{
 		vertex_t center_vertex = v + vdir*progress;
 		normal_t normal        = n + ndir*progress;
-		vector_t camera_vector = viewport->camera().position() - center_vertex;
-		camera_vector.normalize();
+		return 65536 * light_intensity(*scene, *viewport, center_vertex, normal);
+	}
+	void pixel_shader_lights_phong::shade_span(const float * progress, std::uint32_t coverage, int, int * colors)
+	{
+		for (std::uint32_t bits = coverage ; bits ; bits &= bits - 1)
+		{
+			int i = __builtin_ctz(bits);
+			colors[i] = pixel_shader_lights_phong::shade(progress[i]);
+		}
+	}
 
-		float face_sun_intensity = - normal.dot(scene->sun_direction);
-		if (face_sun_intensity < 0.0f)
-			face_sun_intensity = 0.0f;
-		else
-			face_sun_intensity *= scene->sun_intensity;
 
-		float dynamic_lights_intensity = 0.0f;
-		__gnu_parallel::for_each(scene->point_source_lights.begin(), scene->point_source_lights.end(),
-			[&](const auto & psl)
-			{
-				vector_t light_direction = center_vertex - psl.position;
-				float light_distance_squared = light_direction.len_squared();
-				float diffuse = psl.intensity / light_distance_squared;
-				if (diffuse < 0.05)
-					return;
-				light_direction.normalize();
-				float alignment = - normal.dot(light_direction);
-				if (alignment < 0.0f)
-					return;
-				diffuse *= alignment;
-
-				// specular
-				vector_t reflection = light_direction + normal * (alignment * 2);
-				float specular = reflection.dot(camera_vector);
-				if (specular > 0)
-				{
-					static const int p = 32;
-					specular = pow(specular, p);
-					specular = specular * p / 2; // make the integral[0,1] of specular 0.5 again so that no extra light is generated
-					// should multiply by overall albedo, too so that some light is absorbed
-					dynamic_lights_intensity += diffuse + specular / light_distance_squared;
-				}
-				else
-				{
-					dynamic_lights_intensity += diffuse;
-				}
-			});
-
-		return 65536 * (scene->ambient_light_intensity + face_sun_intensity + dynamic_lights_intensity);
+
+	void pixel_shader_lights_gouraud::prepare_for_triangle(const transformed_vertex_t & mv0, const transformed_vertex_t & mv1, const transformed_vertex_t & mv2, bool inverted)
+	{
+		l0 = 65536 * (inverted ? mv0.light_back : mv0.light);
+		l1 = 65536 * (inverted ? mv1.light_back : mv1.light);
+		l2 = 65536 * (inverted ? mv2.light_back : mv2.light);
+	}
+	void pixel_shader_lights_gouraud::prepare_for_upper_triangle(bool long_line_on_right)
+	{
+		lleft = l0;
+		lright = l0;
+		if (long_line_on_right) {
+			lleftdir = l1-l0;
+			lrightdir = l2-l0;
+		} else {
+			lleftdir = l2-l0;
+			lrightdir = l1-l0;
+		}
+	}
+	void pixel_shader_lights_gouraud::prepare_for_lower_triangle(bool long_line_on_right)
+	{
+		if (long_line_on_right)
+		{
+			lright = l0;
+			lrightdir = l2-l0;
+			lleft = l1;
+			lleftdir = l2-l1;
+		}
+		else
+		{
+			lleft = l0;
+			lleftdir = l2-l0;
+			lright = l1;
+			lrightdir = l2-l1;
+		}
+	}
+	void pixel_shader_lights_gouraud::prepare_for_scanline(float progress_left, float progress_right)
+	{
+		l = lleft + lleftdir*progress_left;
+		ldir = lright + lrightdir*progress_right - l;
 	}
 
 
@@ -210,29 +315,38 @@ namespace swegl
 	{
 		pixel_shader_t::prepare_for_primitive(p, s, vp);
 
-		// TODO: select LOD / mipmap according to distance from camera
-
 		if (p.material_id == -1 || s.materials[p.material_id].texture_idx == -1)
 		{
 			default_bitmap = s.materials[p.material_id].color.to_int();
+			texture = nullptr;
 			tbitmap = &default_bitmap;
 			twidth  = 1;
 			theight = 1;
+			taddressing = texel_addressing_t{0, 0, 1};
+			tpower_of_two = true;
+			tcompressed = false;
 		}
 		else
-		{
-			int texture_id = s.materials[p.material_id].texture_idx;
-			tbitmap = s.images[texture_id].m_mipmaps[0]->m_bitmap;
-			twidth  = s.images[texture_id].m_mipmaps[0]->m_width;
-			theight = s.images[texture_id].m_mipmaps[0]->m_height;
-		}
+			texture = &s.images[s.materials[p.material_id].texture_idx];
 	}
 
-	void pixel_shader_texture::prepare_for_triangle(vertex_idx i0, vertex_idx i1, vertex_idx i2, bool)
+	void pixel_shader_texture::prepare_for_triangle(const transformed_vertex_t & mv0, const transformed_vertex_t & mv1, const transformed_vertex_t & mv2, bool)
 	{
-		t0 = primitive->vertices[i0].tex_coords;
-		t1 = primitive->vertices[i1].tex_coords;
-		t2 = primitive->vertices[i2].tex_coords;
+		if (texture)
+		{
+			const mipmap_t & mipmap = triangle_mipmap(*texture, mv0, mv1, mv2);
+			tbitmap = mipmap.m_bitmap;
+			twidth  = mipmap.m_width;
+			theight = mipmap.m_height;
+			taddressing = mipmap.m_addressing;
+			tpower_of_two = mipmap.power_of_two();
+			tmipmap = &mipmap;
+			tcompressed = mipmap.compressed();
+		}
+
+		t0 = mv0.tex_coords;
+		t1 = mv1.tex_coords;
+		t2 = mv2.tex_coords;
 
 		t0.x() *= twidth;
 		t0.y() *= theight;
@@ -275,9 +389,35 @@ namespace swegl
 	int pixel_shader_texture::shade(float progress)
 	{
 		vec2f_t t = t_left + t_dir * progress;
-		int u = (int)t.x() % twidth;
-		int v = (int)t.y() % theight;
-		return tbitmap[v*twidth + u];
+		if (tcompressed)
+			return tpower_of_two ? sample<true,true >(t) : sample<false,true >(t);
+		else
+			return tpower_of_two ? sample<true,false>(t) : sample<false,false>(t);
+	}
+	void pixel_shader_texture::shade_span(const float * progress, std::uint32_t coverage, int, int * colors)
+	{
+		if (tcompressed)
+			tpower_of_two ? sample_span<true,true >(progress, coverage, colors) : sample_span<false,true >(progress, coverage, colors);
+		else
+			tpower_of_two ? sample_span<true,false>(progress, coverage, colors) : sample_span<false,false>(progress, coverage, colors);
+	}
+	template<bool power_of_two, bool compressed>
+	void pixel_shader_texture::sample_span(const float * progress, std::uint32_t coverage, int * colors)
+	{
+		for (std::uint32_t bits = coverage ; bits ; bits &= bits - 1)
+		{
+			int i = __builtin_ctz(bits);
+			colors[i] = sample<power_of_two,compressed>(t_left + t_dir * progress[i]);
+		}
+	}
+	template<bool power_of_two, bool compressed>
+	int pixel_shader_texture::sample(const vec2f_t & t)
+	{
+		unsigned int u = wrap_texel<power_of_two>((int)floor(t.x()), twidth);
+		unsigned int v = wrap_texel<power_of_two>((int)floor(t.y()), theight);
+		if (compressed)
+			return tcache.texel(*tmipmap, u, v);
+		return tbitmap[taddressing.row(v) + taddressing.column(u)];
 	}
 
 
@@ -288,24 +428,35 @@ namespace swegl
 		if (p.material_id == -1 || s.materials[p.material_id].texture_idx == -1)
 		{
 			default_bitmap = s.materials[p.material_id].color.to_int();
+			texture = nullptr;
 			tbitmap = &default_bitmap;
 			twidth  = 1;
 			theight = 1;
+			taddressing = texel_addressing_t{0, 0, 1};
+			tpower_of_two = true;
+			tcompressed = false;
 		}
 		else
-		{
-			int texture_id = s.materials[p.material_id].texture_idx;
-			tbitmap = s.images[texture_id].m_mipmaps[0]->m_bitmap;
-			twidth  = s.images[texture_id].m_mipmaps[0]->m_width;
-			theight = s.images[texture_id].m_mipmaps[0]->m_height;
-		}
+			texture = &s.images[s.materials[p.material_id].texture_idx];
 	}
 
-	void pixel_shader_texture_bilinear::prepare_for_triangle(vertex_idx i0, vertex_idx i1, vertex_idx i2, bool)
+	void pixel_shader_texture_bilinear::prepare_for_triangle(const transformed_vertex_t & mv0, const transformed_vertex_t & mv1, const transformed_vertex_t & mv2, bool)
 	{
-		t0 = primitive->vertices[i0].tex_coords;
-		t1 = primitive->vertices[i1].tex_coords;
-		t2 = primitive->vertices[i2].tex_coords;
+		if (texture)
+		{
+			const mipmap_t & mipmap = triangle_mipmap(*texture, mv0, mv1, mv2);
+			tbitmap = mipmap.m_bitmap;
+			twidth  = mipmap.m_width;
+			theight = mipmap.m_height;
+			taddressing = mipmap.m_addressing;
+			tpower_of_two = mipmap.power_of_two();
+			tmipmap = &mipmap;
+			tcompressed = mipmap.compressed();
+		}
+
+		t0 = mv0.tex_coords;
+		t1 = mv1.tex_coords;
+		t2 = mv2.tex_coords;
 
 		t0.x() *= twidth;
 		t0.y() *= theight;
@@ -347,39 +498,61 @@ namespace swegl
 
 	int pixel_shader_texture_bilinear::shade(float progress)
 	{
-		const pixel_colors * pc = (pixel_colors*)tbitmap;
-
 		vec2f_t t = t_left + t_dir * progress;
+		if (tcompressed)
+			return tpower_of_two ? sample<true,true >(t) : sample<false,true >(t);
+		else
+			return tpower_of_two ? sample<true,false>(t) : sample<false,false>(t);
+	}
+	void pixel_shader_texture_bilinear::shade_span(const float * progress, std::uint32_t coverage, int, int * colors)
+	{
+		if (tcompressed)
+			tpower_of_two ? sample_span<true,true >(progress, coverage, colors) : sample_span<false,true >(progress, coverage, colors);
+		else
+			tpower_of_two ? sample_span<true,false>(progress, coverage, colors) : sample_span<false,false>(progress, coverage, colors);
+	}
+	template<bool power_of_two, bool compressed>
+	void pixel_shader_texture_bilinear::sample_span(const float * progress, std::uint32_t coverage, int * colors)
+	{
+		for (std::uint32_t bits = coverage ; bits ; bits &= bits - 1)
+		{
+			int i = __builtin_ctz(bits);
+			colors[i] = sample<power_of_two,compressed>(t_left + t_dir * progress[i]);
+		}
+	}
+	template<bool power_of_two, bool compressed>
+	int pixel_shader_texture_bilinear::sample(const vec2f_t & t)
+	{
+		const pixel_colors * pc = (pixel_colors*)tbitmap;
 
-		float v = t.x();
-		float u = t.y();
-		float u1 = u-0.5;
+		// u along the width like pixel_shader_texture::sample(), v along the height
+		float u = t.x();
+		float v = t.y();
 		float u2 = u+0.5;
-		float v1 = v-0.5;
 		float v2 = v+0.5;
 
 		u = floor(u2);
 		v = floor(v2);
 
-		int v1m = ((int)v1+theight) % (int)theight;
-		//if (v1m < 0)
-		//	v1m += theight;
-		int v2m = v1m + 1;
-		if (v2m == theight)
-			v2m = 0;
-		v1m *= twidth;
-		v2m *= twidth;
-		int u1m = ((int)u1+twidth) % (int)twidth;
-		//if (u1m < 0)
-		//	u1m += twidth;
-		int u2m = u1m + 1;
-		if (u2m == twidth)
-			u2m = 0;
-		
-		return ( (pc[v1m + u1m] * ((u - u1) * (v - v1)))
-		        +(pc[v2m + u1m] * ((u - u1) * (v2 - v)))
-		        +(pc[v1m + u2m] * ((u2 - u) * (v - v1)))
-		        +(pc[v2m + u2m] * ((u2 - u) * (v2 - v)))
-		       ).to_int();
+		// texels u-1 and u, rows v-1 and v, nearest to u-0.5 and v-0.5
+		int v1m = wrap_texel<power_of_two>((int)v - 1, theight);
+		int v2m = power_of_two ? (v1m + 1) & (theight - 1) : (v1m + 1 == theight ? 0 : v1m + 1);
+		int u1m = wrap_texel<power_of_two>((int)u - 1, twidth);
+		int u2m = power_of_two ? (u1m + 1) & (twidth - 1) : (u1m + 1 == twidth ? 0 : u1m + 1);
+
+		// u2 - u and v2 - v are the weights of column u and row v
+		if (compressed)
+			return bilinear_filter(tcache.texel(*tmipmap, u1m, v1m), tcache.texel(*tmipmap, u2m, v1m)
+			                      ,tcache.texel(*tmipmap, u1m, v2m), tcache.texel(*tmipmap, u2m, v2m)
+			                      ,u2 - u, v2 - v
+			                      ).to_int();
+		v1m = taddressing.row(v1m);
+		v2m = taddressing.row(v2m);
+		u1m = taddressing.column(u1m);
+		u2m = taddressing.column(u2m);
+		return bilinear_filter(pc[v1m + u1m], pc[v1m + u2m]
+		                      ,pc[v2m + u1m], pc[v2m + u2m]
+		                      ,u2 - u, v2 - v
+		                      ).to_int();
 	}
 } // namespace
@@ -1,5 +1,8 @@
 
 #include <cassert>
+#include <atomic>
+#include <deque>
+#include <emmintrin.h>
 
 #include <swegl/render/renderer.hpp>
 
@@ -8,6 +11,7 @@
 #include <swegl/render/pixel_shaders.hpp>
 #include <swegl/render/post_shaders.hpp>
 #include <swegl/render/interpolator.hpp>
+#include <swegl/misc/worker_pool.hpp>
 
 namespace swegl
 {
@@ -25,43 +29,106 @@ struct line_side
 	float x;
 };
 
+struct clip_rect_t
+{
+	int x, y;
+	int w, h;
+};
+
+// E(x,y) = a*x + b*y + c for each edge, positive inside the triangle
+struct edge_functions_t
+{
+	float a[3], b[3], c[3];
+	bool inclusive[3]; // left and top edges own the pixels lying exactly on them
+};
+
+// Pixels are drawn where z >= near_z and |x| <= z and |y| <= z (after projection, before the division by z).
+// Triangles crossing the near plane are clipped. Triangles reaching further than guard_band times the screen
+// on the sides are clipped too, to keep the rasterizer's coordinates small; others are left to the clip rects.
+static const float near_z     = 0.001f;
+static const float guard_band = 8;
+// each of the 5 planes adds at most 1 vertex to the polygon, and creates at most 2
+static const int max_polygon_vertices = 3 + 5;
+static const int max_clipped_vertices = 2 * 5;
+
+// a triangle that survived culling and near-plane clipping, waiting in the tile bins
+struct binned_triangle_t
+{
+	const primitive_t * primitive;
+	const transformed_vertex_t * v0, * v1, * v2; // into the viewport's transformed scene or the bins' clipped vertices
+	bool front_face_visible;
+	cached_face_t cached_face;
+};
+
 void crude_line(viewport_t & viewport, int x1, int y1, int x2, int y2);
 bool do_triangle(const scene_t & scene, const primitive_t & primitive, vertex_idx i0, vertex_idx i1, vertex_idx i2);
+// depth_only: the depth-only variant of the rasterizer, for z-prepasses and shadow maps.
+// Pixels are z-tested and their depth written the same way, but the pixel shader is never called.
+template<bool depth_only>
 void fill_triangle(vertex_idx i0,
                    vertex_idx i1,
                    vertex_idx i2,
-                   node_t & node,
-                   primitive_t & primitive,
+                   const transformed_primitive_t & primitive,
                    viewport_t & vp,
-                   pixel_shader_t & pixel_shader);
-void fill_triangle_2(vertex_idx i0,
-                     vertex_idx i1,
-                     vertex_idx i2,
-                     primitive_t & primitive,
+                   pixel_shader_t & pixel_shader,
+                   std::vector<transformed_vertex_t> & scratch,
+                   const cached_face_t & cached_face);
+template<bool depth_only>
+void fill_triangle_2(const transformed_vertex_t * v0,
+                     const transformed_vertex_t * v1,
+                     const transformed_vertex_t * v2,
                      viewport_t & vp,
                      pixel_shader_t & pixel_shader, 
-                     bool front_face_visible);
+                     bool front_face_visible,
+                     const clip_rect_t & clip,
+                     std::uint32_t triangle_idx);
+template<bool depth_only>
 void fill_half_triangle(int y, int y_end,
 	                    line_side & side_left, line_side & side_right,
                         viewport_t & vp,
-                        pixel_shader_t & pixel_shader);
-
+                        pixel_shader_t & pixel_shader,
+                        const clip_rect_t & clip,
+                        std::uint32_t visibility_tag);
+template<bool depth_only>
+void fill_half_triangle_simd(int y, int y_end,
+                             line_side & side_left, line_side & side_right,
+                             const edge_functions_t & edges,
+                             viewport_t & vp,
+                             pixel_shader_t & pixel_shader,
+                             const clip_rect_t & clip,
+                             std::uint32_t visibility_tag);
 
-struct transformed_scene_t
+struct tile_bins_t
 {
-	scene_t * original;
-	std::vector<node_t> world_view;
-	std::vector<node_t> screen_view;
+	int tile_size;
+	int tiles_x, tiles_y;
+	std::vector<binned_triangle_t> triangles;
+	std::vector<std::vector<std::uint32_t>> tiles; // indices into triangles, in submission order
+	std::deque<transformed_vertex_t> clipped_vertices; // created by near-plane clipping, a deque keeps them in place while it grows
+
+	tile_bins_t(const viewport_t & vp, int tile_size)
+		: tile_size(tile_size)
+		, tiles_x((vp.m_w + tile_size - 1) / tile_size)
+		, tiles_y((vp.m_h + tile_size - 1) / tile_size)
+		, tiles(tiles_x * tiles_y)
+	{}
 };
 
+void bin_triangles(const scene_t & scene, const node_t & node, const transformed_node_t & transformed_node, viewport_t & vp, tile_bins_t & bins);
+void rasterize_tiles(const scene_t & scene, viewport_t & vp, tile_bins_t & bins, int thread_count);
+void shade_visibility(const scene_t & scene, viewport_t & vp, const tile_bins_t & bins);
+
 
-bool inside_camera_frustum(const mesh_vertex_t & v0, const mesh_vertex_t & v1, const mesh_vertex_t & v2)
+// vertices are in viewport coordinates: frustum x in [-1,1[ is [x,x+w[ on screen, frustum y in [-1,1[ is ]y,y+h] (y goes down)
+bool inside_camera_frustum(const transformed_vertex_t & v0, const transformed_vertex_t & v1, const transformed_vertex_t & v2, const viewport_t & vp)
 {
+	const float left = vp.m_x, right = vp.m_x + vp.m_w;
+	const float top  = vp.m_y, bottom = vp.m_y + vp.m_h;
 	// frustum clipping
-	return  ((v0.v_viewport.x() >= -1   ) || (v1.v_viewport.x() >= -1   ) || (v2.v_viewport.x() >= -1   ))
-	      &&((v0.v_viewport.y() >= -1   ) || (v1.v_viewport.y() >= -1   ) || (v2.v_viewport.y() >= -1   ))
-	      &&((v0.v_viewport.x()  <  1   ) || (v1.v_viewport.x()  <  1   ) || (v2.v_viewport.x()  <  1   ))
-	      &&((v0.v_viewport.y()  <  1   ) || (v1.v_viewport.y()  <  1   ) || (v2.v_viewport.y()  <  1   ))
+	return  ((v0.v_viewport.x() >= left  ) || (v1.v_viewport.x() >= left  ) || (v2.v_viewport.x() >= left  ))
+	      &&((v0.v_viewport.y() <= bottom) || (v1.v_viewport.y() <= bottom) || (v2.v_viewport.y() <= bottom))
+	      &&((v0.v_viewport.x()  < right ) || (v1.v_viewport.x()  < right ) || (v2.v_viewport.x()  < right ))
+	      &&((v0.v_viewport.y()  > top   ) || (v1.v_viewport.y()  > top   ) || (v2.v_viewport.y()  > top   ))
 	      &&((v0.v_viewport.z() >= 0.001) || (v1.v_viewport.z() >= 0.001) || (v2.v_viewport.z() >= 0.001))
 	      // object must span at least 1 pixel in width AND in height
 	      &&(v0.v_viewport.x() != v1.v_viewport.x() || v0.v_viewport.x() != v2.v_viewport.x())
@@ -69,322 +136,680 @@ bool inside_camera_frustum(const mesh_vertex_t & v0, const mesh_vertex_t & v1, c
 	      ;
 }
 
-bool front_face_visible(const mesh_vertex_t & v0, const mesh_vertex_t & v1, const mesh_vertex_t & v2)
+// counter-clockwise on screen, where y goes down
+bool front_face_visible(const transformed_vertex_t & v0, const transformed_vertex_t & v1, const transformed_vertex_t & v2)
 {
-	return cross((v1.v_viewport-v0.v_viewport),(v2.v_viewport-v0.v_viewport)).z() > 0;
+	return cross((v1.v_viewport-v0.v_viewport),(v2.v_viewport-v0.v_viewport)).z() < 0;
 }
 
-void _render(scene_t & scene, viewport_t & viewport)
+// calls f(i0, i1, i2) for each triangle the viewport draws of the primitive, strips are rewound so that all triangles face the same way
+template<typename F>
+void for_each_triangle(const primitive_t & primitive, const transformed_primitive_t & transformed_primitive, F && f)
 {
-	vertex_shader_t::world_to_camera_or_frustum(scene, viewport);
-	viewport.clear();
+	const auto & indices = drawn_indices(primitive, transformed_primitive);
+	const auto mode = drawn_mode(primitive, transformed_primitive);
 
-	pixel_shader_t & pixel_shader = *viewport.m_pixel_shader;
-	for (auto & node : scene.nodes)
-	{
-		// determine which vertices will be part of visible triangles and need more transformation 
-		for (auto & primitive : node.primitives)
-		{
-			auto & vertices = primitive.vertices;
-			const auto & indices  = primitive.indices ;
-			const bool double_sided = primitive.material_id != -1 && scene.materials[primitive.material_id].double_sided;
+	// STRIPS
+	if (mode == primitive_t::index_mode_t::TRIANGLE_STRIP)
+		for (unsigned int i=2 ; i<indices.size() ; i++)
+			f(indices[i-2], indices[i-1+(i&0x1)], indices[i-(i&0x1)], i-2);
+	// FANS
+	if (mode == primitive_t::index_mode_t::TRIANGLE_FAN)
+		for (unsigned int i=2 ; i<indices.size() ; i++)
+			f(indices[0], indices[i-1], indices[i], i-2);
+	// TRIs
+	if (mode == primitive_t::index_mode_t::TRIANGLES)
+		for (unsigned int i=2 ; i<indices.size() ; i+= 3)
+			f(indices[i-2], indices[i-1], indices[i], i/3);
+}
+
+// where the triangle face_idx of the primitive keeps its light, see cached_face_t
+inline cached_face_t cached_face(const scene_t & scene, const node_t & node, const primitive_t & primitive, const transformed_primitive_t & transformed_primitive, const viewport_t & vp, size_t face_idx)
+{
+	if ( ! vp.m_cache_face_lights)
+		return {};
+	const std::uint32_t diffuse_version = std::max(node.version, scene.lights_version);
+	return cached_face_t{primitive.diffuse_lights.face(transformed_primitive.lod, face_idx)
+	                    ,transformed_primitive.specular_lights.face(transformed_primitive.lod, face_idx)
+	                    ,diffuse_version
+	                    ,std::max(diffuse_version, vp.m_camera_version)
+	                    };
+}
 
-			if (double_sided)
+// marks the vertices of the primitive's triangles that may be drawn: inside the frustum, and facing the camera unless double sided
+void mark_visible_vertices(const scene_t & scene, const primitive_t & primitive, transformed_primitive_t & transformed_primitive, const viewport_t & viewport)
+{
+	auto & vertices = transformed_primitive.vertices;
+	const auto & indices  = drawn_indices(primitive, transformed_primitive);
+	const auto   mode     = drawn_mode   (primitive, transformed_primitive);
+	const bool double_sided = primitive.material_id != -1 && scene.materials[primitive.material_id].double_sided;
+
+	if (double_sided)
+	{
+		// STRIPS
+		if (mode == primitive_t::index_mode_t::TRIANGLE_STRIP)
+			for (unsigned int i=2 ; i<indices.size() ; i++)
 			{
-				// STRIPS
-				if (primitive.mode == primitive_t::index_mode_t::TRIANGLE_STRIP)
-					for (unsigned int i=2 ; i<indices.size() ; i++)
-					{
-						assert(indices[i-2] < vertices.size());
-						assert(indices[i-1] < vertices.size());
-						assert(indices[i-0] < vertices.size());
-						if (inside_camera_frustum(vertices[indices[i-2]], vertices[indices[i-1]], vertices[indices[i]]))
-						{
-							vertices[indices[i-2]].yes = true;
-							vertices[indices[i-1]].yes = true;
-							vertices[indices[i  ]].yes = true;
-						}
-					}
-				// FANS
-				if (primitive.mode == primitive_t::index_mode_t::TRIANGLE_FAN)
-					for (unsigned int i=2 ; i<indices.size() ; i++)
-					{
-						assert(indices[i-2] < vertices.size());
-						assert(indices[i-1] < vertices.size());
-						assert(indices[i-0] < vertices.size());
-						if (inside_camera_frustum(vertices[indices[0]], vertices[indices[i-1]], vertices[indices[i]]))
-						{
-							vertices[indices[0  ]].yes = true;
-							vertices[indices[i-1]].yes = true;
-							vertices[indices[i  ]].yes = true;
-						}
-					}
-				// TRIs
-				if (primitive.mode == primitive_t::index_mode_t::TRIANGLES)
-					for (unsigned int i=2 ; i<indices.size() ; i+= 3)
-					{
-						assert(indices[i-2] < vertices.size());
-						assert(indices[i-1] < vertices.size());
-						assert(indices[i-0] < vertices.size());
-						if (inside_camera_frustum(vertices[indices[i-2]], vertices[indices[i-1]], vertices[indices[i]]))
-						{
-							vertices[indices[i-2]].yes = true;
-							vertices[indices[i-1]].yes = true;
-							vertices[indices[i  ]].yes = true;
-						}
-					}
+				assert(indices[i-2] < vertices.size());
+				assert(indices[i-1] < vertices.size());
+				assert(indices[i-0] < vertices.size());
+				if (inside_camera_frustum(vertices[indices[i-2]], vertices[indices[i-1]], vertices[indices[i]], viewport))
+				{
+					vertices[indices[i-2]].yes = true;
+					vertices[indices[i-1]].yes = true;
+					vertices[indices[i  ]].yes = true;
+				}
 			}
-			else
+		// FANS
+		if (mode == primitive_t::index_mode_t::TRIANGLE_FAN)
+			for (unsigned int i=2 ; i<indices.size() ; i++)
 			{
-				// STRIPS
-				if (primitive.mode == primitive_t::index_mode_t::TRIANGLE_STRIP)
-					for (unsigned int i=2 ; i<indices.size() ; i++)
-					{
-						assert(indices[i-2] < vertices.size());
-						assert(indices[i-1] < vertices.size());
-						assert(indices[i-0] < vertices.size());
-						if (   inside_camera_frustum(vertices[indices[i-2]], vertices[indices[i-1        ]], vertices[indices[i        ]])
-							&& front_face_visible   (vertices[indices[i-2]], vertices[indices[i-1+(i&0x1)]], vertices[indices[i-(i&0x1)]]))
-						{
-							vertices[indices[i-2]].yes = true;
-							vertices[indices[i-1]].yes = true;
-							vertices[indices[i  ]].yes = true;
-						}
-					}
-				// FANS
-				if (primitive.mode == primitive_t::index_mode_t::TRIANGLE_FAN)
-					for (unsigned int i=2 ; i<indices.size() ; i++)
-					{
-						assert(indices[i-2] < vertices.size());
-						assert(indices[i-1] < vertices.size());
-						assert(indices[i-0] < vertices.size());
-						if (   inside_camera_frustum(vertices[indices[0]], vertices[indices[i-1]], vertices[indices[i]])
-						    && front_face_visible   (vertices[indices[0]], vertices[indices[i-1]], vertices[indices[i]]))
-						{
-							vertices[indices[0  ]].yes = true;
-							vertices[indices[i-1]].yes = true;
-							vertices[indices[i  ]].yes = true;
-						}
-					}
-				// TRIs
-				if (primitive.mode == primitive_t::index_mode_t::TRIANGLES)
-					for (unsigned int i=2 ; i<indices.size() ; i+= 3)
-					{
-						assert(indices[i-2] < vertices.size());
-						assert(indices[i-1] < vertices.size());
-						assert(indices[i-0] < vertices.size());
-						if (   inside_camera_frustum(vertices[indices[i-2]], vertices[indices[i-1]], vertices[indices[i]])
-						    && front_face_visible   (vertices[indices[i-2]], vertices[indices[i-1]], vertices[indices[i]]))
-						{
-							vertices[indices[i-2]].yes = true;
-							vertices[indices[i-1]].yes = true;
-							vertices[indices[i  ]].yes = true;
-						}
-					}
+				assert(indices[i-2] < vertices.size());
+				assert(indices[i-1] < vertices.size());
+				assert(indices[i-0] < vertices.size());
+				if (inside_camera_frustum(vertices[indices[0]], vertices[indices[i-1]], vertices[indices[i]], viewport))
+				{
+					vertices[indices[0  ]].yes = true;
+					vertices[indices[i-1]].yes = true;
+					vertices[indices[i  ]].yes = true;
+				}
+			}
+		// TRIs
+		if (mode == primitive_t::index_mode_t::TRIANGLES)
+			for (unsigned int i=2 ; i<indices.size() ; i+= 3)
+			{
+				assert(indices[i-2] < vertices.size());
+				assert(indices[i-1] < vertices.size());
+				assert(indices[i-0] < vertices.size());
+				if (inside_camera_frustum(vertices[indices[i-2]], vertices[indices[i-1]], vertices[indices[i]], viewport))
+				{
+					vertices[indices[i-2]].yes = true;
+					vertices[indices[i-1]].yes = true;
+					vertices[indices[i  ]].yes = true;
+				}
 			}
+	}
+	else
+	{
+		// STRIPS
+		if (mode == primitive_t::index_mode_t::TRIANGLE_STRIP)
+			for (unsigned int i=2 ; i<indices.size() ; i++)
+			{
+				assert(indices[i-2] < vertices.size());
+				assert(indices[i-1] < vertices.size());
+				assert(indices[i-0] < vertices.size());
+				if (   inside_camera_frustum(vertices[indices[i-2]], vertices[indices[i-1        ]], vertices[indices[i        ]], viewport)
+					&& front_face_visible   (vertices[indices[i-2]], vertices[indices[i-1+(i&0x1)]], vertices[indices[i-(i&0x1)]]))
+				{
+					vertices[indices[i-2]].yes = true;
+					vertices[indices[i-1]].yes = true;
+					vertices[indices[i  ]].yes = true;
+				}
+			}
+		// FANS
+		if (mode == primitive_t::index_mode_t::TRIANGLE_FAN)
+			for (unsigned int i=2 ; i<indices.size() ; i++)
+			{
+				assert(indices[i-2] < vertices.size());
+				assert(indices[i-1] < vertices.size());
+				assert(indices[i-0] < vertices.size());
+				if (   inside_camera_frustum(vertices[indices[0]], vertices[indices[i-1]], vertices[indices[i]], viewport)
+				    && front_face_visible   (vertices[indices[0]], vertices[indices[i-1]], vertices[indices[i]]))
+				{
+					vertices[indices[0  ]].yes = true;
+					vertices[indices[i-1]].yes = true;
+					vertices[indices[i  ]].yes = true;
+				}
+			}
+		// TRIs
+		if (mode == primitive_t::index_mode_t::TRIANGLES)
+			for (unsigned int i=2 ; i<indices.size() ; i+= 3)
+			{
+				assert(indices[i-2] < vertices.size());
+				assert(indices[i-1] < vertices.size());
+				assert(indices[i-0] < vertices.size());
+				if (   inside_camera_frustum(vertices[indices[i-2]], vertices[indices[i-1]], vertices[indices[i]], viewport)
+				    && front_face_visible   (vertices[indices[i-2]], vertices[indices[i-1]], vertices[indices[i]]))
+				{
+					vertices[indices[i-2]].yes = true;
+					vertices[indices[i-1]].yes = true;
+					vertices[indices[i  ]].yes = true;
+				}
+			}
+	}
+}
+
+// draws the visible triangles of the node, only their depth or shaded
+template<bool depth_only>
+void draw_node(const scene_t & scene, const node_t & node, const transformed_node_t & transformed_node, viewport_t & viewport, pixel_shader_t & pixel_shader, std::vector<transformed_vertex_t> & clip_scratch)
+{
+	for (size_t p=0 ; p<node.primitives.size() ; p++)
+	{
+		const primitive_t & primitive = node.primitives[p];
+		const transformed_primitive_t & transformed_primitive = transformed_node.primitives[p];
+		if ( ! transformed_primitive.visible)
+			continue;
+		if ( ! depth_only)
+			pixel_shader.prepare_for_primitive(primitive, scene, viewport);
+
+		for_each_triangle(primitive, transformed_primitive, [&](vertex_idx i0, vertex_idx i1, vertex_idx i2, size_t face_idx)
+			{
+				fill_triangle<depth_only>(i0, i1, i2, transformed_primitive, viewport, pixel_shader, clip_scratch
+				                         ,depth_only ? cached_face_t{} : cached_face(scene, node, primitive, transformed_primitive, viewport, face_idx));
+			});
+	}
+}
+
+void render(scene_t & scene, const std::vector<viewport_t*> & viewports)
+{
+	// node matrices, bounds, the BVH and the lights ONCE for all viewports. Vertices are not: each viewport takes the
+	// ones it sees from model to screen coordinates in one pass, see vertex_shader_t::transform_vertices()
+	vertex_shader_t::original_to_world(scene);
+	scene.update_lights();
+	// cameras that moved get a new version, see scene_t::last_version
+	for (viewport_t * viewport : viewports)
+	{
+		const vertex_t position = viewport->camera().position();
+		const vertex_t & seen = viewport->m_camera_version_position;
+		if (position.x() != seen.x() || position.y() != seen.y() || position.z() != seen.z())
+		{
+			viewport->m_camera_version = ++scene.last_version;
+			viewport->m_camera_version_position = position;
 		}
+	}
 
-		// do the rest of the transformations to the vertices that are part of visible triangles
-		vertex_shader_t::frustum_to_viewport(node, viewport);
+	// from here on the scene is only read, each viewport transforms and draws into its own buffers
+	worker_pool().run(viewports.size(), [&](int i) { _render(scene, *viewports[i]); });
+}
 
-		// do the painting
-		for (auto & primitive : node.primitives)
+void _render(const scene_t & scene, viewport_t & viewport)
+{
+	transformed_scene_t & transformed = viewport.m_transformed_scene;
+	vertex_shader_t::world_to_viewport(scene, transformed, viewport);
+	viewport.m_light_clusters.build(scene.point_source_light_streams, viewport.camera(), viewport.m_use_light_clusters);
+	if ( ! viewport.m_sun_shadows.m_cascades.empty())
+		render_sun_shadows(scene, viewport);
+	viewport.clear();
+
+	// deferred shading needs all triangles kept until the end of the frame, it bins them in 1 tile if not tiled
+	const bool tiled = viewport.m_tile_size > 0;
+	const bool binned = tiled || viewport.m_deferred_shading;
+	std::unique_ptr<tile_bins_t> bins;
+	if (binned)
+		bins = std::make_unique<tile_bins_t>(viewport, tiled ? viewport.m_tile_size : std::max(viewport.m_w, viewport.m_h));
+
+	// viewports rendered concurrently may share their pixel shader, which keeps per-triangle state
+	std::shared_ptr<pixel_shader_t> pixel_shader_clone = viewport.m_pixel_shader->clone();
+	pixel_shader_t & pixel_shader = *pixel_shader_clone;
+	const bool lit_per_vertex = pixel_shader.lit_per_vertex();
+	std::vector<transformed_vertex_t> clip_scratch;
+	clip_scratch.reserve(max_clipped_vertices);
+	for (int node_idx : transformed.visible_nodes) // culled by the vertex shader
+	{
+		const node_t & node = scene.nodes[node_idx];
+		transformed_node_t & transformed_node = transformed.nodes[node_idx];
+
+		// determine which vertices are part of visible triangles
+		for (size_t p=0 ; p<node.primitives.size() ; p++)
 		{
-			auto & indices = primitive.indices;
+			const primitive_t & primitive = node.primitives[p];
+			transformed_primitive_t & transformed_primitive = transformed_node.primitives[p];
+			if ( ! transformed_primitive.visible)
+				continue;
+			mark_visible_vertices(scene, primitive, transformed_primitive, viewport);
 
-			pixel_shader.prepare_for_primitive(primitive, scene, viewport);
+			if (lit_per_vertex)
+				vertex_shader_t::light_vertices(scene, transformed_primitive.vertices.data(), drawn_vertex_count(primitive, transformed_primitive), viewport
+				                               ,primitive.material_id != -1 && scene.materials[primitive.material_id].double_sided);
+		}
 
-			// STRIPS
-			if (primitive.mode == primitive_t::index_mode_t::TRIANGLE_STRIP)
-				for (unsigned int i=2 ; i<indices.size() ; i++)
-					fill_triangle(indices[i-2]
-						         ,indices[i-1+(i&0x1)]
-						         ,indices[i  -(i&0x1)]
-						         ,node
-						         ,primitive
-						         ,viewport
-						         ,pixel_shader
-						         );
-			// FANSv
-			if (primitive.mode == primitive_t::index_mode_t::TRIANGLE_FAN)
-				for (unsigned int i=2 ; i<indices.size() ; i++)
-					fill_triangle(indices[0  ]
-					             ,indices[i-1]
-					             ,indices[i  ]
-					             ,node
-					             ,primitive
-					             ,viewport
-					             ,pixel_shader
-					             );
-			// TRIs
-			if (primitive.mode == primitive_t::index_mode_t::TRIANGLES)
-				for (unsigned int i=2 ; i<indices.size() ; i+= 3)
-					fill_triangle(indices[i-2]
-					             ,indices[i-1]
-					             ,indices[i  ]
-					             ,node
-					             ,primitive
-					             ,viewport
-					             ,pixel_shader
-					             );
+		if (binned)
+		{
+			bin_triangles(scene, node, transformed_node, viewport, *bins);
+			continue;
 		}
+
+		// do the painting
+		if ( ! viewport.m_z_prepass)
+			draw_node<false>(scene, node, transformed_node, viewport, pixel_shader, clip_scratch);
+	}
+
+	if ( ! binned && viewport.m_z_prepass)
+	{
+		// the depth of all triangles first, then only the nearest get shaded
+		for (int node_idx : transformed.visible_nodes)
+			draw_node<true >(scene, scene.nodes[node_idx], transformed.nodes[node_idx], viewport, pixel_shader, clip_scratch);
+		for (int node_idx : transformed.visible_nodes)
+			draw_node<false>(scene, scene.nodes[node_idx], transformed.nodes[node_idx], viewport, pixel_shader, clip_scratch);
+	}
+
+	if (binned)
+	{
+		rasterize_tiles(scene, viewport, *bins, tiled ? viewport.m_thread_count : 1);
+		if (viewport.m_deferred_shading)
+			shade_visibility(scene, viewport, *bins);
 	}
 
 	viewport.flatten();
 	viewport.m_post_shader->shade(viewport);
 }
 
+void render_depth(const scene_t & scene, viewport_t & viewport)
+{
+	transformed_scene_t & transformed = viewport.m_transformed_scene;
+	vertex_shader_t::world_to_viewport(scene, transformed, viewport);
+	viewport.clear_depth();
 
+	pixel_shader_t no_pixel_shader; // never called when drawing depth only
+	std::vector<transformed_vertex_t> clip_scratch;
+	clip_scratch.reserve(max_clipped_vertices);
+	for (int node_idx : transformed.visible_nodes)
+	{
+		const node_t & node = scene.nodes[node_idx];
+		transformed_node_t & transformed_node = transformed.nodes[node_idx];
+		for (size_t p=0 ; p<node.primitives.size() ; p++)
+			if (transformed_node.primitives[p].visible)
+				mark_visible_vertices(scene, node.primitives[p], transformed_node.primitives[p], viewport);
+		draw_node<true>(scene, node, transformed_node, viewport, no_pixel_shader, clip_scratch);
+	}
+}
 
+// The rasterizer interpolates 1/z linearly across the screen, as z varies under a perspective projection.
+// Under the maps' orthographic projection it is z itself that varies linearly: the maps are drawn with 1/(2-z)
+// for the rasterizer to interpolate 2-z linearly, and keep 1/(2-z), which is nearer to the sun when smaller like z.
+void render_sun_shadows(const scene_t & scene, viewport_t & viewport)
+{
+	sun_shadows_t & shadows = viewport.m_sun_shadows;
+	shadows.fit(scene, viewport.camera());
 
-void fill_triangle(vertex_idx i0,
+	pixel_shader_t no_pixel_shader; // never called when drawing depth only
+	transformed_primitive_t caster;
+	std::vector<bvh_t::item_t> casters;
+	for (sun_shadows_t::cascade_t & cascade : shadows.m_cascades)
+	{
+		viewport_t & map = *cascade.m_map;
+		map.clear_depth();
+		const clip_rect_t clip{0, 0, map.m_w, map.m_h};
+
+		casters.clear();
+		if (cascade.m_z_end > 0)
+			scene.bvh.query(cascade.m_frustum, scene, casters);
+		for (auto [node_idx, primitive_idx] : casters)
+		{
+			const node_t & node = scene.nodes[node_idx];
+			const primitive_t & primitive = node.primitives[primitive_idx];
+			// the coarsest level of detail whose error stays under the viewport's threshold in texels
+			caster.lod = -1;
+			if (viewport.m_lod_pixel_error > 0 && primitive.bounds.radius > 0)
+			{
+				const float texels_per_unit = primitive.bounds_world.radius / primitive.bounds.radius / cascade.m_texel;
+				while (caster.lod+1 < (int)primitive.lods.size() && primitive.lods[caster.lod+1].error * texels_per_unit <= viewport.m_lod_pixel_error)
+					caster.lod++;
+			}
+			caster.vertices.resize(primitive.vertices.size());
+			// primitives without bounds may reach out of the scene's bounds, z is clamped
+			vertex_shader_t::transform_vertices_orthographic(primitive.vertices, 0, drawn_vertex_count(primitive, caster), cascade.m_matrix * node.original_to_world_matrix, caster.vertices.data());
+			const bool double_sided = primitive.material_id != -1 && scene.materials[primitive.material_id].double_sided;
+			for_each_triangle(primitive, caster, [&](vertex_idx i0, vertex_idx i1, vertex_idx i2, size_t)
+				{
+					// like the camera, the sun only sees the front faces of single sided primitives
+					if (double_sided || front_face_visible(caster.vertices[i0], caster.vertices[i1], caster.vertices[i2]))
+						fill_triangle_2<true>(&caster.vertices[i0], &caster.vertices[i1], &caster.vertices[i2], map, no_pixel_shader, true, clip, 0);
+				});
+		}
+	}
+}
+
+
+
+
+struct clip_vertex_t
+{
+	vertex_t clip; // projected, not divided by z
+	const transformed_vertex_t * mv;
+};
+
+inline vertex_t clip_coordinates(const transformed_vertex_t & tv, const viewport_t & vp)
+{
+	return transform(transform(tv.v_world, vp.camera().m_viewmatrix), vp.camera().m_projectionmatrix);
+}
+
+// Clips the triangle in homogeneous coordinates and calls emit(v0, v1, v2, front_face_visible, clipped) for each resulting triangle.
+// The primitive is left untouched: vertices created by the clipping are emplaced into scratch, whose references must stay valid
+// as long as the caller needs the triangles (a vector with enough capacity cleared for each triangle, or a deque).
+template<typename S, typename F>
+void clip_triangle(vertex_idx i0,
                    vertex_idx i1,
                    vertex_idx i2,
-                   node_t & node,
-                   primitive_t & primitive,
-                   viewport_t & vp,
-                   pixel_shader_t & pixel_shader)
+                   const transformed_primitive_t & primitive,
+                   const viewport_t & vp,
+                   S & scratch,
+                   F && emit)
 {
-	if (  !primitive.vertices[i0].yes
-	    ||!primitive.vertices[i1].yes
-	    ||!primitive.vertices[i2].yes )
+	const transformed_vertex_t & mv0 = primitive.vertices[i0];
+	const transformed_vertex_t & mv1 = primitive.vertices[i1];
+	const transformed_vertex_t & mv2 = primitive.vertices[i2];
+	if ( ! mv0.yes || ! mv1.yes || ! mv2.yes)
+		return;
+
+	auto front_face_visible = [](const transformed_vertex_t & a, const transformed_vertex_t & b, const transformed_vertex_t & c)
+		{
+			return cross((b.v_viewport-a.v_viewport),(c.v_viewport-a.v_viewport)).z() < 0;
+		};
+
+	// normal case: in front of the camera and within the guard band, already projected
+	const auto & m = vp.m_viewportmatrix;
+	auto inside = [&](const transformed_vertex_t & mv)
+		{
+			return mv.v_viewport.z() >= near_z
+			    && fabs(mv.v_viewport.x() - m[0][3]) <= guard_band * fabs(m[0][0])
+			    && fabs(mv.v_viewport.y() - m[1][3]) <= guard_band * fabs(m[1][1]);
+		};
+	if (inside(mv0) && inside(mv1) && inside(mv2))
 	{
-	    return;
+		emit(mv0, mv1, mv2, front_face_visible(mv0, mv1, mv2), false);
+		return;
 	}
-	const vertex_t * v0 = &primitive.vertices[i0].v_viewport;
-	const vertex_t * v1 = &primitive.vertices[i1].v_viewport;
-	const vertex_t * v2 = &primitive.vertices[i2].v_viewport;
 
-	bool front_face_visible = cross((*v1-*v0),(*v2-*v0)).z() < 0;
+	// Sutherland-Hodgman, each plane keeps the side where distance() >= 0
+	clip_vertex_t polygon_a[max_polygon_vertices];
+	clip_vertex_t polygon_b[max_polygon_vertices];
+	clip_vertex_t * polygon = polygon_a;
+	clip_vertex_t * clipped = polygon_b;
+	int count = 3;
+	polygon[0] = clip_vertex_t{clip_coordinates(mv0, vp), &mv0};
+	polygon[1] = clip_vertex_t{clip_coordinates(mv1, vp), &mv1};
+	polygon[2] = clip_vertex_t{clip_coordinates(mv2, vp), &mv2};
 
-	// handle cases where 1 or 2 vertices have screen z values below zero (behind the camera)
+	auto clip_polygon = [&](auto && distance)
+		{
+			int clipped_count = 0;
+			for (int k=0 ; k<count ; k++)
+			{
+				const clip_vertex_t & a = polygon[k];
+				const clip_vertex_t & b = polygon[(k+1) % count];
+				float da = distance(a.clip);
+				float db = distance(b.clip);
+				if (da >= 0)
+					clipped[clipped_count++] = a;
+				if ((da >= 0) == (db >= 0))
+					continue;
 
-	bool inverted_order = false;
+				// a->b crosses the plane
+				float cut = da / (da - db);
+				const transformed_vertex_t & va = *a.mv;
+				const transformed_vertex_t & vb = *b.mv;
+				transformed_vertex_t & new_vertex = scratch.emplace_back();
+				new_vertex.v_world    = va.v_world    + (vb.v_world   -va.v_world   )*cut;
+				new_vertex.tex_coords = va.tex_coords + (vb.tex_coords-va.tex_coords)*cut;
+				if (vb.normal_world == va.normal_world)
+					new_vertex.normal_world = va.normal_world;
+				else
+					new_vertex.normal_world = va.normal_world + (vb.normal_world-va.normal_world)*cut;
+				new_vertex.light      = va.light      + (vb.light     -va.light     )*cut;
+				new_vertex.light_back = va.light_back + (vb.light_back-va.light_back)*cut;
+				new_vertex.yes = true;
+				vertex_shader_t::world_to_viewport(new_vertex, vp);
+				clipped[clipped_count++] = clip_vertex_t{a.clip + (b.clip-a.clip)*cut, &new_vertex};
+			}
+			std::swap(polygon, clipped);
+			count = clipped_count;
+		};
 
-	// sort by Z DESC
-	if (v1->z() > v0->z()) {
-		std::swap(v0, v1);
-		std::swap(i0, i1);
-		inverted_order = ! inverted_order;
-	}
-	if (v2->z() > v1->z()) {
-		std::swap(v1, v2);
-		std::swap(i1, i2);
-		inverted_order = ! inverted_order;
-	}
-	if (v1->z() > v0->z()) {
-		std::swap(v0, v1);
-		std::swap(i0, i1);
-		inverted_order = ! inverted_order;
-	}
+	clip_polygon([](const vertex_t & c) { return c.z() - near_z;               });
+	clip_polygon([](const vertex_t & c) { return guard_band * c.z() + c.x(); });
+	clip_polygon([](const vertex_t & c) { return guard_band * c.z() - c.x(); });
+	clip_polygon([](const vertex_t & c) { return guard_band * c.z() + c.y(); });
+	clip_polygon([](const vertex_t & c) { return guard_band * c.z() - c.y(); });
 
-	if (v2->z() >= 0.001)
+	// the polygon keeps the triangle's winding
+	for (int k=1 ; k+1<count ; k++)
 	{
-		// normal case
-		fill_triangle_2(i0, i1, i2, primitive, vp, pixel_shader, front_face_visible);
+		const transformed_vertex_t & a = *polygon[0].mv;
+		const transformed_vertex_t & b = *polygon[k].mv;
+		const transformed_vertex_t & c = *polygon[k+1].mv;
+		emit(a, b, c, front_face_visible(a, b, c), true);
 	}
-	else if (v1->z() < 0.001)
+}
+
+template<bool depth_only>
+void fill_triangle(vertex_idx i0,
+                   vertex_idx i1,
+                   vertex_idx i2,
+                   const transformed_primitive_t & primitive,
+                   viewport_t & vp,
+                   pixel_shader_t & pixel_shader,
+                   std::vector<transformed_vertex_t> & scratch,
+                   const cached_face_t & cached_face)
+{
+	const clip_rect_t clip{vp.m_x, vp.m_y, vp.m_w, vp.m_h};
+
+	scratch.clear(); // capacity is kept, references stay valid while clipping
+	clip_triangle(i0, i1, i2, primitive, vp, scratch, [&](const transformed_vertex_t & v0, const transformed_vertex_t & v1, const transformed_vertex_t & v2, bool front_face_visible, bool clipped)
+		{
+			if constexpr ( ! depth_only)
+				pixel_shader.cached_face = clipped ? cached_face_t{} : cached_face;
+			fill_triangle_2<depth_only>(&v0, &v1, &v2, vp, pixel_shader, front_face_visible, clip, 0);
+		});
+}
+
+void bin_triangles(const scene_t & scene, const node_t & node, const transformed_node_t & transformed_node, viewport_t & vp, tile_bins_t & bins)
+{
+	for (size_t p=0 ; p<node.primitives.size() ; p++)
 	{
-		// only v0 in front of the camera
-		float cut_1 = (v0->z()-0.001f) / (v0->z() - v1->z());
-		mesh_vertex_t & new_vertex_1 = primitive.vertices.emplace_back();
-		new_vertex_1.v_world    = primitive.vertices[i0].v_world      + (primitive.vertices[i1].v_world     -primitive.vertices[i0].v_world     )*cut_1;
-		new_vertex_1.tex_coords = primitive.vertices[i0].tex_coords   + (primitive.vertices[i1].tex_coords  -primitive.vertices[i0].tex_coords  )*cut_1;
-		if (primitive.vertices[i1].normal == primitive.vertices[i0].normal)
-			new_vertex_1.normal = primitive.vertices[i0].normal;
-		else
-			new_vertex_1.normal = primitive.vertices[i0].normal       + (primitive.vertices[i1].normal      -primitive.vertices[i0].normal      )*cut_1;
-		vertex_shader_t::world_to_viewport(new_vertex_1, node, vp);
-
-		float cut_2 = (v0->z()-0.001f) / (v0->z() - v2->z());
-		mesh_vertex_t & new_vertex_2 = primitive.vertices.emplace_back();
-		new_vertex_2.v_world    = primitive.vertices[i0].v_world      + (primitive.vertices[i2].v_world     -primitive.vertices[i0].v_world     )*cut_2;
-		new_vertex_2.tex_coords = primitive.vertices[i0].tex_coords   + (primitive.vertices[i2].tex_coords  -primitive.vertices[i0].tex_coords  )*cut_2;
-		if (primitive.vertices[i2].normal == primitive.vertices[i0].normal)
-			new_vertex_2.normal = primitive.vertices[i0].normal;
-		else
-			new_vertex_2.normal = primitive.vertices[i0].normal       + (primitive.vertices[i2].normal      -primitive.vertices[i0].normal      )*cut_2;
-		vertex_shader_t::world_to_viewport(new_vertex_2, node, vp);
+		const primitive_t & primitive = node.primitives[p];
+		const transformed_primitive_t & transformed_primitive = transformed_node.primitives[p];
+		if ( ! transformed_primitive.visible)
+			continue;
 
-		front_face_visible = cross((new_vertex_1.v_viewport-*v0),(new_vertex_2.v_viewport-*v0)).z() < 0;
-		if (inverted_order)
-			front_face_visible = ! front_face_visible;
+		for_each_triangle(primitive, transformed_primitive, [&](vertex_idx i0, vertex_idx i1, vertex_idx i2, size_t face_idx)
+			{
+				clip_triangle(i0, i1, i2, transformed_primitive, vp, bins.clipped_vertices, [&](const transformed_vertex_t & mv0, const transformed_vertex_t & mv1, const transformed_vertex_t & mv2, bool front_face_visible, bool clipped)
+					{
+						const vertex_t & v0 = mv0.v_viewport;
+						const vertex_t & v1 = mv1.v_viewport;
+						const vertex_t & v2 = mv2.v_viewport;
 
-		fill_triangle_2(i0, primitive.vertices.size()-2, primitive.vertices.size()-1, primitive, vp, pixel_shader, front_face_visible);
-		primitive.vertices.pop_back();
-		primitive.vertices.pop_back();
-		return;
+						// screen bounding box, in tiles
+						int x_min = (int)floor(std::min(v0.x(), std::min(v1.x(), v2.x()))) - vp.m_x;
+						int x_max = (int) ceil(std::max(v0.x(), std::max(v1.x(), v2.x()))) - vp.m_x;
+						int y_min = (int)floor(std::min(v0.y(), std::min(v1.y(), v2.y()))) - vp.m_y;
+						int y_max = (int) ceil(std::max(v0.y(), std::max(v1.y(), v2.y()))) - vp.m_y;
+						if (x_max < 0 || y_max < 0 || x_min >= vp.m_w || y_min >= vp.m_h)
+							return;
+						int tx_begin = std::max(x_min, 0) / bins.tile_size;
+						int tx_end   = std::min(x_max, vp.m_w-1) / bins.tile_size;
+						int ty_begin = std::max(y_min, 0) / bins.tile_size;
+						int ty_end   = std::min(y_max, vp.m_h-1) / bins.tile_size;
+
+						std::uint32_t triangle_idx = bins.triangles.size();
+						bins.triangles.push_back(binned_triangle_t{&primitive, &mv0, &mv1, &mv2, front_face_visible
+						                                          ,clipped ? cached_face_t{} : cached_face(scene, node, primitive, transformed_primitive, vp, face_idx)});
+						for (int ty=ty_begin ; ty<=ty_end ; ty++)
+							for (int tx=tx_begin ; tx<=tx_end ; tx++)
+								bins.tiles[ty*bins.tiles_x + tx].push_back(triangle_idx);
+					});
+			});
 	}
-	else if (v2->z() < 0.001)
-	{
-		// only v2 is in the back of the camera
-		float cut_0 = (v0->z()-0.001f) / (v0->z() - v2->z());
-		mesh_vertex_t & new_vertex_1 = primitive.vertices.emplace_back();
-		new_vertex_1.v_world    = primitive.vertices[i0].v_world      + (primitive.vertices[i2].v_world     -primitive.vertices[i0].v_world     )*cut_0;
-		new_vertex_1.tex_coords = primitive.vertices[i0].tex_coords   + (primitive.vertices[i2].tex_coords  -primitive.vertices[i0].tex_coords  )*cut_0;
-		if (primitive.vertices[i2].normal == primitive.vertices[i0].normal)
-			new_vertex_1.normal = primitive.vertices[i0].normal;
-		else
-			new_vertex_1.normal = primitive.vertices[i0].normal       + (primitive.vertices[i2].normal      -primitive.vertices[i0].normal      )*cut_0;
-		vertex_shader_t::world_to_viewport(new_vertex_1, node, vp);
-
-		float cut_1 = (v1->z()-0.001f) / (v1->z() - v2->z());
-		mesh_vertex_t & new_vertex_2 = primitive.vertices.emplace_back();
-		new_vertex_2.v_world    = primitive.vertices[i1].v_world      + (primitive.vertices[i2].v_world     -primitive.vertices[i1].v_world     )*cut_1;
-		new_vertex_2.tex_coords = primitive.vertices[i1].tex_coords   + (primitive.vertices[i2].tex_coords  -primitive.vertices[i1].tex_coords  )*cut_1;
-		if (primitive.vertices[i2].normal == primitive.vertices[i1].normal)
-			new_vertex_2.normal = primitive.vertices[i1].normal;
-		else
-			new_vertex_2.normal = primitive.vertices[i1].normal       + (primitive.vertices[i2].normal      -primitive.vertices[i1].normal      )*cut_1;
-		vertex_shader_t::world_to_viewport(new_vertex_2, node, vp);
+}
 
-		front_face_visible = cross((*v1-*v0),(new_vertex_2.v_viewport-*v0)).z() < 0;
-		if (inverted_order)
-			front_face_visible = ! front_face_visible;
+void rasterize_tiles(const scene_t & scene, viewport_t & vp, tile_bins_t & bins, int thread_count)
+{
+	std::atomic<int> next_tile = 0;
 
-		fill_triangle_2(i0, i1, primitive.vertices.size()-1, primitive, vp, pixel_shader, front_face_visible);
+	auto worker = [&]()
+		{
+			// shaders hold per-triangle state, each thread gets its own
+			std::shared_ptr<pixel_shader_t> pixel_shader = vp.m_pixel_shader->clone();
 
-		front_face_visible = cross((new_vertex_2.v_viewport-*v0),(new_vertex_1.v_viewport-*v0)).z() < 0;
-		if (inverted_order)
-			front_face_visible = ! front_face_visible;
+			for (int tile_idx = next_tile++ ; tile_idx < (int)bins.tiles.size() ; tile_idx = next_tile++)
+			{
+				const auto & tile = bins.tiles[tile_idx];
+				if (tile.empty())
+					continue;
 
-		fill_triangle_2(i0, primitive.vertices.size()-1, primitive.vertices.size()-2, primitive, vp, pixel_shader, front_face_visible);
+				int tx = tile_idx % bins.tiles_x;
+				int ty = tile_idx / bins.tiles_x;
+				clip_rect_t clip{vp.m_x + tx*bins.tile_size
+				                ,vp.m_y + ty*bins.tile_size
+				                ,std::min(bins.tile_size, vp.m_w - tx*bins.tile_size)
+				                ,std::min(bins.tile_size, vp.m_h - ty*bins.tile_size)
+				                };
 
-		primitive.vertices.pop_back();
-		primitive.vertices.pop_back();
-		return;
-	}
+				// the depth of the tile's triangles first, then only the nearest get shaded
+				if (vp.m_z_prepass)
+					for (std::uint32_t triangle_idx : tile)
+					{
+						const binned_triangle_t & t = bins.triangles[triangle_idx];
+						fill_triangle_2<true>(t.v0, t.v1, t.v2, vp, *pixel_shader, t.front_face_visible, clip, triangle_idx);
+					}
 
-	
+				const primitive_t * current_primitive = nullptr;
+				for (std::uint32_t triangle_idx : tile)
+				{
+					const binned_triangle_t & t = bins.triangles[triangle_idx];
+					if (t.primitive != current_primitive)
+					{
+						pixel_shader->prepare_for_primitive(*t.primitive, scene, vp);
+						current_primitive = t.primitive;
+					}
+					pixel_shader->cached_face = t.cached_face;
+					fill_triangle_2<false>(t.v0, t.v1, t.v2, vp, *pixel_shader, t.front_face_visible, clip, triangle_idx);
+				}
+			}
+		};
+
+	worker_pool().run(thread_count, [&](int) { worker(); });
 }
 
-void fill_triangle_2([[maybe_unused]] vertex_idx i0,
-                     [[maybe_unused]] vertex_idx i1,
-                     [[maybe_unused]] vertex_idx i2,
-                     [[maybe_unused]] primitive_t & primitive,
-                     [[maybe_unused]] viewport_t & vp,
-                     [[maybe_unused]] pixel_shader_t & pixel_shader, 
-                     bool front_face_visible)
+// Sort points by screen Y ASC
+inline void sort_by_screen_y(const transformed_vertex_t *& v0, const transformed_vertex_t *& v1, const transformed_vertex_t *& v2)
 {
-	const vertex_t * v0 = &primitive.vertices[i0].v_viewport;
-	const vertex_t * v1 = &primitive.vertices[i1].v_viewport;
-	const vertex_t * v2 = &primitive.vertices[i2].v_viewport;
-
-	bool inverted = !front_face_visible;
-
-	// Sort points by screen Y ASC
-	if (v1->y() < v0->y()) {
+	if (v1->v_viewport.y() < v0->v_viewport.y())
 		std::swap(v0, v1);
-		std::swap(i0, i1);
-	}
-	if (v2->y() < v1->y()) {
+	if (v2->v_viewport.y() < v1->v_viewport.y())
 		std::swap(v1, v2);
-		std::swap(i1, i2);
-	}
-	if (v1->y() < v0->y()) {
+	if (v1->v_viewport.y() < v0->v_viewport.y())
 		std::swap(v0, v1);
-		std::swap(i0, i1);
-	}
+}
+
+// Second pass of deferred shading: replays, for each covered pixel, the pixel shader calls that
+// fill_triangle_2 would have made for it. Consecutive pixels of the same scanline of the same triangle
+// share the preparation and are shaded together, up to span_size at a time. Bands of rows are shared between threads.
+void shade_visibility(const scene_t & scene, viewport_t & vp, const tile_bins_t & bins)
+{
+	static const int band_height = 16;
+	std::atomic<int> next_band = 0;
+
+	auto worker = [&]()
+		{
+			std::shared_ptr<pixel_shader_t> pixel_shader = vp.m_pixel_shader->clone();
+			const primitive_t * current_primitive = nullptr;
+			std::uint32_t current_triangle = visibility_sample_t::triangle_mask;
+			std::uint32_t current_tag = ~0u;
+			float progress_left = -1, progress_right = -1;
+
+			// the pixels of the current run from span_x, one bit each in coverage
+			float progress[pixel_shader_t::span_size];
+			int colors[pixel_shader_t::span_size];
+			std::uint32_t coverage = 0;
+			int span_x = 0;
+			auto shade_span = [&](pixel_colors * video)
+				{
+					if (coverage == 0)
+						return;
+					pixel_shader->shade_span(progress, coverage, 32 - __builtin_clz(coverage), colors);
+					for (std::uint32_t bits = coverage ; bits ; bits &= bits - 1)
+					{
+						int i = __builtin_ctz(bits);
+						video[span_x + i] = colors[i];
+					}
+					coverage = 0;
+				};
+
+			for (int y_begin = band_height * next_band++ ; y_begin < vp.m_h ; y_begin = band_height * next_band++)
+				for (int y = y_begin ; y < std::min(y_begin + band_height, vp.m_h) ; y++)
+				{
+					pixel_colors *video = &((pixel_colors*)vp.m_screen->pixels)[(int) ( (y+vp.m_y)*vp.m_screen->pitch/vp.m_screen->format->BytesPerPixel + vp.m_x)];
+					const float * zb = &vp.zbuffer()[y*vp.m_w];
+					const visibility_sample_t * sample = &vp.m_visibility[y*vp.m_w];
+					for (int x=0 ; x<vp.m_w ; x++)
+					{
+						if (zb[x] == max_z.f)
+							continue; // nothing drawn here
+
+						const visibility_sample_t & s = sample[x];
+						if (s.triangle != current_tag)
+						{
+							shade_span(video);
+							std::uint32_t triangle_idx = s.triangle & visibility_sample_t::triangle_mask;
+							if (triangle_idx != current_triangle)
+							{
+								const binned_triangle_t & t = bins.triangles[triangle_idx];
+								if (t.primitive != current_primitive)
+								{
+									pixel_shader->prepare_for_primitive(*t.primitive, scene, vp);
+									current_primitive = t.primitive;
+								}
+								const transformed_vertex_t * v0 = t.v0, * v1 = t.v1, * v2 = t.v2;
+								sort_by_screen_y(v0, v1, v2);
+								pixel_shader->cached_face = t.cached_face;
+								pixel_shader->prepare_for_triangle(*v0, *v1, *v2, !t.front_face_visible);
+								current_triangle = triangle_idx;
+							}
+							bool long_line_on_right = s.triangle & visibility_sample_t::long_line_on_right;
+							if (s.triangle & visibility_sample_t::lower_half)
+								pixel_shader->prepare_for_lower_triangle(long_line_on_right);
+							else
+								pixel_shader->prepare_for_upper_triangle(long_line_on_right);
+							current_tag = s.triangle;
+							progress_left = -1;
+						}
+						if (s.progress_left != progress_left || s.progress_right != progress_right)
+						{
+							shade_span(video);
+							progress_left  = s.progress_left;
+							progress_right = s.progress_right;
+							pixel_shader->prepare_for_scanline(progress_left, progress_right);
+						}
+						if (coverage != 0 && x - span_x >= pixel_shader_t::span_size)
+							shade_span(video);
+						if (coverage == 0)
+							span_x = x;
+						progress[x - span_x] = s.progress;
+						coverage |= 1u << (x - span_x);
+					}
+					shade_span(video);
+				}
+		};
+
+	worker_pool().run(vp.m_thread_count, [&](int) { worker(); });
+}
+
+// After a z-prepass the z-buffer already holds the depth of the nearest triangles: the shading pass draws the pixels
+// whose depth is equal to it, the hierarchical z would reject them
+template<bool depth_only>
+inline bool use_hierarchical_z(const viewport_t & vp)
+{
+	return vp.m_use_hierarchical_z && (depth_only || ! vp.m_z_prepass);
+}
+
+template<bool depth_only>
+void fill_triangle_2(const transformed_vertex_t * mv0,
+                     const transformed_vertex_t * mv1,
+                     const transformed_vertex_t * mv2,
+                     viewport_t & vp,
+                     pixel_shader_t & pixel_shader, 
+                     bool front_face_visible,
+                     const clip_rect_t & clip,
+                     std::uint32_t triangle_idx)
+{
+	bool inverted = !front_face_visible;
+
+	sort_by_screen_y(mv0, mv1, mv2);
+	const vertex_t * v0 = &mv0->v_viewport;
+	const vertex_t * v1 = &mv1->v_viewport;
+	const vertex_t * v2 = &mv2->v_viewport;
 
 	// get pixel limits
 	int y0 = (int) ceil(v0->y());
@@ -393,16 +818,52 @@ void fill_triangle_2([[maybe_unused]] vertex_idx i0,
 
 	if (y0==y2) return; // All on 1 scanline, not worth drawing
 
+	if (use_hierarchical_z<depth_only>(vp))
+	{
+		// whole triangle behind what's already drawn in its bounding box?
+		int x_begin = std::max((int)floor(std::min(std::min(v0->x(), v1->x()), v2->x())), clip.x);
+		int x_end   = std::min((int)ceil (std::max(std::max(v0->x(), v1->x()), v2->x())) + 1, clip.x + clip.w);
+		int y_begin = std::max(y0, clip.y);
+		int y_end   = std::min(y2, clip.y + clip.h);
+		if (x_begin >= x_end || y_begin >= y_end)
+			return;
+		float z_min = std::min(std::min(v0->z(), v1->z()), v2->z());
+		if (vp.m_hierarchical_z.hidden(x_begin-vp.m_x, y_begin-vp.m_y, x_end-vp.m_x, y_end-vp.m_y, z_min, vp.zbuffer()))
+		{
+			vp.m_hierarchical_z.m_rejected_triangles++;
+			return;
+		}
+	}
+
+	const bool simd = vp.m_rasterizer == viewport_t::rasterizer_t::HALFSPACE;
+	edge_functions_t edges;
+	if (simd)
+	{
+		const vertex_t * v[3] = {v0, v1, v2};
+		// orient the edges so that the opposite vertex is on the positive side
+		float e0_at_v2 = (v1->y()-v0->y())*(v2->x()-v0->x()) - (v1->x()-v0->x())*(v2->y()-v0->y());
+		float sign = e0_at_v2 < 0 ? -1.0f : 1.0f;
+		for (int k=0 ; k<3 ; k++)
+		{
+			const vertex_t & va = *v[k];
+			const vertex_t & vb = *v[(k+1)%3];
+			edges.a[k] = sign * (vb.y()-va.y());
+			edges.b[k] = sign * (va.x()-vb.x());
+			edges.c[k] = - edges.a[k]*va.x() - edges.b[k]*va.y();
+			edges.inclusive[k] = edges.a[k] > 0 || (edges.a[k] == 0 && edges.b[k] > 0);
+		}
+	}
+
 	line_side side_long;
 	line_side side_short;
 
 	// Init long line
 	side_long.ratio = (v2->x()-v0->x()) / (v2->y()-v0->y()); // never div#0 because y0!=y2
 	side_long.interpolator.InitSelf(v2->y() - v0->y(), v0->z(), v2->z()); // *t0, *t2
-	if (y0 < vp.m_y) {
-		// start at first scanline of viewport
-		side_long.interpolator.DisplaceStartingPoint(vp.m_y-v0->y());
-		side_long.x = v0->x() + side_long.ratio*(vp.m_y-v0->y());
+	if (y0 < clip.y) {
+		// start at first scanline of the clipping area
+		side_long.interpolator.DisplaceStartingPoint(clip.y-v0->y());
+		side_long.x = v0->x() + side_long.ratio*(clip.y-v0->y());
 	} else {
 		side_long.interpolator.DisplaceStartingPoint(y0-v0->y());
 		side_long.x = v0->x() + side_long.ratio*(y0-v0->y());
@@ -410,15 +871,18 @@ void fill_triangle_2([[maybe_unused]] vertex_idx i0,
 
 	int y, y_end; // scanlines upper and lower bound of whole triangle
 
-	pixel_shader.prepare_for_triangle(i0, i1, i2, inverted);
+	// deferred shading: pixels are only tagged with the triangle and the half they belong to, shading comes later
+	const bool deferred = vp.m_deferred_shading;
+	if ( ! depth_only && ! deferred)
+		pixel_shader.prepare_for_triangle(*mv0, *mv1, *mv2, inverted);
 
 	// upper half of the triangle
-	if (y1 >= vp.m_y) // dont skip: at least some part is in the viewport
+	if (y1 >= clip.y) // dont skip: at least some part is in the clipping area
 	{
 		side_short.ratio = (v1->x()-v0->x()) / (v1->y()-v0->y()); // never div#0 because y0!=y2
 		side_short.interpolator.InitSelf(v1->y() - v0->y(), v0->z(), v1->z()); // *t0, *t1
-		y = std::max(y0, vp.m_y);
-		y_end = std::min(y1, vp.m_y + vp.m_h);
+		y = std::max(y0, clip.y);
+		y_end = std::min(y1, clip.y + clip.h);
 		side_short.interpolator.DisplaceStartingPoint(y-v0->y());
 		side_short.x = v0->x() + side_short.ratio*(y-v0->y());
 
@@ -430,18 +894,23 @@ void fill_triangle_2([[maybe_unused]] vertex_idx i0,
 					return {side_long, side_short};
 			}();
 
-		pixel_shader.prepare_for_upper_triangle(long_line_on_right);
+		std::uint32_t visibility_tag = triangle_idx | 0 | (long_line_on_right ? visibility_sample_t::long_line_on_right : 0);
+		if ( ! depth_only && ! deferred)
+			pixel_shader.prepare_for_upper_triangle(long_line_on_right);
 
-		fill_half_triangle(y, y_end, side_left, side_right, vp, pixel_shader);
+		if (simd)
+			fill_half_triangle_simd<depth_only>(y, y_end, side_left, side_right, edges, vp, pixel_shader, clip, visibility_tag);
+		else
+			fill_half_triangle<depth_only>(y, y_end, side_left, side_right, vp, pixel_shader, clip, visibility_tag);
 	}
 
 	// lower half of the triangle
-	if (y1 < vp.m_y + vp.m_h) // dont skip: at least some part is in the viewport
+	if (y1 < clip.y + clip.h) // dont skip: at least some part is in the clipping area
 	{
 		side_short.ratio = (v2->x()-v1->x()) / (v2->y()-v1->y()); // never div#0 because y0!=y2
 		side_short.interpolator.InitSelf(v2->y() - v1->y(), v1->z(), v2->z()); // *t1, *t2
-		y = std::max(y1, vp.m_y);
-		y_end = std::min(y2, vp.m_y + vp.m_h);
+		y = std::max(y1, clip.y);
+		y_end = std::min(y2, clip.y + clip.h);
 		side_short.interpolator.DisplaceStartingPoint(y-v1->y());
 		side_short.x = v1->x() + side_short.ratio*(y-v1->y());
 
@@ -453,26 +922,121 @@ void fill_triangle_2([[maybe_unused]] vertex_idx i0,
 					return {side_long, side_short};
 			}();
 
-		pixel_shader.prepare_for_lower_triangle(long_line_on_right);
+		std::uint32_t visibility_tag = triangle_idx | visibility_sample_t::lower_half | (long_line_on_right ? visibility_sample_t::long_line_on_right : 0);
+		if ( ! depth_only && ! deferred)
+			pixel_shader.prepare_for_lower_triangle(long_line_on_right);
+
+		if (simd)
+			fill_half_triangle_simd<depth_only>(y, y_end, side_left, side_right, edges, vp, pixel_shader, clip, visibility_tag);
+		else
+			fill_half_triangle<depth_only>(y, y_end, side_left, side_right, vp, pixel_shader, clip, visibility_tag);
+	}
+}
+
+// writes a shaded pixel that passed the z-test, sorting it into the transparency layers if needed
+inline void plot(viewport_t & vp, pixel_colors * video, float * zb, int zero_based_offset, float z, pixel_colors new_color)
+{
+	if (vp.m_got_transparency == false)
+	{
+		*video = new_color;
+		*zb = z;
+		return;
+	}
+	size_t layer_idx = 0;
+	for (layer_idx=0 ; layer_idx<vp.m_transparency_layers.size() ; layer_idx++)
+		if (vp.m_transparency_layers[layer_idx].m_zbuffer[zero_based_offset] == max_z.f
+		  ||vp.m_transparency_layers[layer_idx].m_zbuffer[zero_based_offset] < z)
+			break;
+	if (new_color.o.a == 255)
+	{
+		// solid color, use the base (deepest, backest) layer
+		*video = new_color;
+		*zb = z;
+		// eliminat transparency layers that were further away
+		size_t i,k;
+		for (i=0,k=layer_idx ; k<vp.m_transparency_layers.size() ; i++,k++)
+		{
+			vp.m_transparency_layers[i].m_zbuffer[zero_based_offset] = vp.m_transparency_layers[k].m_zbuffer[zero_based_offset];
+			vp.m_transparency_layers[i].m_colors [zero_based_offset] = vp.m_transparency_layers[k].m_colors [zero_based_offset];
+		}
+		// zero remaining now-unused upper (fronter) transparency layers
+		for ( ; i<vp.m_transparency_layers.size() ; i++)
+		{
+			vp.m_transparency_layers[i].m_zbuffer[zero_based_offset] = max_z.f;
+			vp.m_transparency_layers[i].m_colors [zero_based_offset] = {0,0,0,0};
+		}
+	}
+	else
+	{
+		// transparency color, let's not user the base layer
+		// let's insert a transparency layer at layer_idx
+
+		bool all_layers_used = vp.m_transparency_layers.back().m_zbuffer[zero_based_offset] != max_z.f;
+		if (all_layers_used)
+		{
+			// shift layers down
+			while(layer_idx-->0)
+			{
+				std::swap(vp.m_transparency_layers[layer_idx].m_zbuffer[zero_based_offset],         z);
+				std::swap(vp.m_transparency_layers[layer_idx].m_colors [zero_based_offset], new_color);
+			}
+		}
+		else
+		{
+			// shift layers up
+			for ( ; layer_idx < vp.m_transparency_layers.size() ; layer_idx++)
+			{
+				std::swap(vp.m_transparency_layers[layer_idx].m_zbuffer[zero_based_offset],         z);
+				std::swap(vp.m_transparency_layers[layer_idx].m_colors [zero_based_offset], new_color);
+				if (z == max_z.f)
+					break; // we've reached the last used layer
+			}
+		}
+	}
+}
 
-		fill_half_triangle(y, y_end, side_left, side_right, vp, pixel_shader);
+// shades the pixels of a run that passed the z-test, one bit each in coverage, and plots them
+inline void plot_span(viewport_t & vp, pixel_shader_t & pixel_shader, pixel_colors * video, float * zb, int zero_based_offset
+                     ,const float * z, const float * progress, std::uint32_t coverage, int count)
+{
+	if (coverage == 0)
+		return;
+	int colors[pixel_shader_t::span_size];
+	pixel_shader.shade_span(progress, coverage, count, colors);
+	for (std::uint32_t bits = coverage ; bits ; bits &= bits - 1)
+	{
+		int i = __builtin_ctz(bits);
+		plot(vp, video+i, zb+i, zero_based_offset+i, z[i], colors[i]);
 	}
 }
 
+template<bool depth_only>
 void fill_half_triangle(int y, int y_end,
 	                    line_side & side_left, line_side & side_right,
                         viewport_t & vp,
-                        pixel_shader_t & pixel_shader)
+                        pixel_shader_t & pixel_shader,
+                        const clip_rect_t & clip,
+                        std::uint32_t visibility_tag)
 {
+	const bool hierarchical_z = use_hierarchical_z<depth_only>(vp);
+	const bool z_equal_passes = ! depth_only && vp.m_z_prepass;
 	for ( ; y < y_end ; y++)
 	{
-		int x1 = std::max((int)ceil(side_left .x), vp.m_x);
-		int x2 = std::min((int)ceil(side_right.x), vp.m_x+vp.m_w);
+		int x1 = std::max((int)ceil(side_left .x), clip.x);
+		int x2 = std::min((int)ceil(side_right.x), clip.x+clip.w);
 
-		if (x1 < x2)
+		if (x1 < x2 && hierarchical_z
+		 && vp.m_hierarchical_z.span_hidden(x1-vp.m_x, x2-vp.m_x, y-vp.m_y, std::min(side_left.interpolator.value(0), side_right.interpolator.value(0))))
+		{
+			vp.m_hierarchical_z.m_rejected_spans++;
+		}
+		else if (x1 < x2)
 		{
-			pixel_shader.prepare_for_scanline(side_left .interpolator.progress()
-			                                 ,side_right.interpolator.progress());
+			if (hierarchical_z)
+				vp.m_hierarchical_z.mark_drawn(x1-vp.m_x, x2-vp.m_x, y-vp.m_y);
+			if ( ! depth_only && ! vp.m_deferred_shading)
+				pixel_shader.prepare_for_scanline(side_left .interpolator.progress()
+				                                 ,side_right.interpolator.progress());
 			interpolator_g<1> qpixel;
 			qpixel.InitSelf(side_right.x - side_left.x,
 			            side_left .interpolator.value(0),
@@ -480,75 +1044,212 @@ void fill_half_triangle(int y, int y_end,
 			qpixel.DisplaceStartingPoint(x1 - side_left.x);
 
 			// fill_line
-			pixel_colors *video = &((pixel_colors*)vp.m_screen->pixels)[(int) ( y*vp.m_screen->pitch/vp.m_screen->format->BytesPerPixel + x1)];
 			int zero_based_offset = (int) ( (y-vp.m_y)*vp.m_w + (x1-vp.m_x));
 			float * zb = &vp.zbuffer()[zero_based_offset];
-			for ( ; x1 < x2 ; x1++,video++,zb++,zero_based_offset++,qpixel.Step() )
+			if constexpr (depth_only)
 			{
-				float z = qpixel.value(0);
-				if (z <= 0.001) // Ugly z-near clipping
-					continue;
-				if (z >= *zb)
-					continue;
-				pixel_colors new_color = pixel_shader.shade(qpixel.progress());
-				if (vp.m_got_transparency == false)
+				for ( ; x1 < x2 ; x1++,zb++,qpixel.Step() )
 				{
-					*video = new_color;
-					*zb = z;
-					continue;
+					float z = qpixel.value(0);
+					if (z > 0.001 && z < *zb) // Ugly z-near clipping
+						*zb = z;
 				}
-				size_t layer_idx = 0;
-				for (layer_idx=0 ; layer_idx<vp.m_transparency_layers.size() ; layer_idx++)
-					if (vp.m_transparency_layers[layer_idx].m_zbuffer[zero_based_offset] == max_z.f
-					  ||vp.m_transparency_layers[layer_idx].m_zbuffer[zero_based_offset] < z)
-						break;
-				if (new_color.o.a == 255)
+			}
+			else
+			{
+				pixel_colors *video = &((pixel_colors*)vp.m_screen->pixels)[(int) ( y*vp.m_screen->pitch/vp.m_screen->format->BytesPerPixel + x1)];
+
+				// the pixels that pass the z-test, shaded span_size at a time
+				float z_span[pixel_shader_t::span_size];
+				float progress_span[pixel_shader_t::span_size];
+				std::uint32_t coverage = 0;
+				int count = 0;
+				for ( ; x1 < x2 ; x1++,video++,zb++,zero_based_offset++,qpixel.Step() )
 				{
-					// solid color, use the base (deepest, backest) layer
-					*video = new_color;
-					*zb = z;
-					// eliminat transparency layers that were further away
-					size_t i,k;
-					for (i=0,k=layer_idx ; k<vp.m_transparency_layers.size() ; i++,k++)
+					if (count == pixel_shader_t::span_size)
 					{
-						vp.m_transparency_layers[i].m_zbuffer[zero_based_offset] = vp.m_transparency_layers[k].m_zbuffer[zero_based_offset];
-						vp.m_transparency_layers[i].m_colors [zero_based_offset] = vp.m_transparency_layers[k].m_colors [zero_based_offset];
+						plot_span(vp, pixel_shader, video-count, zb-count, zero_based_offset-count, z_span, progress_span, coverage, count);
+						coverage = 0;
+						count = 0;
 					}
-					// zero remaining now-unused upper (fronter) transparency layers
-					for ( ; i<vp.m_transparency_layers.size() ; i++)
+					int i = count++;
+					float z = qpixel.value(0);
+					if (z <= 0.001) // Ugly z-near clipping
+						continue;
+					if (z_equal_passes ? z > *zb : z >= *zb)
+						continue;
+					if (vp.m_deferred_shading)
 					{
-						vp.m_transparency_layers[i].m_zbuffer[zero_based_offset] = max_z.f;
-						vp.m_transparency_layers[i].m_colors [zero_based_offset] = {0,0,0,0};
+						*zb = z;
+						vp.m_visibility[zero_based_offset] = {visibility_tag, side_left.interpolator.progress(), side_right.interpolator.progress(), qpixel.progress()};
+						continue;
 					}
+					z_span[i] = z;
+					progress_span[i] = qpixel.progress();
+					coverage |= 1u << i;
 				}
+				plot_span(vp, pixel_shader, video-count, zb-count, zero_based_offset-count, z_span, progress_span, coverage, count);
+			}
+		}
+		side_left .x += side_left .ratio;
+		side_right.x += side_right.ratio;
+		side_left .interpolator.Step();
+		side_right.interpolator.Step();
+	}
+}
+
+// Same contract as fill_half_triangle, but coverage, depth and scanline progress are computed 4 pixels at a time:
+// coverage from the triangle's edge functions, depth from 1/z which is linear in screen space.
+// Only pixels that are covered and pass the z-test reach the pixel shader.
+template<bool depth_only>
+void fill_half_triangle_simd(int y, int y_end,
+                             line_side & side_left, line_side & side_right,
+                             const edge_functions_t & edges,
+                             viewport_t & vp,
+                             pixel_shader_t & pixel_shader,
+                             const clip_rect_t & clip,
+                             std::uint32_t visibility_tag)
+{
+	const __m128 lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+	const __m128 zero  = _mm_setzero_ps();
+	const __m128 one   = _mm_set1_ps(1.0f);
+	const __m128 z_near = _mm_set1_ps(0.001f);
+	__m128 inclusive[3];
+	__m128 a[3], a4[3];
+	for (int k=0 ; k<3 ; k++)
+	{
+		inclusive[k] = _mm_castsi128_ps(_mm_set1_epi32(edges.inclusive[k] ? -1 : 0));
+		a [k] = _mm_set1_ps(edges.a[k]);
+		a4[k] = _mm_set1_ps(edges.a[k] * 4);
+	}
+
+	alignas(16) float z_out[4];
+	alignas(16) float progress_out[4];
+	// the pixels that pass the z-test, shaded span_size at a time
+	alignas(16) float z_span[pixel_shader_t::span_size];
+	alignas(16) float progress_span[pixel_shader_t::span_size];
+	static_assert(pixel_shader_t::span_size % 4 == 0);
+
+	const bool hierarchical_z = use_hierarchical_z<depth_only>(vp);
+	const bool z_equal_passes = ! depth_only && vp.m_z_prepass;
+	for ( ; y < y_end ; y++)
+	{
+		// one pixel of margin on each side, the edge functions decide the exact coverage
+		int x1 = std::max((int)floor(side_left .x), clip.x);
+		int x2 = std::min((int)ceil (side_right.x) + 1, clip.x+clip.w);
+
+		if (x1 < x2 && hierarchical_z
+		 && vp.m_hierarchical_z.span_hidden(x1-vp.m_x, x2-vp.m_x, y-vp.m_y, std::min(side_left.interpolator.value(0), side_right.interpolator.value(0))))
+		{
+			vp.m_hierarchical_z.m_rejected_spans++;
+		}
+		else if (x1 < x2)
+		{
+			if (hierarchical_z)
+				vp.m_hierarchical_z.mark_drawn(x1-vp.m_x, x2-vp.m_x, y-vp.m_y);
+			if ( ! depth_only && ! vp.m_deferred_shading)
+				pixel_shader.prepare_for_scanline(side_left .interpolator.progress()
+				                                 ,side_right.interpolator.progress());
+
+			float span = side_right.x - side_left.x;
+			float inv_z_left  = 1.0f / side_left .interpolator.value(0);
+			float inv_z_right = 1.0f / side_right.interpolator.value(0);
+			__m128 left_x      = _mm_set1_ps(side_left.x);
+			__m128 inv_span    = _mm_set1_ps(span > 0 ? 1.0f / span : 0.0f);
+			__m128 iz_left     = _mm_set1_ps(inv_z_left);
+			__m128 iz_dir      = _mm_set1_ps(inv_z_right - inv_z_left);
+			__m128 iz_right    = _mm_set1_ps(inv_z_right);
+			__m128 x_end       = _mm_set1_ps(x2);
+
+			__m128 x = _mm_add_ps(_mm_set1_ps(x1), lanes);
+			__m128 e[3];
+			for (int k=0 ; k<3 ; k++)
+				e[k] = _mm_add_ps(_mm_mul_ps(a[k], x), _mm_set1_ps(edges.b[k]*y + edges.c[k]));
+
+			// the row of the screen, none when drawing depth only
+			pixel_colors *video_row = depth_only ? nullptr : &((pixel_colors*)vp.m_screen->pixels)[(int) ( y*vp.m_screen->pitch/vp.m_screen->format->BytesPerPixel)];
+			int zero_based_offset = (int) ( (y-vp.m_y)*vp.m_w + (x1-vp.m_x));
+			float * zb = &vp.zbuffer()[zero_based_offset];
+
+			std::uint32_t coverage = 0;
+			int count = 0;
+			for ( ; x1 < x2 ; x1+=4, zb+=4, zero_based_offset+=4)
+			{
+				if (! depth_only && count == pixel_shader_t::span_size)
+				{
+					plot_span(vp, pixel_shader, video_row+x1-count, zb-count, zero_based_offset-count, z_span, progress_span, coverage, count);
+					coverage = 0;
+					count = 0;
+				}
+				int i = count;
+				count += 4;
+
+				__m128 mask = _mm_cmplt_ps(x, x_end);
+				for (int k=0 ; k<3 ; k++)
+				{
+					mask = _mm_and_ps(mask, _mm_or_ps(_mm_cmpgt_ps(e[k], zero)
+					                                 ,_mm_and_ps(_mm_cmpeq_ps(e[k], zero), inclusive[k])));
+					e[k] = _mm_add_ps(e[k], a4[k]);
+				}
+
+				// 1/z is linear along the scanline, progress is the perspective-correct position between both sides
+				__m128 t        = _mm_mul_ps(_mm_sub_ps(x, left_x), inv_span);
+				__m128 z        = _mm_div_ps(one, _mm_add_ps(iz_left, _mm_mul_ps(iz_dir, t)));
+				__m128 progress = _mm_mul_ps(_mm_mul_ps(t, iz_right), z);
+				x = _mm_add_ps(x, _mm_set1_ps(4.0f));
+
+				int mask_bits = _mm_movemask_ps(mask);
+				if (mask_bits == 0)
+					continue;
+
+				__m128 zbuffer_values;
+				if (x1 + 4 <= x2)
+					zbuffer_values = _mm_loadu_ps(zb);
 				else
 				{
-					// transparency color, let's not user the base layer
-					// let's insert a transparency layer at layer_idx
+					alignas(16) float tail[4] = {max_z.f, max_z.f, max_z.f, max_z.f};
+					for (int i=0 ; i<x2-x1 ; i++)
+						tail[i] = zb[i];
+					zbuffer_values = _mm_load_ps(tail);
+				}
+				mask = _mm_and_ps(mask, z_equal_passes ? _mm_cmple_ps(z, zbuffer_values) : _mm_cmplt_ps(z, zbuffer_values));
+				mask = _mm_and_ps(mask, _mm_cmpgt_ps(z, z_near)); // Ugly z-near clipping
+				mask_bits = _mm_movemask_ps(mask);
+				if (mask_bits == 0)
+					continue;
 
-					bool all_layers_used = vp.m_transparency_layers.back().m_zbuffer[zero_based_offset] != max_z.f;
-					if (all_layers_used)
-					{
-						// shift layers down
-						while(layer_idx-->0)
-						{
-							std::swap(vp.m_transparency_layers[layer_idx].m_zbuffer[zero_based_offset],         z);
-							std::swap(vp.m_transparency_layers[layer_idx].m_colors [zero_based_offset], new_color);
-						}
-					}
+				if constexpr (depth_only)
+				{
+					if (x1 + 4 <= x2)
+						_mm_storeu_ps(zb, _mm_blendv_ps(zbuffer_values, z, mask));
 					else
 					{
-						// shift layers up
-						for ( ; layer_idx < vp.m_transparency_layers.size() ; layer_idx++)
+						_mm_store_ps(z_out, z);
+						for (int i=0 ; i<4 ; i++)
+							if (mask_bits & (1<<i))
+								zb[i] = z_out[i];
+					}
+					continue;
+				}
+
+				if (vp.m_deferred_shading)
+				{
+					_mm_store_ps(z_out, z);
+					_mm_store_ps(progress_out, progress);
+					for (int i=0 ; i<4 ; i++)
+						if (mask_bits & (1<<i))
 						{
-							std::swap(vp.m_transparency_layers[layer_idx].m_zbuffer[zero_based_offset],         z);
-							std::swap(vp.m_transparency_layers[layer_idx].m_colors [zero_based_offset], new_color);
-							if (z == max_z.f)
-								break; // we've reached the last used layer
+							zb[i] = z_out[i];
+							vp.m_visibility[zero_based_offset+i] = {visibility_tag, side_left.interpolator.progress(), side_right.interpolator.progress(), progress_out[i]};
 						}
-					}
+					continue;
 				}
+				_mm_store_ps(z_span + i, z);
+				_mm_store_ps(progress_span + i, progress);
+				coverage |= mask_bits << i;
 			}
+			if ( ! depth_only)
+				plot_span(vp, pixel_shader, video_row+x1-count, zb-count, zero_based_offset-count, z_span, progress_span, coverage, count);
 		}
 		side_left .x += side_left .ratio;
 		side_right.x += side_right.ratio;
@@ -0,0 +1,178 @@
+
+#include <algorithm>
+#include <smmintrin.h>
+
+#include <swegl/misc/fast_math.hpp>
+#include <swegl/render/pixel_shaders.hpp>
+#include <swegl/render/viewport.hpp>
+#include <swegl/render/vertex_shaders.hpp>
+
+namespace swegl
+{
+
+namespace
+{
+
+// the 3 first rows of a matrix, each coefficient broadcast to 4 lanes
+struct rows_ps
+{
+	__m128 m[3][4];
+
+	rows_ps(const matrix44_t & matrix)
+	{
+		for (int i=0 ; i<3 ; i++)
+			for (int j=0 ; j<4 ; j++)
+				m[i][j] = _mm_set1_ps(matrix[i][j]);
+	}
+
+	// same operations in the same order as transform(vertex_t, matrix44_t), so that results are bit-identical
+	inline void transform(__m128 x, __m128 y, __m128 z, __m128 & rx, __m128 & ry, __m128 & rz) const
+	{
+		rx = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0][0], x), _mm_mul_ps(m[0][1], y)), _mm_mul_ps(m[0][2], z)), m[0][3]);
+		ry = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[1][0], x), _mm_mul_ps(m[1][1], y)), _mm_mul_ps(m[1][2], z)), m[1][3]);
+		rz = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[2][0], x), _mm_mul_ps(m[2][1], y)), _mm_mul_ps(m[2][2], z)), m[2][3]);
+	}
+	inline void rotate(__m128 x, __m128 y, __m128 z, __m128 & rx, __m128 & ry, __m128 & rz) const
+	{
+		rx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0][0], x), _mm_mul_ps(m[0][1], y)), _mm_mul_ps(m[0][2], z));
+		ry = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[1][0], x), _mm_mul_ps(m[1][1], y)), _mm_mul_ps(m[1][2], z));
+		rz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[2][0], x), _mm_mul_ps(m[2][1], y)), _mm_mul_ps(m[2][2], z));
+	}
+};
+
+} // namespace
+
+void vertex_shader_t::transform_vertices(const vertex_streams_t & vertices, size_t begin, size_t end,
+                                         const matrix44_t & model, const matrix44_t & normal_matrix,
+                                         const viewport_t & viewport,
+                                         transformed_vertex_t * out)
+{
+	size_t i = begin;
+	// the streams are 32-byte aligned, reach a multiple of 4 for aligned loads
+	for ( ; i<end && (i&0x3) != 0 ; i++)
+		transform_vertex(vertices, i, model, normal_matrix, viewport, out[i]);
+
+	const rows_ps m_model     (model);
+	const rows_ps m_normal    (normal_matrix);
+	const rows_ps m_view      (viewport.camera().m_viewmatrix);
+	const rows_ps m_projection(viewport.camera().m_projectionmatrix);
+	const __m128 viewport_x_scale  = _mm_set1_ps(viewport.m_viewportmatrix[0][0]);
+	const __m128 viewport_x_offset = _mm_set1_ps(viewport.m_viewportmatrix[0][3]);
+	const __m128 viewport_y_scale  = _mm_set1_ps(viewport.m_viewportmatrix[1][1]);
+	const __m128 viewport_y_offset = _mm_set1_ps(viewport.m_viewportmatrix[1][3]);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 sign = _mm_set1_ps(-0.0f);
+
+	alignas(16) float world[3][4];
+	alignas(16) float screen[3][4];
+	alignas(16) float normal[3][4];
+
+	for ( ; i+4<=end ; i+=4)
+	{
+		__m128 x = _mm_load_ps(&vertices.x[i]);
+		__m128 y = _mm_load_ps(&vertices.y[i]);
+		__m128 z = _mm_load_ps(&vertices.z[i]);
+
+		__m128 wx, wy, wz;
+		m_model.transform(x, y, z, wx, wy, wz);
+		__m128 cx, cy, cz;
+		m_view.transform(wx, wy, wz, cx, cy, cz);
+		__m128 px, py, pz;
+		m_projection.transform(cx, cy, cz, px, py, pz);
+
+		// perspective divide by |z|, skipped where z == 0
+		__m128 divide = _mm_cmpneq_ps(pz, zero);
+		__m128 abs_z = _mm_andnot_ps(sign, pz);
+		px = _mm_blendv_ps(px, _mm_div_ps(px, abs_z), divide);
+		py = _mm_blendv_ps(py, _mm_div_ps(py, abs_z), divide);
+
+		px = _mm_add_ps(_mm_mul_ps(viewport_x_scale, px), viewport_x_offset);
+		py = _mm_add_ps(_mm_mul_ps(viewport_y_scale, py), viewport_y_offset);
+
+		__m128 nx, ny, nz;
+		m_normal.rotate(_mm_load_ps(&vertices.nx[i]), _mm_load_ps(&vertices.ny[i]), _mm_load_ps(&vertices.nz[i]), nx, ny, nz);
+		// like normal_t::normalize()
+		__m128 len_squared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz));
+		__m128 normalize = _mm_cmpneq_ps(len_squared, zero);
+		if constexpr (default_math_accuracy == math_accuracy_t::EXACT)
+		{
+			__m128 len = _mm_sqrt_ps(len_squared);
+			nx = _mm_blendv_ps(nx, _mm_div_ps(nx, len), normalize);
+			ny = _mm_blendv_ps(ny, _mm_div_ps(ny, len), normalize);
+			nz = _mm_blendv_ps(nz, _mm_div_ps(nz, len), normalize);
+		}
+		else
+		{
+			__m128 r = fast_rsqrt(len_squared);
+			nx = _mm_blendv_ps(nx, _mm_mul_ps(nx, r), normalize);
+			ny = _mm_blendv_ps(ny, _mm_mul_ps(ny, r), normalize);
+			nz = _mm_blendv_ps(nz, _mm_mul_ps(nz, r), normalize);
+		}
+
+		_mm_store_ps(world [0], wx); _mm_store_ps(world [1], wy); _mm_store_ps(world [2], wz);
+		_mm_store_ps(screen[0], px); _mm_store_ps(screen[1], py); _mm_store_ps(screen[2], pz);
+		_mm_store_ps(normal[0], nx); _mm_store_ps(normal[1], ny); _mm_store_ps(normal[2], nz);
+
+		// transformed vertices are AoS, read by the rasterizer one triangle at a time
+		for (int k=0 ; k<4 ; k++)
+		{
+			transformed_vertex_t & tv = out[i+k];
+			tv.yes = false;
+			tv.v_world    = vertex_t(world [0][k], world [1][k], world [2][k]);
+			tv.v_viewport = vertex_t(screen[0][k], screen[1][k], screen[2][k]);
+			tv.tex_coords = vertices.tex_coords(i+k);
+			tv.normal_world.x() = normal[0][k];
+			tv.normal_world.y() = normal[1][k];
+			tv.normal_world.z() = normal[2][k];
+		}
+	}
+
+	for ( ; i<end ; i++)
+		transform_vertex(vertices, i, model, normal_matrix, viewport, out[i]);
+}
+
+void vertex_shader_t::transform_vertices_orthographic(const vertex_streams_t & vertices, size_t begin, size_t end,
+                                                      const matrix44_t & matrix,
+                                                      transformed_vertex_t * out)
+{
+	auto one_vertex = [&](size_t i)
+		{
+			vertex_t v = transform(vertices.position(i), matrix);
+			out[i].v_viewport = vertex_t(v.x(), v.y(), 1 / (2 - std::clamp(v.z(), 0.0f, 1.0f)));
+		};
+	size_t i = begin;
+	for ( ; i<end && (i&0x3) != 0 ; i++)
+		one_vertex(i);
+
+	const rows_ps m(matrix);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one  = _mm_set1_ps(1.0f);
+	const __m128 two  = _mm_set1_ps(2.0f);
+	alignas(16) float map[3][4];
+	for ( ; i+4<=end ; i+=4)
+	{
+		__m128 x, y, z;
+		m.transform(_mm_load_ps(&vertices.x[i]), _mm_load_ps(&vertices.y[i]), _mm_load_ps(&vertices.z[i]), x, y, z);
+		z = _mm_div_ps(one, _mm_sub_ps(two, _mm_min_ps(_mm_max_ps(z, zero), one)));
+		_mm_store_ps(map[0], x); _mm_store_ps(map[1], y); _mm_store_ps(map[2], z);
+		for (int k=0 ; k<4 ; k++)
+			out[i+k].v_viewport = vertex_t(map[0][k], map[1][k], map[2][k]);
+	}
+
+	for ( ; i<end ; i++)
+		one_vertex(i);
+}
+
+void vertex_shader_t::light_vertices(const scene_t & scene, transformed_vertex_t * vertices, size_t count, const viewport_t & viewport, bool double_sided)
+{
+	for (size_t i=0 ; i<count ; i++)
+	{
+		transformed_vertex_t & tv = vertices[i];
+		if ( ! tv.yes)
+			continue;
+		tv.light = light_intensity(scene, viewport, tv.v_world, tv.normal_world);
+		tv.light_back = double_sided ? light_intensity(scene, viewport, tv.v_world, - tv.normal_world) : tv.light;
+	}
+}
+
+} // namespace
@@ -1,5 +1,8 @@
 
 #include <memory.h>
+#include <limits>
+#include <numeric>
+#include <cmath>
 #include <swegl/render/viewport.hpp>
 #include <swegl/projection/points.hpp>
 
@@ -11,6 +14,310 @@ namespace swegl
 		, m_zbuffer(std::make_unique<float[]>(w*h))
 	{}
 
+	hierarchical_z_t::hierarchical_z_t(int w, int h)
+		: m_w(w)
+		, m_h(h)
+		, m_blocks_x((w + block_size - 1) / block_size)
+		, m_blocks_y((h + block_size - 1) / block_size)
+		, m_coarse_x((w + coarse_size - 1) / coarse_size)
+		, m_coarse_y((h + coarse_size - 1) / coarse_size)
+		, m_block_max(m_blocks_x * m_blocks_y)
+		, m_block_dirty(m_blocks_x * m_blocks_y)
+		, m_coarse_max(m_coarse_x * m_coarse_y)
+		, m_coarse_dirty(m_coarse_x * m_coarse_y)
+		, m_rejected_triangles(0)
+		, m_rejected_spans(0)
+	{
+		clear();
+	}
+
+	void hierarchical_z_t::clear()
+	{
+		std::fill(m_block_max .begin(), m_block_max .end(), std::numeric_limits<float>::max());
+		std::fill(m_coarse_max.begin(), m_coarse_max.end(), std::numeric_limits<float>::max());
+		std::fill(m_block_dirty .begin(), m_block_dirty .end(), 0);
+		std::fill(m_coarse_dirty.begin(), m_coarse_dirty.end(), 0);
+		m_rejected_triangles = 0;
+		m_rejected_spans = 0;
+	}
+
+	float hierarchical_z_t::refresh_block(int bx, int by, const float * zbuffer)
+	{
+		float & block_max = m_block_max[by * m_blocks_x + bx];
+		unsigned char & dirty = m_block_dirty[by * m_blocks_x + bx];
+		if (dirty)
+		{
+			int x_end = std::min(m_w, (bx+1) * block_size);
+			int y_end = std::min(m_h, (by+1) * block_size);
+			float z_max = 0;
+			for (int y = by * block_size ; y < y_end ; y++)
+				for (int x = bx * block_size ; x < x_end ; x++)
+					z_max = std::max(z_max, zbuffer[y * m_w + x]);
+			block_max = z_max;
+			dirty = 0;
+		}
+		return block_max;
+	}
+
+	bool hierarchical_z_t::hidden(int x_begin, int y_begin, int x_end, int y_end, float z, const float * zbuffer)
+	{
+		for (int cy = y_begin / coarse_size ; cy <= (y_end-1) / coarse_size ; cy++)
+			for (int cx = x_begin / coarse_size ; cx <= (x_end-1) / coarse_size ; cx++)
+			{
+				float & coarse_max = m_coarse_max[cy * m_coarse_x + cx];
+				unsigned char & coarse_dirty = m_coarse_dirty[cy * m_coarse_x + cx];
+				if (z >= coarse_max && ! coarse_dirty)
+					continue;
+
+				// descend into the blocks of this coarse block that are in the area
+				int bx_begin = std::max(x_begin    , cx * coarse_size) / block_size;
+				int bx_end   = std::min(x_end   - 1, (cx+1) * coarse_size - 1) / block_size;
+				int by_begin = std::max(y_begin    , cy * coarse_size) / block_size;
+				int by_end   = std::min(y_end   - 1, (cy+1) * coarse_size - 1) / block_size;
+				for (int by = by_begin ; by <= by_end ; by++)
+					for (int bx = bx_begin ; bx <= bx_end ; bx++)
+						if (z < refresh_block(bx, by, zbuffer))
+							return false;
+
+				// the coarse block can be refreshed too if the area covered it completely
+				if (bx_end - bx_begin + 1 == blocks_per_coarse && by_end - by_begin + 1 == blocks_per_coarse)
+				{
+					coarse_max = *std::max_element(&m_block_max[by_begin * m_blocks_x + bx_begin], &m_block_max[by_begin * m_blocks_x + bx_end + 1]);
+					for (int by = by_begin+1 ; by <= by_end ; by++)
+						coarse_max = std::max(coarse_max, *std::max_element(&m_block_max[by * m_blocks_x + bx_begin], &m_block_max[by * m_blocks_x + bx_end + 1]));
+					coarse_dirty = 0;
+				}
+			}
+		return true;
+	}
+
+	light_clusters_t::light_clusters_t(int w, int h)
+		: m_w(w)
+		, m_h(h)
+		, m_tiles_x((w + tile_size - 1) / tile_size)
+		, m_tiles_y((h + tile_size - 1) / tile_size)
+		, m_clustered(false)
+	{
+		m_slice_z[0] = 0;
+		for (int k=1 ; k<slice_count ; k++)
+			m_slice_z[k] = near_z * std::pow(far_z / near_z, (k-1) / float(slice_count-2));
+		m_slice_z[slice_count] = std::numeric_limits<float>::infinity();
+	}
+
+	void light_clusters_t::build(const point_source_light_streams_t & lights, const camera_t & camera, bool clustered)
+	{
+		m_all_lights = &lights;
+		m_clustered = clustered && lights.count > 0;
+		if ( ! m_clustered)
+			return;
+
+		m_viewmatrix = camera.m_viewmatrix;
+		m_x_scale = camera.m_projectionmatrix[0][0];
+		m_y_scale = camera.m_projectionmatrix[1][1];
+
+		auto slice = [&](float z) { return int(std::upper_bound(m_slice_z + 1, m_slice_z + slice_count, z) - (m_slice_z + 1)); };
+		// camera coordinate of a screen coordinate in [-1,1] at depth z, z may be infinite
+		auto unproject = [](float ndc, float z, float scale) { return ndc == 0 ? 0 : ndc * z / scale; };
+		auto span = [](float a, float b, float c, float d, float & lo, float & hi)
+			{
+				lo = std::min(std::min(a, b), std::min(c, d));
+				hi = std::max(std::max(a, b), std::max(c, d));
+			};
+
+		m_pairs.clear();
+		for (std::uint32_t l=0 ; l<lights.count ; l++)
+		{
+			point_source_light psl{vertex_t(lights.x[l], lights.y[l], lights.z[l]), lights.intensity[l]};
+			vertex_t c = transform(psl.position, m_viewmatrix); // rigid: distances are kept
+			// the margin covers rounding when lights() places points that lie on the border of 2 clusters
+			float r = psl.reach() * 1.001f + 0.001f;
+			if (c.z() + r <= 0)
+				continue; // behind the camera
+
+			int tx_begin = 0, tx_end = m_tiles_x;
+			int ty_begin = 0, ty_end = m_tiles_y;
+			float z_min = c.z() - r, z_max = c.z() + r;
+			if (z_min > 0)
+			{
+				// the sphere's bounding box seen from the camera
+				float x_lo = std::min((c.x()-r) / z_min, (c.x()-r) / z_max) * m_x_scale;
+				float x_hi = std::max((c.x()+r) / z_min, (c.x()+r) / z_max) * m_x_scale;
+				float y_lo = std::min((c.y()-r) / z_min, (c.y()-r) / z_max) * m_y_scale;
+				float y_hi = std::max((c.y()+r) / z_min, (c.y()+r) / z_max) * m_y_scale;
+				float px_lo = (1 + x_lo) * m_w / 2, px_hi = (1 + x_hi) * m_w / 2;
+				float py_lo = (1 - y_hi) * m_h / 2, py_hi = (1 - y_lo) * m_h / 2;
+				if (px_hi < 0 || px_lo >= m_w || py_hi < 0 || py_lo >= m_h)
+					continue; // off screen
+				tx_begin = std::max(0, (int)std::floor(px_lo / tile_size));
+				tx_end   = std::min(m_tiles_x, (int)std::floor(px_hi / tile_size) + 1);
+				ty_begin = std::max(0, (int)std::floor(py_lo / tile_size));
+				ty_end   = std::min(m_tiles_y, (int)std::floor(py_hi / tile_size) + 1);
+			}
+
+			for (int s = slice(std::max(z_min, 0.0f)) ; s <= slice(z_max) ; s++)
+			{
+				float z0 = m_slice_z[s], z1 = m_slice_z[s+1];
+				for (int ty = ty_begin ; ty < ty_end ; ty++)
+				{
+					float ny0 = 1 - 2.0f * std::min(m_h, (ty+1) * tile_size) / m_h;
+					float ny1 = 1 - 2.0f * ty * tile_size / m_h;
+					float y_lo, y_hi;
+					span(unproject(ny0, z0, m_y_scale), unproject(ny0, z1, m_y_scale), unproject(ny1, z0, m_y_scale), unproject(ny1, z1, m_y_scale), y_lo, y_hi);
+					float dy = c.y() < y_lo ? y_lo - c.y() : c.y() > y_hi ? c.y() - y_hi : 0;
+					float dz = c.z() < z0   ? z0   - c.z() : c.z() > z1   ? c.z() - z1   : 0;
+					if (dy*dy + dz*dz > r*r)
+						continue;
+					for (int tx = tx_begin ; tx < tx_end ; tx++)
+					{
+						float nx0 = 2.0f * tx * tile_size / m_w - 1;
+						float nx1 = 2.0f * std::min(m_w, (tx+1) * tile_size) / m_w - 1;
+						float x_lo, x_hi;
+						span(unproject(nx0, z0, m_x_scale), unproject(nx0, z1, m_x_scale), unproject(nx1, z0, m_x_scale), unproject(nx1, z1, m_x_scale), x_lo, x_hi);
+						float dx = c.x() < x_lo ? x_lo - c.x() : c.x() > x_hi ? c.x() - x_hi : 0;
+						if (dx*dx + dy*dy + dz*dz <= r*r)
+							m_pairs.emplace_back((s * m_tiles_y + ty) * m_tiles_x + tx, l);
+					}
+				}
+			}
+		}
+
+		// counting sort by cluster, lights stay in order within a cluster
+		const int cluster_count = slice_count * m_tiles_y * m_tiles_x;
+		m_offsets.assign(cluster_count + 1, 0);
+		for (const auto & [cluster, light] : m_pairs)
+			m_offsets[cluster + 1]++;
+		std::partial_sum(m_offsets.begin(), m_offsets.end(), m_offsets.begin());
+		m_lights.resize(m_pairs.size());
+		std::vector<std::uint32_t> cursor(m_offsets.begin(), m_offsets.end() - 1);
+		for (const auto & [cluster, light] : m_pairs)
+			m_lights[cursor[cluster]++] = light;
+
+		m_streams.clear();
+		m_stream_offsets.resize(cluster_count + 1);
+		for (int cluster=0 ; cluster<cluster_count ; cluster++)
+		{
+			m_stream_offsets[cluster] = m_streams.x.size();
+			for (std::uint32_t k=m_offsets[cluster] ; k<m_offsets[cluster+1] ; k++)
+			{
+				std::uint32_t l = m_lights[k];
+				m_streams.push_back(point_source_light{vertex_t(lights.x[l], lights.y[l], lights.z[l]), lights.intensity[l]});
+			}
+			m_streams.pad();
+		}
+		m_stream_offsets[cluster_count] = m_streams.x.size();
+	}
+
+	void sun_shadows_t::resize(int size, int cascade_count, float distance)
+	{
+		m_size = std::max(0, size);
+		m_distance = distance;
+		m_cascades.clear();
+		if (m_size == 0)
+			return;
+		m_cascades.resize(std::max(1, cascade_count));
+		for (cascade_t & cascade : m_cascades)
+		{
+			cascade.m_map = std::make_unique<viewport_t>(m_size, m_size);
+			cascade.m_zbuffer = cascade.m_map->zbuffer();
+		}
+	}
+
+	void sun_shadows_t::fit(const scene_t & scene, const camera_t & camera)
+	{
+		m_viewmatrix = camera.m_viewmatrix;
+		if (scene.bvh.m_nodes.empty())
+		{
+			// nothing has bounds to cast shadows
+			for (cascade_t & cascade : m_cascades)
+				cascade.m_z_end = 0;
+			return;
+		}
+
+		// the sun's axes, x and y across the maps and z along the sun's direction,
+		// handed like the screen's for the faces turned to the sun to be front faces in the maps
+		const normal_t & sun_z = scene.sun_direction;
+		const normal_t sun_x = cross(std::fabs(sun_z.y()) < 0.99f ? vector_t(0, 1, 0) : vector_t(1, 0, 0), sun_z);
+		const normal_t sun_y = cross(sun_x, sun_z);
+		auto along = [](const vector_t & axis, const vertex_t & v) { return axis.x()*v.x() + axis.y()*v.y() + axis.z()*v.z(); };
+
+		// the depth of the scene's bounding box, a bit wider so that nothing lies exactly at 0 or 1
+		const bvh_t::bvh_node_t & root = scene.bvh.m_nodes[0];
+		float z_min = 0, z_max = 0;
+		for (int k=0 ; k<3 ; k++)
+		{
+			float axis = k == 0 ? sun_z.x() : k == 1 ? sun_z.y() : sun_z.z();
+			float lo = axis * (k == 0 ? root.min.x() : k == 1 ? root.min.y() : root.min.z());
+			float hi = axis * (k == 0 ? root.max.x() : k == 1 ? root.max.y() : root.max.z());
+			z_min += std::min(lo, hi);
+			z_max += std::max(lo, hi);
+		}
+		const float margin = 0.01f * (z_max - z_min) + 0.01f;
+		z_min -= margin;
+		const float z_range = z_max + margin - z_min;
+
+		// slices of the view between the near plane, where the projected z is 0, and m_distance: the usual blend
+		// of a uniform and a logarithmic split
+		const auto & p = camera.m_projectionmatrix;
+		const auto & v = camera.m_viewmatrix;
+		const float z_near = std::max(0.01f, -p[2][3] / p[2][2]);
+		const float z_far  = std::max(z_near * 2, m_distance);
+		const int count = m_cascades.size();
+		auto split = [&](int i)
+			{
+				float t = i / (float)count;
+				return 0.75f * z_near * std::pow(z_far / z_near, t) + 0.25f * (z_near + (z_far - z_near) * t);
+			};
+
+		for (int c=0 ; c<count ; c++)
+		{
+			cascade_t & cascade = m_cascades[c];
+			const float z_begin = split(c);
+			cascade.m_z_end = split(c+1);
+
+			// the sphere around the slice's corners, its radius does not change as the camera turns
+			vertex_t corners[8];
+			vertex_t center(0, 0, 0);
+			for (int k=0 ; k<8 ; k++)
+			{
+				float z = k < 4 ? z_begin : cascade.m_z_end;
+				float x = (k & 1 ? 1 : -1) * (p[2][2]*z + p[2][3]) / p[0][0];
+				float y = (k & 2 ? 1 : -1) * (p[2][2]*z + p[2][3]) / p[1][1];
+				corners[k] = camera.position() + vector_t(x*v[0][0] + y*v[1][0] + z*v[2][0]
+				                                         ,x*v[0][1] + y*v[1][1] + z*v[2][1]
+				                                         ,x*v[0][2] + y*v[1][2] + z*v[2][2]);
+				center = center + (corners[k] - vertex_t(0, 0, 0)) * 0.125f;
+			}
+			float radius = 0;
+			for (const vertex_t & corner : corners)
+				radius = std::max(radius, (corner - center).len());
+
+			// the center moves by whole texels, for the shadows not to shimmer as the camera moves: a texel of margin
+			radius *= m_size / (m_size - 2.0f);
+			const float texel = 2 * radius / m_size;
+			const float x = std::floor(along(sun_x, center) / texel) * texel;
+			const float y = std::floor(along(sun_y, center) / texel) * texel;
+			const float z = along(sun_z, center);
+
+			matrix44_t & m = cascade.m_matrix;
+			m = matrix44_t::Identity;
+			m[0][0] =  sun_x.x() / texel; m[0][1] =  sun_x.y() / texel; m[0][2] =  sun_x.z() / texel; m[0][3] = (radius - x) / texel;
+			m[1][0] = -sun_y.x() / texel; m[1][1] = -sun_y.y() / texel; m[1][2] = -sun_y.z() / texel; m[1][3] = (radius + y) / texel;
+			m[2][0] = sun_z.x() / z_range; m[2][1] = sun_z.y() / z_range; m[2][2] = sun_z.z() / z_range; m[2][3] = -z_min / z_range;
+
+			// casters on the sun's side of the cascade can shade it too, those beyond cannot
+			auto plane = [](const vector_t & n, float d) { return plane_t{n.x(), n.y(), n.z(), d}; };
+			cascade.m_frustum.planes[0] = plane(  sun_x , radius - x);
+			cascade.m_frustum.planes[1] = plane(- sun_x , radius + x);
+			cascade.m_frustum.planes[2] = plane(  sun_y , radius - y);
+			cascade.m_frustum.planes[3] = plane(- sun_y , radius + y);
+			cascade.m_frustum.planes[4] = plane(- sun_z , radius + z);
+
+			cascade.m_texel = texel;
+			cascade.m_normal_offset = 1.5f * texel;
+			cascade.m_depth_bias = texel / z_range;
+		}
+	}
+
 	viewport_t::viewport_t(int x, int y, int w, int h
 	                      ,SDL_Surface *screen
 	                      ,std::shared_ptr<swegl:: pixel_shader_t> & pixel_shader
@@ -26,6 +333,20 @@ namespace swegl
 		, m_camera(1.0*w/h)
 		, m_pixel_shader(pixel_shader)
 		, m_got_transparency(transparency_layer_count > 0)
+		, m_tile_size(0)
+		, m_thread_count(std::max(1u, std::thread::hardware_concurrency()))
+		, m_rasterizer(SCANLINE)
+		, m_hierarchical_z(w, h)
+		, m_use_hierarchical_z(false)
+		, m_light_clusters(w, h)
+		, m_use_light_clusters(true)
+		, m_cache_face_lights(true)
+		, m_camera_version(0)
+		, m_camera_version_position(0, 0, 0)
+		, m_deferred_shading(false)
+		, m_z_prepass(false)
+		, m_lod_pixel_error(1.0f)
+		, m_lod_hysteresis(0.25f)
 	{
 		this->m_viewportmatrix[0][3] = x+w/2.0f;
 		this->m_viewportmatrix[1][3] = y+h/2.0f;
@@ -39,6 +360,35 @@ namespace swegl
 			m_transparency_layers.emplace_back(w, h);
 	}
 
+	viewport_t::viewport_t(int w, int h)
+		: m_x(0)
+		, m_y(0)
+		, m_w(w)
+		, m_h(h)
+		, m_screen(nullptr)
+		, m_zbuffer(new float[w * h])
+		, m_viewportmatrix(matrix44_t::Identity)
+		, m_camera(1.0*w/h)
+		, m_post_shader(nullptr)
+		, m_got_transparency(false)
+		, m_tile_size(0)
+		, m_thread_count(1)
+		, m_rasterizer(HALFSPACE)
+		, m_hierarchical_z(w, h)
+		, m_use_hierarchical_z(false)
+		, m_light_clusters(w, h)
+		, m_use_light_clusters(false)
+		, m_cache_face_lights(false)
+		, m_camera_version(0)
+		, m_camera_version_position(0, 0, 0)
+		, m_deferred_shading(false)
+		, m_z_prepass(false)
+		, m_lod_pixel_error(0.0f)
+		, m_lod_hysteresis(0.25f)
+	{
+		clear_depth();
+	}
+
 	// merge 2 transparency layers
 	void viewport_t::flatten(transparency_layer_t & front, transparency_layer_t & back)
 	{
@@ -58,7 +408,7 @@ namespace swegl
 			// flatten from screen to 1st transparency layer
 			for (int j=0 ; j<m_h ; j++)
 			{
-				pixel_colors * pixel_back = &((pixel_colors*)m_screen->pixels)[(int)(j*m_screen->pitch/m_screen->format->BytesPerPixel)];
+				pixel_colors * pixel_back = &((pixel_colors*)m_screen->pixels)[(int)((j+m_y)*m_screen->pitch/m_screen->format->BytesPerPixel) + m_x];
 				for (int i=0 ; i<m_w ; i++, pixel_front++, pixel_back++)
 					if (pixel_front->o.a != 0)
 						*pixel_front = blend(*pixel_back, *pixel_front);
@@ -71,7 +421,7 @@ namespace swegl
 			// just copy from screen to 1st transparency layer
 			for (int j=0 ; j<m_h ; j++)
 			{
-				pixel_colors * pixel_back = &((pixel_colors*)m_screen->pixels)[(int)(j*m_screen->pitch/m_screen->format->BytesPerPixel)];
+				pixel_colors * pixel_back = &((pixel_colors*)m_screen->pixels)[(int)((j+m_y)*m_screen->pitch/m_screen->format->BytesPerPixel) + m_x];
 				for (int i=0 ; i<m_w ; i++, pixel_front++, pixel_back++)
 						*pixel_front = *pixel_back;
 			}
@@ -103,8 +453,7 @@ namespace swegl
 				memset(line_ptr, 0, clear_width);
 		}
 
-		//std::fill(m_zbuffer.get(), &m_zbuffer[m_w*m_h], std::numeric_limits<std::remove_pointer<typename decltype(m_zbuffer)::pointer>::type>::max());
-		memset(m_zbuffer.get(), 0x7F, 4 * m_w * m_h);
+		clear_depth();
 		for (auto & transparency_layer : m_transparency_layers)
 		{
 			memset(transparency_layer.m_zbuffer.get(), 0x7F, 4 * m_w * m_h);
@@ -112,6 +461,13 @@ namespace swegl
 		}
 	}
 
+	void viewport_t::clear_depth()
+	{
+		//std::fill(m_zbuffer.get(), &m_zbuffer[m_w*m_h], std::numeric_limits<std::remove_pointer<typename decltype(m_zbuffer)::pointer>::type>::max());
+		memset(m_zbuffer.get(), 0x7F, 4 * m_w * m_h);
+		m_hierarchical_z.clear();
+	}
+
 	vertex_t viewport_t::transform(const vertex_t & v) const
 	{
 		const auto & m = m_viewportmatrix;
@@ -120,7 +476,7 @@ namespace swegl
 		                        v.z()          );
 	}
 
-	void viewport_t::transform(mesh_vertex_t & mv) const
+	void viewport_t::transform(transformed_vertex_t & mv) const
 	{
 		const auto & m = m_viewportmatrix;
 		mv.v_viewport.x() = m[0][0]*mv.v_viewport.x() + m[0][3];
@@ -38,10 +38,6 @@ swegl::scene_t build_scene_2()
 	s.nodes.emplace_back(std::move(tri2));
 	//*/
 
-	for (auto & node : s.nodes)
-		for (auto & primitive : node.primitives)
-			primitive.vertices.reserve(primitive.vertices.size()+2);
-
 	for (int i=0 ; i<(int)s.nodes.size() ; i++)
 		s.root_nodes.push_back(i);
 	
@@ -138,18 +134,15 @@ swegl::scene_t build_scene()
 	s.nodes.emplace_back(std::move(tri3));
 	//*/
 
-	for (auto & node : s.nodes)
-		for (auto & primitive : node.primitives)
-			primitive.vertices.reserve(primitive.vertices.size()+2);
-
 	for (int i=0 ; i<(int)s.nodes.size() ; i++)
 		s.root_nodes.push_back(i);
 
 	return s;
 }
 
-int handle_keyboard_events(swegl::sdl_t & sdl, swegl::camera_t & camera, swegl::scene_t & scene)
+int handle_keyboard_events(swegl::sdl_t & sdl, swegl::viewport_t & viewport, swegl::scene_t & scene)
 {
+	swegl::camera_t & camera = viewport.camera();
 	static int keystick = SDL_GetTicks();
 	static float cameraxrotation;
 	SDL_Event event;
@@ -169,6 +162,9 @@ int handle_keyboard_events(swegl::sdl_t & sdl, swegl::camera_t & camera, swegl::
 			case SDL_KEYDOWN:
 				if (event.key.keysym.sym == SDLK_ESCAPE)
 					return -10;
+				else if (event.key.keysym.sym == SDLK_p)
+					// tiles drawn by all the cores, or the whole viewport by this thread
+					viewport.set_tiled_rendering(viewport.m_tile_size > 0 ? 0 : 64, std::thread::hardware_concurrency());
 				else if (event.key.keysym.sym == SDLK_d)
 					sdl.keys['d'] = 1;
 				else if (event.key.keysym.sym == SDLK_a)
@@ -334,9 +330,6 @@ int main(int argc, char ** argv)
 				scene.ambient_light_intensity = 0.3f;
 				scene.sun_direction = swegl::normal_t(1.0, -2.0, -1.0);
 				scene.sun_intensity = 0.7;
-				for (auto & node : scene.nodes)
-					for (auto & primitive : node.primitives)
-						primitive.vertices.reserve(primitive.vertices.size()+2);
 				return scene;
 			}
 		}();
@@ -373,10 +366,10 @@ int main(int argc, char ** argv)
 			//swegl::render(scene, viewport1, viewport2);
 			swegl::render(scene, viewport);
 
-			font.Print(std::to_string(mp.status()/1000000).c_str(), 10, 10, sdl.surface);
+			font.Print((std::to_string(mp.status()/1000000) + (viewport.m_tile_size > 0 ? " tiled" : "")).c_str(), 10, 10, sdl.surface);
 
 			scene.animate(clock.elapsed_seconds());
-			if (handle_keyboard_events(sdl, viewport.camera(), scene) < 0)
+			if (handle_keyboard_events(sdl, viewport, scene) < 0)
 				break;
 
 			sdl.update_frame();
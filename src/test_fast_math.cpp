@@ -0,0 +1,124 @@
+
+#include "headers.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <swegl/misc/fast_math.hpp>
+
+// fast_math.hpp at its 3 accuracies: the largest relative errors over inputs spread across the floats, against
+// math_error_bounds(), and millions of results per second.
+// rsqrt and rcp for x from 1e-37 to 1e36, pow for x in ]0,1] and exponents from 0.5 to 128 like specular powers,
+// with the error closest to its bound, to_u8 for channels from -10 to 265 in 1/64th steps: off by at most 1/2.
+// A test: returns 1 if an error is out of bounds.
+// usage: test_fast_math [repeat]
+
+float from_bits(std::uint32_t bits)
+{
+	float f;
+	std::memcpy(&f, &bits, 4);
+	return f;
+}
+
+template<swegl::math_accuracy_t A>
+bool check(const char * name, int repeat)
+{
+	constexpr swegl::math_error_bounds_t bounds = swegl::math_error_bounds(A);
+	bool ok = true;
+	auto report = [&](const char * function, double error, double bound, double mops)
+		{
+			printf("%-7s %-6s error %.2e  bound %.2e  %8.1f Mresults/s%s\n", name, function, error, bound, mops, error <= bound ? "" : "  FAILED");
+			ok = ok && error <= bound;
+		};
+
+	std::vector<float> xs;
+	for (std::uint32_t bits=0x02000000 ; bits<0x7C000000 ; bits+=997)
+		xs.push_back(from_bits(bits));
+	std::vector<float> results(xs.size());
+	auto mops = [&](auto f)
+		{
+			auto begin = std::chrono::steady_clock::now();
+			for (int r=0 ; r<repeat ; r++)
+				for (size_t i=0 ; i<xs.size() ; i+=4)
+					_mm_storeu_ps(&results[i], f(_mm_loadu_ps(&xs[i])));
+			return (double)xs.size() * repeat / std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() / 1e6;
+		};
+	xs.resize(xs.size() / 4 * 4);
+
+	double speed = mops([](__m128 x) { return swegl::fast_rsqrt<A>(x); });
+	double error = 0;
+	for (size_t i=0 ; i<xs.size() ; i++)
+		error = std::max(error, std::abs(results[i] * std::sqrt((double)xs[i]) - 1));
+	report("rsqrt", error, bounds.rsqrt, speed);
+
+	speed = mops([](__m128 x) { return swegl::fast_rcp<A>(x); });
+	error = 0;
+	for (size_t i=0 ; i<xs.size() ; i++)
+		error = std::max(error, std::abs(results[i] * (double)xs[i] - 1));
+	report("rcp", error, bounds.rcp, speed);
+
+	for (float y : {0.5f, 2.0f, 5.0f, 32.0f, 128.0f})
+	{
+		xs.clear();
+		for (std::uint32_t bits=0x00800000 ; bits<=0x3F800000 ; bits+=251)
+			xs.push_back(from_bits(bits));
+		xs.resize(xs.size() / 4 * 4);
+		results.resize(xs.size());
+		__m128 ys = _mm_set1_ps(y);
+		speed = mops([ys](__m128 x) { return swegl::fast_pow<A>(x, ys); });
+		// the error relative to the bound, to report the worst one
+		double worst = 0, worst_error = 0, worst_bound = 0;
+		for (size_t i=0 ; i<xs.size() ; i++)
+		{
+			double expected = std::pow((double)xs[i], (double)y);
+			if (expected <= 1e-30)
+				continue;
+			double e = std::abs(results[i] / expected - 1);
+			double bound = bounds.pow + y * bounds.pow_per_exponent - std::log2(expected) * bounds.pow_per_log2;
+			if (e / bound >= worst)
+			{
+				worst = e / bound;
+				worst_error = e;
+				worst_bound = bound;
+			}
+		}
+		std::string function = y < 1 ? "pow .5" : "pow " + std::to_string((int)y);
+		report(function.c_str(), worst_error, worst_bound, speed);
+	}
+	if (swegl::fast_pow<A>(0.0f, 2.0f) != 0.0f)
+		report("pow 0", 1, 0, 0);
+
+	xs.clear();
+	for (int i=-10*64 ; i<265*64 ; i++)
+		xs.push_back(i / 64.0f);
+	xs.resize(xs.size() / 4 * 4);
+	std::vector<int> packed(xs.size() / 4);
+	auto begin = std::chrono::steady_clock::now();
+	for (int r=0 ; r<repeat ; r++)
+		for (size_t i=0 ; i<xs.size() ; i+=4)
+			packed[i/4] = swegl::fast_to_u8<A>(_mm_loadu_ps(&xs[i]));
+	speed = (double)packed.size() * repeat / std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() / 1e6;
+	error = 0;
+	for (size_t i=0 ; i<xs.size() ; i++)
+	{
+		int channel = (packed[i/4] >> (8 * (i%4))) & 0xFF;
+		error = std::max(error, std::abs(channel - (double)std::clamp(xs[i], 0.0f, 255.0f)));
+	}
+	report("to_u8", error, 0.5, speed);
+
+	return ok;
+}
+
+int main(int argc, char ** argv)
+{
+	int repeat = argc > 1 ? std::stoi(argv[1]) : 10;
+
+	bool ok = check<swegl::math_accuracy_t::EXACT  >("exact"  , repeat);
+	ok = check<swegl::math_accuracy_t::REFINED>("refined", repeat) && ok;
+	ok = check<swegl::math_accuracy_t::FAST   >("fast"   , repeat) && ok;
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,22 @@
+
+#pragma once
+
+#include <cstdint>
+
+namespace swegl
+{
+
+// BC1 and BC3 (DXT1 and DXT5) blocks of 4x4 texels, texels in the order of the texture's rows.
+// Texels are BGRA like pixel_colors.
+// BC1: 8 bytes, 2 RGB565 colors and 2 bits per texel to pick one of 4 colors on the line between them, opaque.
+// BC3: 16 bytes, the same alpha coded the same way with 2 alphas and 3 bits per texel, then a BC1 color block.
+static const int bc1_block_bytes = 8;
+static const int bc3_block_bytes = 16;
+
+void encode_bc1_block(const unsigned int texels[16], std::uint8_t block[bc1_block_bytes]);
+void encode_bc3_block(const unsigned int texels[16], std::uint8_t block[bc3_block_bytes]);
+
+void decode_bc1_block(const std::uint8_t block[bc1_block_bytes], unsigned int texels[16]);
+void decode_bc3_block(const std::uint8_t block[bc3_block_bytes], unsigned int texels[16]);
+
+} // namespace
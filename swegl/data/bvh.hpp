@@ -0,0 +1,51 @@
+
+#pragma once
+
+#include <vector>
+
+#include <swegl/projection/points.hpp>
+#include <swegl/projection/camera.hpp>
+
+namespace swegl
+{
+
+struct scene_t;
+
+// Bounding volume hierarchy over the primitives of a scene, on their world bounding spheres.
+// Built once, then refit every frame: moving nodes loosen the tree but never invalidate it.
+// It is rebuilt when primitives are added or removed.
+struct bvh_t
+{
+	struct item_t
+	{
+		int node_idx;
+		int primitive_idx;
+	};
+
+	struct bvh_node_t
+	{
+		vertex_t min, max;
+		int first; // leaf: first item, inner: 2nd child, the 1st child is the next node
+		int count; // leaf: number of items, inner: 0
+	};
+
+	static const int max_leaf_size = 4;
+
+	std::vector<bvh_node_t> m_nodes;
+	std::vector<item_t> m_items;
+	std::vector<item_t> m_unbounded; // primitives without bounds, always visible
+	std::vector<unsigned char> m_changed; // refit scratch
+	size_t m_primitive_count = 0;
+
+	void build(const scene_t & scene);
+	// updates the boxes of the leaves whose primitives moved, and their ancestors
+	void refit(const scene_t & scene);
+	// appends the primitives whose bounds may be seen, in scene order
+	void query(const frustum_t & frustum, const scene_t & scene, std::vector<item_t> & result) const;
+
+private:
+	int build(const scene_t & scene, int first, int count);
+	void fit_leaf(const scene_t & scene, bvh_node_t & node) const;
+};
+
+} // namespace
@@ -94,6 +94,16 @@ struct glb_chunk
 	char * data;
 };
 
-swegl::scene_t load_scene(std::string filename);
+struct load_options_t
+{
+	// reorders triangles and vertices for the renderer, see mesh_optimizer.hpp, and builds levels of detail, see lod.hpp
+	bool optimize_meshes = true;
+	// resamples the images whose sides are not powers of two, see texture_t::resample_to_power_of_two()
+	bool power_of_two_textures = false;
+	// keeps the images compressed in memory: BC1 for the opaque ones, BC3 for the others, see texture_t::set_layout()
+	bool compressed_textures = false;
+};
+
+swegl::scene_t load_scene(std::string filename, const load_options_t & options = {});
 
 } // mamespace
@@ -0,0 +1,26 @@
+
+#pragma once
+
+#include <swegl/data/model.hpp>
+#include <swegl/data/mesh_optimizer.hpp>
+
+namespace swegl
+{
+
+// Levels of detail of a primitive, built at load time by quadric error edge collapses (Garland & Heckbert).
+// Collapses move a vertex onto one of its neighbours, so all levels share the primitive's vertices:
+// they are renumbered so that each level only uses the first primitive_lod_t::vertex_count of them.
+// Vertices on open borders, texture seams included, never move: levels don't crack.
+struct lod_options_t
+{
+	int   max_levels    = 4;
+	float ratio         = 0.5f; // triangles kept from one level to the next
+	int   min_triangles = 64;   // no level is made of a primitive with fewer triangles
+	mesh_optimization_t optimization = {}; // how the triangles of each level are reordered, see optimize_triangles()
+};
+
+void build_lods(primitive_t & primitive, const lod_options_t & options = {});
+void build_lods(node_t & node, const lod_options_t & options = {});
+void build_lods(scene_t & scene, const lod_options_t & options = {});
+
+} // namespace
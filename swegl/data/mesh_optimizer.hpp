@@ -0,0 +1,35 @@
+
+#pragma once
+
+#include <swegl/data/model.hpp>
+
+namespace swegl
+{
+
+// Load-time reordering of the triangles and vertices of indexed primitives.
+// Only the drawing order changes: the image is the same, except where triangles overlap at exactly the same depth.
+struct mesh_optimization_t
+{
+	bool strips_to_lists   = true; // strips and fans can't be reordered, they become lists of triangles
+	bool reorder_triangles = true; // triangles sharing vertices drawn close together (Forsyth's vertex cache optimization)
+	bool reduce_overdraw   = true; // then clusters of triangles facing outwards drawn first (Sander, Nehab & Barczak)
+	bool reorder_vertices  = true; // vertices renumbered in order of first use, unused ones dropped
+	int  cache_size        = 32;   // transformed vertices expected to stay in cache
+	int  cluster_size      = 64;   // triangles per overdraw cluster
+};
+
+// the triangles the renderer draws, with the same winding, degenerate ones dropped
+std::vector<vertex_idx> triangle_list(const primitive_t & primitive);
+
+void optimize_primitive(primitive_t & primitive, const mesh_optimization_t & options = {});
+// a list of triangles reordered as options tell, their vertices left as they are: for levels of detail, see build_lods()
+std::vector<vertex_idx> optimize_triangles(std::vector<vertex_idx> triangles, const vertex_streams_t & vertices, const mesh_optimization_t & options = {});
+void optimize_node(node_t & node, const mesh_optimization_t & options = {});
+void optimize_scene(scene_t & scene, const mesh_optimization_t & options = {});
+
+// average number of vertices per triangle missing from a FIFO cache of cache_size vertices:
+// 3 at worst, about 0.5 for a well ordered regular mesh
+float average_cache_miss_ratio(const primitive_t & primitive, int cache_size = 32);
+float average_cache_miss_ratio(const std::vector<vertex_idx> & triangles, int cache_size = 32);
+
+} // namespace
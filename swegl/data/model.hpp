@@ -1,12 +1,18 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstring>
+#include <memory>
+
 #include <swegl/projection/camera.hpp>
 #include <swegl/projection/vec2f.hpp>
 #include <swegl/projection/points.hpp>
 #include <swegl/projection/matrix44.hpp>
 #include <swegl/data/texture.hpp>
 #include <swegl/render/colors.hpp>
+#include <swegl/data/bvh.hpp>
+#include <swegl/misc/aligned_allocator.hpp>
 
 
 namespace swegl
@@ -17,17 +23,159 @@ class pixel_shader_t;
 
 using vertex_idx = std::uint32_t;
 
+// one vertex of a primitive, to build or read vertex_streams_t a whole vertex at a time
 struct mesh_vertex_t
 {
 	vertex_t v;
+	vec2f_t tex_coords;
+	normal_t normal;
+};
+
+// Vertices of a primitive, one array per component, so that each pass only streams the components it reads
+// and the vertex transform can load 4 or 8 consecutive vertices at once. Arrays are 32-byte aligned.
+struct vertex_streams_t
+{
+	template<typename T>
+	using stream_t = std::vector<T, aligned_allocator<T, 32>>;
+
+	stream_t<float> x, y, z;
+	stream_t<float> nx, ny, nz;
+	stream_t<float> u, v;
+
+	vertex_streams_t() = default;
+	// AoS adapter
+	vertex_streams_t(const std::vector<mesh_vertex_t> & vertices)
+	{
+		reserve(vertices.size());
+		for (const auto & mv : vertices)
+			push_back(mv);
+	}
+
+	inline size_t size() const { return x.size(); }
+	inline bool  empty() const { return x.empty(); }
+
+	template<typename F>
+	inline void for_each_stream(F && f)
+	{
+		f(x); f(y); f(z);
+		f(nx); f(ny); f(nz);
+		f(u); f(v);
+	}
+	inline void resize (size_t n) { for_each_stream([n](auto & s) { s.resize (n); }); }
+	inline void reserve(size_t n) { for_each_stream([n](auto & s) { s.reserve(n); }); }
+
+	inline vertex_t position  (size_t i) const { return vertex_t(x[i], y[i], z[i]); }
+	inline vec2f_t  tex_coords(size_t i) const { return vec2f_t(u[i], v[i]); }
+	inline vector_t normal    (size_t i) const { return vector_t(nx[i], ny[i], nz[i]); } // as stored, not renormalized
+
+	inline void set_normal(size_t i, const vector_t & n)
+	{
+		nx[i] = n.x();
+		ny[i] = n.y();
+		nz[i] = n.z();
+	}
+
+	// AoS adapter
+	inline void push_back(const mesh_vertex_t & mv)
+	{
+		x .push_back(mv.v.x());
+		y .push_back(mv.v.y());
+		z .push_back(mv.v.z());
+		nx.push_back(mv.normal.x());
+		ny.push_back(mv.normal.y());
+		nz.push_back(mv.normal.z());
+		u .push_back(mv.tex_coords.x());
+		v .push_back(mv.tex_coords.y());
+	}
+	// AoS adapter, a copy: write through set_normal() or the streams
+	inline mesh_vertex_t operator[](size_t i) const
+	{
+		mesh_vertex_t mv{position(i), tex_coords(i), {}};
+		mv.normal.x() = nx[i];
+		mv.normal.y() = ny[i];
+		mv.normal.z() = nz[i];
+		return mv;
+	}
+};
+
+// a mesh_vertex_t as seen from a viewport, see transformed_scene_t
+struct transformed_vertex_t
+{
 	vertex_t v_world;    // after transformations into world coordinates
 	vertex_t v_viewport; // after transformations into viewport coordinates (pixel x,y + z depth
 	vec2f_t tex_coords;
-	normal_t normal;
 	normal_t normal_world;
+	float light = 0;      // ambient, sun and point source lights, for pixel shaders lit_per_vertex()
+	float light_back = 0; // the same on the back face of double-sided materials
 	bool yes = false;
 };
 
+// radius < 0: unknown, never culled
+struct bounding_sphere_t
+{
+	vertex_t center = vertex_t(0,0,0);
+	float radius = -1;
+};
+
+// a simplified version of a primitive, using the primitive's vertices
+struct primitive_lod_t
+{
+	std::vector<vertex_idx> indices; // triangles
+	size_t vertex_count;             // vertices [0,vertex_count[ are enough to draw it
+	float error;                     // how far it may be from the full resolution surface, in original coordinates
+};
+
+// Light of a triangle by the flat shader, kept from frame to frame, see pixel_shader_lights_flat.
+// The key and the light are read and written at once: threads may draw the same triangle, or its 2 faces.
+struct face_light_t
+{
+	std::atomic<std::uint64_t> value{~0ull}; // key << 32 | the bits of the light, no key is ~0
+
+	// key: version << 1 | back face, see scene_t::last_version
+	inline bool get(std::uint32_t key, float & light) const
+	{
+		std::uint64_t v = value.load(std::memory_order_relaxed);
+		if ((std::uint32_t)(v >> 32) != key)
+			return false;
+		std::uint32_t bits = (std::uint32_t)v;
+		std::memcpy(&light, &bits, 4);
+		return true;
+	}
+	inline void set(std::uint32_t key, float light)
+	{
+		std::uint32_t bits;
+		std::memcpy(&bits, &light, 4);
+		value.store((std::uint64_t)key << 32 | bits, std::memory_order_relaxed);
+	}
+};
+struct primitive_t;
+// a face_light_t for each triangle of each level of detail of a primitive, see resize()
+struct face_light_cache_t
+{
+	std::vector<std::unique_ptr<face_light_t[]>> levels; // [lod+1], triangles in for_each_triangle() order
+	std::vector<size_t> sizes;                           // [lod+1], triangles of each level
+	std::uint32_t geometry_version = 0;                  // the primitive's the lights were kept for
+
+	face_light_cache_t() = default;
+	// copies start empty
+	face_light_cache_t(const face_light_cache_t &) {}
+	face_light_cache_t & operator=(const face_light_cache_t &) { levels.clear(); sizes.clear(); return *this; }
+	face_light_cache_t(face_light_cache_t &&) = default;
+	face_light_cache_t & operator=(face_light_cache_t &&) = default;
+
+	inline void resize(const primitive_t & primitive);
+	inline face_light_t * face(int lod, size_t face_idx) const { return &levels[lod+1][face_idx]; }
+};
+// Where the renderer lets shaders keep the light of the triangle about to be prepared, see pixel_shader_t::cached_face.
+// None for triangles cut by clipping, or when the viewport doesn't cache.
+struct cached_face_t
+{
+	face_light_t * diffuse  = nullptr; // valid for diffuse_version: the node's matrix and the lights
+	face_light_t * specular = nullptr; // valid for specular_version: the same and the camera
+	std::uint32_t diffuse_version  = 0;
+	std::uint32_t specular_version = 0;
+};
+
 struct primitive_t
 {
 	enum index_mode_t
@@ -41,12 +189,53 @@ struct primitive_t
 		TRIANGLE_FAN   = 6,
 	};
 
-	std::vector<mesh_vertex_t> vertices;
+	vertex_streams_t vertices;
 	std::vector<vertex_idx> indices;
 	index_mode_t mode;
 	int material_id;
+	std::vector<primitive_lod_t> lods = {}; // coarser and coarser, see build_lods()
+
+	bounding_sphere_t bounds       = {}; // original coordinates, see calculate_bounds()
+	bounding_sphere_t bounds_world = {}; // updated every frame from the node's matrix
+
+	face_light_cache_t diffuse_lights = {}; // shared by the viewports, written while rendering, sized by original_to_world()
+	// bumped whenever indices, mode or lods change once the primitive has been drawn: by optimize_primitive(), build_lods(),
+	// and by hand after editing them. What is kept for each triangle, like the lights of face_light_cache_t, starts over
+	std::uint32_t geometry_version = 0;
 };
 
+inline size_t triangle_count(const std::vector<vertex_idx> & indices, primitive_t::index_mode_t mode)
+{
+	if (mode == primitive_t::index_mode_t::TRIANGLES)
+		return indices.size() / 3;
+	if (mode == primitive_t::index_mode_t::TRIANGLE_STRIP || mode == primitive_t::index_mode_t::TRIANGLE_FAN)
+		return indices.size() < 2 ? 0 : indices.size() - 2;
+	return 0;
+}
+
+inline void face_light_cache_t::resize(const primitive_t & primitive)
+{
+	auto level_size = [&](size_t level)
+		{
+			return level == 0 ? triangle_count(primitive.indices, primitive.mode)
+			                  : triangle_count(primitive.lods[level-1].indices, primitive_t::index_mode_t::TRIANGLES);
+		};
+	// the triangles in each slot are still the same
+	bool same = geometry_version == primitive.geometry_version && sizes.size() == primitive.lods.size() + 1;
+	for (size_t level=0 ; same && level<sizes.size() ; level++)
+		same = sizes[level] == level_size(level);
+	if (same)
+		return;
+	levels.clear();
+	sizes.clear();
+	for (size_t level=0 ; level<=primitive.lods.size() ; level++)
+	{
+		sizes.push_back(level_size(level));
+		levels.emplace_back(new face_light_t[sizes.back()]);
+	}
+	geometry_version = primitive.geometry_version;
+}
+
 struct node_t
 {
 	vertex_t scale = vertex_t(1,1,1);
@@ -62,6 +251,7 @@ struct node_t
 
 	// final transformation matrix, including parents
 	matrix44_t original_to_world_matrix = matrix44_t::Identity;
+	std::uint32_t version = 0; // of original_to_world_matrix, see scene_t::last_version
 
 	std::vector<primitive_t> primitives;
 
@@ -73,8 +263,67 @@ struct node_t
 
 struct point_source_light
 {
+	// the diffuse intensity under which a light is ignored, reached at reach() from the light
+	static constexpr float cutoff = 0.05f;
+
 	vertex_t position;
 	float intensity;
+
+	inline float reach() const { return std::sqrt(intensity / cutoff); }
+};
+
+// A run of point_source_light_streams_t: a multiple of width lights, the first one aligned
+struct point_source_light_range_t
+{
+	const float * x, * y, * z, * intensity;
+	size_t count;
+};
+
+// Point source lights as streams of coordinates, for SIMD loops going through width lights at a time.
+// The streams are padded to a multiple of width with lights of intensity 0, that light nothing.
+struct point_source_light_streams_t
+{
+	template<typename T>
+	using stream_t = std::vector<T, aligned_allocator<T, 32>>;
+	static const int width = 4;
+
+	stream_t<float> x, y, z, intensity;
+	size_t count = 0; // lights before padding
+
+	inline void clear()
+	{
+		x.clear(); y.clear(); z.clear(); intensity.clear();
+		count = 0;
+	}
+	// AoS adapter
+	inline void push_back(const point_source_light & psl)
+	{
+		x.push_back(psl.position.x());
+		y.push_back(psl.position.y());
+		z.push_back(psl.position.z());
+		intensity.push_back(psl.intensity);
+		count++;
+	}
+	// ends the run of lights pushed since the last pad(), keeps count as the number of real lights
+	inline void pad()
+	{
+		size_t real = count;
+		while (x.size() % width)
+			push_back(point_source_light{vertex_t(0, 0, 0), 0});
+		count = real;
+	}
+	inline void assign(const std::vector<point_source_light> & lights)
+	{
+		clear();
+		for (const auto & psl : lights)
+			push_back(psl);
+		pad();
+	}
+	inline point_source_light_range_t range(size_t begin, size_t end) const
+	{
+		return {x.data() + begin, y.data() + begin, z.data() + begin, intensity.data() + begin, end - begin};
+	}
+	inline point_source_light_range_t all() const { return range(0, x.size()); }
 };
 
 struct material_t
@@ -138,11 +387,46 @@ struct scene_t
 	material_t default_material;
 
 	std::vector<point_source_light> point_source_lights;
+	point_source_light_streams_t point_source_light_streams; // the same, copied by render() when they change, see update_lights()
+
+	// Versions of what results kept from frame to frame depend on: the nodes' matrices (node_t::version), the lights
+	// (lights_version) and the viewports' cameras (viewport_t::m_camera_version) each get a new last_version when they
+	// change, so that the largest of those a result depends on changes whenever one of them does.
+	std::uint32_t last_version = 0;
+	std::uint32_t lights_version = 0;
+	float lights_version_ambient = 0, lights_version_sun_intensity = 0;
+	normal_t lights_version_sun_direction = normal_t(0, 0, 0);
 
 	std::vector<material_t> materials;
 	std::vector<texture_t> images;
 	std::vector<animation_t> animations;
 
+	bvh_t bvh;
+
+	// copies point_source_lights into point_source_light_streams, with a new lights_version if any light changed
+	inline void update_lights()
+	{
+		bool changed = ambient_light_intensity != lights_version_ambient
+		            || sun_intensity != lights_version_sun_intensity
+		            || ! (sun_direction == lights_version_sun_direction)
+		            || point_source_lights.size() != point_source_light_streams.count;
+		for (size_t i=0 ; i<point_source_lights.size() && ! changed ; i++)
+		{
+			const point_source_light & psl = point_source_lights[i];
+			changed = psl.position.x() != point_source_light_streams.x[i]
+			       || psl.position.y() != point_source_light_streams.y[i]
+			       || psl.position.z() != point_source_light_streams.z[i]
+			       || psl.intensity    != point_source_light_streams.intensity[i];
+		}
+		if ( ! changed)
+			return;
+		point_source_light_streams.assign(point_source_lights);
+		lights_version_ambient       = ambient_light_intensity;
+		lights_version_sun_intensity = sun_intensity;
+		lights_version_sun_direction = sun_direction;
+		lights_version = ++last_version;
+	}
+
 	inline void animate(const float elapsed_seconds)
 	{
 		for (auto & animation : animations)
@@ -177,6 +461,77 @@ struct scene_t
 	}
 };
 
+// What the vertex shader computes for one viewport, mirroring the scene's nodes and primitives.
+// Kept by the viewport, out of the scene, so that the scene is only read while viewports are rendered.
+struct transformed_primitive_t
+{
+	bool visible = false; // bounds intersect the viewport's frustum
+	int lod = -1;         // index into the primitive's lods, -1 for full resolution. Kept between frames, see select_lod()
+	std::vector<transformed_vertex_t> vertices; // same indices as the primitive's, only filled when visible and used by the lod
+	face_light_cache_t specular_lights = {}; // depends on the camera, sized by world_to_viewport()
+};
+
+// what the viewport draws of the primitive
+inline const std::vector<vertex_idx> & drawn_indices(const primitive_t & primitive, const transformed_primitive_t & transformed)
+{
+	return transformed.lod < 0 ? primitive.indices : primitive.lods[transformed.lod].indices;
+}
+inline primitive_t::index_mode_t drawn_mode(const primitive_t & primitive, const transformed_primitive_t & transformed)
+{
+	return transformed.lod < 0 ? primitive.mode : primitive_t::index_mode_t::TRIANGLES;
+}
+inline size_t drawn_vertex_count(const primitive_t & primitive, const transformed_primitive_t & transformed)
+{
+	return transformed.lod < 0 ? primitive.vertices.size() : primitive.lods[transformed.lod].vertex_count;
+}
+struct transformed_node_t
+{
+	bool visible = false; // some of its primitives are visible
+	std::vector<transformed_primitive_t> primitives;
+};
+struct transformed_scene_t
+{
+	std::vector<transformed_node_t> nodes;
+	// result of the last culling, by scene order
+	std::vector<bvh_t::item_t> visible_primitives;
+	std::vector<int> visible_nodes;
+
+	inline void resize(const scene_t & scene)
+	{
+		nodes.resize(scene.nodes.size());
+		for (size_t i=0 ; i<nodes.size() ; i++)
+			nodes[i].primitives.resize(scene.nodes[i].primitives.size());
+	}
+};
+
+
+// center of the bounding box, distance to the farthest vertex
+inline void calculate_bounds(primitive_t & primitive)
+{
+	if (primitive.vertices.empty())
+	{
+		primitive.bounds = bounding_sphere_t{};
+		return;
+	}
+	const auto & vertices = primitive.vertices;
+	vertex_t min = vertices.position(0);
+	vertex_t max = vertices.position(0);
+	for (size_t i=1 ; i<vertices.size() ; i++)
+	{
+		min = vertex_t(std::min(min.x(), vertices.x[i]), std::min(min.y(), vertices.y[i]), std::min(min.z(), vertices.z[i]));
+		max = vertex_t(std::max(max.x(), vertices.x[i]), std::max(max.y(), vertices.y[i]), std::max(max.z(), vertices.z[i]));
+	}
+	vertex_t center = (min + max) / 2;
+	float radius_squared = 0;
+	for (size_t i=0 ; i<vertices.size() ; i++)
+		radius_squared = std::max(radius_squared, (vertices.position(i) - center).len_squared());
+	primitive.bounds = bounding_sphere_t{center, std::sqrt(radius_squared)};
+}
+inline void calculate_bounds(node_t & node)
+{
+	for (auto & primitive : node.primitives)
+		calculate_bounds(primitive);
+}
 
 inline void calculate_face_normals(primitive_t & primitive)
 {
@@ -188,15 +543,15 @@ inline void calculate_face_normals(primitive_t & primitive)
 		int i0 = primitive.indices[0];
 		int i1 = primitive.indices[1];
 		int i2 = primitive.indices[2];
-		normal_t n(cross(vertices[i1].v-vertices[i0].v, vertices[i2].v-vertices[i0].v));
-		vertices[i0].normal = n;
-		vertices[i1].normal = n;
-		vertices[i2].normal = n;
+		normal_t n(cross(vertices.position(i1)-vertices.position(i0), vertices.position(i2)-vertices.position(i0)));
+		vertices.set_normal(i0, n);
+		vertices.set_normal(i1, n);
+		vertices.set_normal(i2, n);
 		for (unsigned int i=3 ; i<primitive.indices.size() ; i++, i0=i1, i1=i2)
 		{
 			i2 = primitive.indices[i];
-			vertices[i2].normal = normal_t(((i&0x1)==0) ? cross(vertices[i1].v-vertices[i0].v, vertices[i2].v-vertices[i0].v)
-			                                            : cross(vertices[i2].v-vertices[i0].v, vertices[i1].v-vertices[i0].v));
+			vertices.set_normal(i2, normal_t(((i&0x1)==0) ? cross(vertices.position(i1)-vertices.position(i0), vertices.position(i2)-vertices.position(i0))
+			                                                     : cross(vertices.position(i2)-vertices.position(i0), vertices.position(i1)-vertices.position(i0))));
 		}
 	}
 	// Preca node.normals for fans
@@ -205,14 +560,14 @@ inline void calculate_face_normals(primitive_t & primitive)
 		int i0 = primitive.indices[0];
 		int i1 = primitive.indices[1];
 		int i2 = primitive.indices[2];
-		normal_t n(cross(vertices[i1].v-vertices[i0].v, vertices[i2].v-vertices[i0].v));
-		vertices[i0].normal = n;
-		vertices[i1].normal = n;
-		vertices[i2].normal = n;
+		normal_t n(cross(vertices.position(i1)-vertices.position(i0), vertices.position(i2)-vertices.position(i0)));
+		vertices.set_normal(i0, n);
+		vertices.set_normal(i1, n);
+		vertices.set_normal(i2, n);
 		for (unsigned int i=3 ; i<primitive.indices.size() ; i++, i1=i2)
 		{
 			i2 = primitive.indices[i];
-			vertices[i2].normal = normal_t(cross(vertices[i1].v-vertices[i0].v, vertices[i2].v-vertices[i0].v));
+			vertices.set_normal(i2, normal_t(cross(vertices.position(i1)-vertices.position(i0), vertices.position(i2)-vertices.position(i0))));
 		}
 	}
 	// Preca node.normals for lose triangles
@@ -222,10 +577,10 @@ inline void calculate_face_normals(primitive_t & primitive)
 			int i0 = primitive.indices[i-2];
 			int i1 = primitive.indices[i-1];
 			int i2 = primitive.indices[i  ];
-			vector_t n(cross(vertices[i1].v-vertices[i0].v, vertices[i2].v-vertices[i0].v));
-			vertices[i0].normal = n;
-			vertices[i1].normal = n;
-			vertices[i2].normal = n;
+			vector_t n(cross(vertices.position(i1)-vertices.position(i0), vertices.position(i2)-vertices.position(i0)));
+			vertices.set_normal(i0, n);
+			vertices.set_normal(i1, n);
+			vertices.set_normal(i2, n);
 		}
 }
 
@@ -236,9 +591,9 @@ inline node_t make_tri(float size, int material_idx)
 
 	result.primitives = std::vector<primitive_t>
 		{
-			primitive_t{std::vector<mesh_vertex_t>{mesh_vertex_t{vertex_t{0.0f, 0.0f, 0.0f}, {}, {}, vec2f_t{0.0f,0.0f}, normal_t(0,0,1), {}}
-			                                      ,mesh_vertex_t{vertex_t{size, 0.0f, 0.0f}, {}, {}, vec2f_t{0.0f,1.0f}, normal_t(0,0,1), {}}
-			                                      ,mesh_vertex_t{vertex_t{0.0f, size, 0.0f}, {}, {}, vec2f_t{1.0f,0.0f}, normal_t(0,0,1), {}}
+			primitive_t{std::vector<mesh_vertex_t>{mesh_vertex_t{vertex_t{0.0f, 0.0f, 0.0f}, vec2f_t{0.0f,0.0f}, normal_t(0,0,1)}
+			                                      ,mesh_vertex_t{vertex_t{size, 0.0f, 0.0f}, vec2f_t{0.0f,1.0f}, normal_t(0,0,1)}
+			                                      ,mesh_vertex_t{vertex_t{0.0f, size, 0.0f}, vec2f_t{1.0f,0.0f}, normal_t(0,0,1)}
 			                                      }
 			           ,{0,1,2}
 			           ,primitive_t::index_mode_t::TRIANGLES
@@ -247,6 +602,7 @@ inline node_t make_tri(float size, int material_idx)
 		};
 
 	//calculate_face_normals(result);
+	calculate_bounds(result);
 	
 	return result;	
 }
@@ -258,60 +614,60 @@ inline node_t make_cube(float size, int material_idx)
 	result.primitives = std::vector<primitive_t>
 		{
 			// 0 fan (top face): value 1
-			primitive_t{std::vector<mesh_vertex_t>{mesh_vertex_t{vertex_t(-size / 2.0f,  size / 2.0f,  size / 2.0f), {}, {}, vec2f_t{0.0,0.0  }, normal_t(0,1,0), {}, false}
-			                                      ,mesh_vertex_t{vertex_t( size / 2.0f,  size / 2.0f,  size / 2.0f), {}, {}, vec2f_t{0.5,0.0  }, normal_t(0,1,0), {}, false}
-			                                      ,mesh_vertex_t{vertex_t( size / 2.0f,  size / 2.0f, -size / 2.0f), {}, {}, vec2f_t{0.5,0.333}, normal_t(0,1,0), {}, false}
-			                                      ,mesh_vertex_t{vertex_t(-size / 2.0f,  size / 2.0f, -size / 2.0f), {}, {}, vec2f_t{0.0,0.333}, normal_t(0,1,0), {}, false}
+			primitive_t{std::vector<mesh_vertex_t>{mesh_vertex_t{vertex_t(-size / 2.0f,  size / 2.0f,  size / 2.0f), vec2f_t{0.0,0.0  }, normal_t(0,1,0)}
+			                                      ,mesh_vertex_t{vertex_t( size / 2.0f,  size / 2.0f,  size / 2.0f), vec2f_t{0.5,0.0  }, normal_t(0,1,0)}
+			                                      ,mesh_vertex_t{vertex_t( size / 2.0f,  size / 2.0f, -size / 2.0f), vec2f_t{0.5,0.333}, normal_t(0,1,0)}
+			                                      ,mesh_vertex_t{vertex_t(-size / 2.0f,  size / 2.0f, -size / 2.0f), vec2f_t{0.0,0.333}, normal_t(0,1,0)}
 			                                      }
 			           ,{0,1,2,3}
 			           ,primitive_t::index_mode_t::TRIANGLE_FAN
 			           ,material_idx
 		               },
 			// 1 fan (front face): value 2
-			primitive_t{std::vector<mesh_vertex_t>{mesh_vertex_t{vertex_t(-size / 2.0f, -size / 2.0f,  size / 2.0f), {}, {}, vec2f_t{0.5,0.0  }, normal_t(0,0,1), {}, false}
-			                                      ,mesh_vertex_t{vertex_t( size / 2.0f, -size / 2.0f,  size / 2.0f), {}, {}, vec2f_t{1.0,0.0  }, normal_t(0,0,1), {}, false}
-			                                      ,mesh_vertex_t{vertex_t( size / 2.0f,  size / 2.0f,  size / 2.0f), {}, {}, vec2f_t{1.0,0.333}, normal_t(0,0,1), {}, false}
-			                                      ,mesh_vertex_t{vertex_t(-size / 2.0f,  size / 2.0f,  size / 2.0f), {}, {}, vec2f_t{0.5,0.333}, normal_t(0,0,1), {}, false}
+			primitive_t{std::vector<mesh_vertex_t>{mesh_vertex_t{vertex_t(-size / 2.0f, -size / 2.0f,  size / 2.0f), vec2f_t{0.5,0.0  }, normal_t(0,0,1)}
+			                                      ,mesh_vertex_t{vertex_t( size / 2.0f, -size / 2.0f,  size / 2.0f), vec2f_t{1.0,0.0  }, normal_t(0,0,1)}
+			                                      ,mesh_vertex_t{vertex_t( size / 2.0f,  size / 2.0f,  size / 2.0f), vec2f_t{1.0,0.333}, normal_t(0,0,1)}
+			                                      ,mesh_vertex_t{vertex_t(-size / 2.0f,  size / 2.0f,  size / 2.0f), vec2f_t{0.5,0.333}, normal_t(0,0,1)}
 			                                      }
 			           ,{0,1,2,3}
 			           ,primitive_t::index_mode_t::TRIANGLE_FAN
 			           ,material_idx
 		               },
 			// 2 fan (right face): value 4
-			primitive_t{std::vector<mesh_vertex_t>{mesh_vertex_t{vertex_t( size / 2.0f, -size / 2.0f,  size / 2.0f), {}, {}, vec2f_t{0.0,0.333}, normal_t(1,0,0), {}, false}
-			                                      ,mesh_vertex_t{vertex_t( size / 2.0f, -size / 2.0f, -size / 2.0f), {}, {}, vec2f_t{0.5,0.333}, normal_t(1,0,0), {}, false}
-			                                      ,mesh_vertex_t{vertex_t( size / 2.0f,  size / 2.0f, -size / 2.0f), {}, {}, vec2f_t{0.5,0.667}, normal_t(1,0,0), {}, false}
-			                                      ,mesh_vertex_t{vertex_t( size / 2.0f,  size / 2.0f,  size / 2.0f), {}, {}, vec2f_t{0.0,0.667}, normal_t(1,0,0), {}, false}
+			primitive_t{std::vector<mesh_vertex_t>{mesh_vertex_t{vertex_t( size / 2.0f, -size / 2.0f,  size / 2.0f), vec2f_t{0.0,0.333}, normal_t(1,0,0)}
+			                                      ,mesh_vertex_t{vertex_t( size / 2.0f, -size / 2.0f, -size / 2.0f), vec2f_t{0.5,0.333}, normal_t(1,0,0)}
+			                                      ,mesh_vertex_t{vertex_t( size / 2.0f,  size / 2.0f, -size / 2.0f), vec2f_t{0.5,0.667}, normal_t(1,0,0)}
+			                                      ,mesh_vertex_t{vertex_t( size / 2.0f,  size / 2.0f,  size / 2.0f), vec2f_t{0.0,0.667}, normal_t(1,0,0)}
 			                                      }
 			           ,{0,1,2,3}
 			           ,primitive_t::index_mode_t::TRIANGLE_FAN
 			           ,material_idx
 		               },
 			// 3 fan (back face): value 6
-			primitive_t{std::vector<mesh_vertex_t>{mesh_vertex_t{vertex_t( size / 2.0f, -size / 2.0f, -size / 2.0f), {}, {}, vec2f_t{0.5,0.667}, normal_t(0,0,-1), {}, false}
-			                                      ,mesh_vertex_t{vertex_t(-size / 2.0f, -size / 2.0f, -size / 2.0f), {}, {}, vec2f_t{1.0,0.667}, normal_t(0,0,-1), {}, false}
-			                                      ,mesh_vertex_t{vertex_t(-size / 2.0f,  size / 2.0f, -size / 2.0f), {}, {}, vec2f_t{1.0,1.0  }, normal_t(0,0,-1), {}, false}
-			                                      ,mesh_vertex_t{vertex_t( size / 2.0f,  size / 2.0f, -size / 2.0f), {}, {}, vec2f_t{0.5,1.0  }, normal_t(0,0,-1), {}, false}
+			primitive_t{std::vector<mesh_vertex_t>{mesh_vertex_t{vertex_t( size / 2.0f, -size / 2.0f, -size / 2.0f), vec2f_t{0.5,0.667}, normal_t(0,0,-1)}
+			                                      ,mesh_vertex_t{vertex_t(-size / 2.0f, -size / 2.0f, -size / 2.0f), vec2f_t{1.0,0.667}, normal_t(0,0,-1)}
+			                                      ,mesh_vertex_t{vertex_t(-size / 2.0f,  size / 2.0f, -size / 2.0f), vec2f_t{1.0,1.0  }, normal_t(0,0,-1)}
+			                                      ,mesh_vertex_t{vertex_t( size / 2.0f,  size / 2.0f, -size / 2.0f), vec2f_t{0.5,1.0  }, normal_t(0,0,-1)}
 			                                      }
 			           ,{0,1,2,3}
 			           ,primitive_t::index_mode_t::TRIANGLE_FAN
 			           ,material_idx
 		               },
 			// 4 fan (left face): value 3
-			primitive_t{std::vector<mesh_vertex_t>{mesh_vertex_t{vertex_t(-size / 2.0f, -size / 2.0f, -size / 2.0f), {}, {}, vec2f_t{0.5,0.333}, normal_t(-1,0,0), {}, false}
-			                                      ,mesh_vertex_t{vertex_t(-size / 2.0f, -size / 2.0f,  size / 2.0f), {}, {}, vec2f_t{1.0,0.333}, normal_t(-1,0,0), {}, false}
-			                                      ,mesh_vertex_t{vertex_t(-size / 2.0f,  size / 2.0f,  size / 2.0f), {}, {}, vec2f_t{1.0,0.667}, normal_t(-1,0,0), {}, false}
-			                                      ,mesh_vertex_t{vertex_t(-size / 2.0f,  size / 2.0f, -size / 2.0f), {}, {}, vec2f_t{0.5,0.667}, normal_t(-1,0,0), {}, false}
+			primitive_t{std::vector<mesh_vertex_t>{mesh_vertex_t{vertex_t(-size / 2.0f, -size / 2.0f, -size / 2.0f), vec2f_t{0.5,0.333}, normal_t(-1,0,0)}
+			                                      ,mesh_vertex_t{vertex_t(-size / 2.0f, -size / 2.0f,  size / 2.0f), vec2f_t{1.0,0.333}, normal_t(-1,0,0)}
+			                                      ,mesh_vertex_t{vertex_t(-size / 2.0f,  size / 2.0f,  size / 2.0f), vec2f_t{1.0,0.667}, normal_t(-1,0,0)}
+			                                      ,mesh_vertex_t{vertex_t(-size / 2.0f,  size / 2.0f, -size / 2.0f), vec2f_t{0.5,0.667}, normal_t(-1,0,0)}
 			                                      }
 			           ,{0,1,2,3}
 			           ,primitive_t::index_mode_t::TRIANGLE_FAN
 			           ,material_idx
 		               },
 			// 6 fan (bottom face): value 5
-			primitive_t{std::vector<mesh_vertex_t>{mesh_vertex_t{vertex_t(-size / 2.0f, -size / 2.0f, -size / 2.0f), {}, {}, vec2f_t{0.0,0.667}, normal_t(0,-1,0), {}, false}
-			                                      ,mesh_vertex_t{vertex_t( size / 2.0f, -size / 2.0f, -size / 2.0f), {}, {}, vec2f_t{0.5,0.667}, normal_t(0,-1,0), {}, false}
-			                                      ,mesh_vertex_t{vertex_t( size / 2.0f, -size / 2.0f,  size / 2.0f), {}, {}, vec2f_t{0.5,1.0  }, normal_t(0,-1,0), {}, false}
-			                                      ,mesh_vertex_t{vertex_t(-size / 2.0f, -size / 2.0f,  size / 2.0f), {}, {}, vec2f_t{0.0,1.0  }, normal_t(0,-1,0), {}, false}
+			primitive_t{std::vector<mesh_vertex_t>{mesh_vertex_t{vertex_t(-size / 2.0f, -size / 2.0f, -size / 2.0f), vec2f_t{0.0,0.667}, normal_t(0,-1,0)}
+			                                      ,mesh_vertex_t{vertex_t( size / 2.0f, -size / 2.0f, -size / 2.0f), vec2f_t{0.5,0.667}, normal_t(0,-1,0)}
+			                                      ,mesh_vertex_t{vertex_t( size / 2.0f, -size / 2.0f,  size / 2.0f), vec2f_t{0.5,1.0  }, normal_t(0,-1,0)}
+			                                      ,mesh_vertex_t{vertex_t(-size / 2.0f, -size / 2.0f,  size / 2.0f), vec2f_t{0.0,1.0  }, normal_t(0,-1,0)}
 			                                      }
 			           ,{0,1,2,3}
 			           ,primitive_t::index_mode_t::TRIANGLE_FAN
@@ -320,6 +676,7 @@ inline node_t make_cube(float size, int material_idx)
 		};
 
 	//calculate_face_normals(result);
+	calculate_bounds(result);
 
 	return result;	
 }
@@ -345,11 +702,8 @@ inline node_t make_tore(unsigned int precision, int material_idx)
 			for (unsigned int sm = 0; sm <= precision; sm++)
 			{
 				primitive.vertices.push_back(mesh_vertex_t{transform(transform(vertex_t(0.0f, 0.0f, 0.0f), small), big)
-				                                          ,{}
-				                                          ,{}
 				                                          ,vec2f_t(1.0*bg/precision, 1.0*sm/precision)
 				                                          ,transform(transform(normal_t(1.0f, 0.0f, 0.0f), small_normal), big_normal)
-				                                          ,{}
 					                                      }
 				                            );
 				small.rotate_z(angle);
@@ -366,11 +720,8 @@ inline node_t make_tore(unsigned int precision, int material_idx)
 			for (unsigned int sm = 0; sm <= precision; sm++)
 			{
 				primitive.vertices.push_back(mesh_vertex_t{transform(transform(vertex_t(0.0f, 0.0f, 0.0f), small), big)
-				                                          ,{}
-				                                          ,{}
 				                                          ,vec2f_t(1.0*(bg+1)/precision, 1.0*sm/precision)
 				                                          ,transform(transform(normal_t(1.0f, 0.0f, 0.0f), small_normal), big_normal)
-				                                          ,{}
 					                                      }
 				                            );
 				small.rotate_z(angle);
@@ -383,10 +734,10 @@ inline node_t make_tore(unsigned int precision, int material_idx)
 			primitive.indices.push_back(precision+1 + sm);
 			primitive.indices.push_back(              sm);
 		}
-
-		primitive.vertices.reserve(primitive.vertices.size() + 2); // allow for 2 extra vertices in case we have triangles intersecting the 0,0 camera plane
 	}
 
+	calculate_bounds(result);
+
 	return result;
 }
 
@@ -408,11 +759,8 @@ inline node_t make_sphere(unsigned int precision, float radius, int material_idx
 			{
 				vertex_t v = transform(transform(vertex_t(0.0f, radius, 0.0f),small), big);
 				primitive.vertices.push_back(mesh_vertex_t{v
-				                                          ,{}
-				                                          ,{}
 				                                          ,vec2f_t(1.0*sm/precision, 1.0*bg/precision)
 				                                          ,normal_t(v.x(), v.y(), v.z())
-				                                          ,{}
 				                                          }
 				                            );
 				small.rotate_z(angle/2);
@@ -426,11 +774,8 @@ inline node_t make_sphere(unsigned int precision, float radius, int material_idx
 			{
 				vertex_t v = transform(transform(vertex_t(0.0f, radius, 0.0f),small), big);
 				primitive.vertices.push_back(mesh_vertex_t{v
-				                                          ,{}
-				                                          ,{}
 				                                          ,vec2f_t(1.0*sm/precision, 1.0*(bg+1)/precision)
 				                                          ,normal_t(v.x(), v.y(), v.z())
-				                                          ,{}
 				                                          }
 				                            );
 				small.rotate_z(angle/2);
@@ -441,8 +786,6 @@ inline node_t make_sphere(unsigned int precision, float radius, int material_idx
 			primitive.indices.push_back(precision+1 + sm);
 			primitive.indices.push_back(              sm);
 		}
-
-		primitive.vertices.reserve(primitive.vertices.size() + 2); // allow for 2 extra vertices in case we have triangles intersecting the 0,0 camera plane
 	}
 
 	/*
@@ -460,6 +803,8 @@ inline node_t make_sphere(unsigned int precision, float radius, int material_idx
 	}
 	*/
 
+	calculate_bounds(result);
+
 	return result;
 }
 
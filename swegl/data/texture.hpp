@@ -3,38 +3,134 @@
 
 #include <memory>
 #include <vector>
+#include <cmath>
+#include <algorithm>
 
 namespace swegl
 {
 
-	#define MIPMAPS_COUNT 5
+	// Where texel (x,y) is in a bitmap: row(y) + column(x), the same formula for all layouts.
+	// Rows and columns are separate so that samplers can wrap them separately.
+	struct texel_addressing_t
+	{
+		unsigned int shift = 0;           // log2 of the tile size
+		unsigned int mask = 0;            // tile size - 1
+		unsigned int row_stride;          // texels between rows of tiles
+		unsigned int tile_row_stride = 0; // texels between rows inside a tile
+		unsigned int tile_stride = 1;     // texels between tiles of a row
+
+		inline unsigned int row   (unsigned int y) const { return (y >> shift) * row_stride  + (y & mask) * tile_row_stride; }
+		inline unsigned int column(unsigned int x) const { return (x >> shift) * tile_stride + (x & mask); }
+	};
+
+	// texel coordinate i wrapped into [0,size[ as the texture repeats, negative coordinates included
+	template<bool power_of_two>
+	inline unsigned int wrap_texel(int i, unsigned int size)
+	{
+		if (power_of_two)
+			return i & (size - 1); // two's complement: -1 is size-1
+		int r = i % (int)size;
+		return r < 0 ? r + size : r;
+	}
 
 	struct mipmap_t
 	{
+		enum layout_t
+		{
+			ROW_MAJOR = 0,
+			TILED_4X4 = 1, // 4x4 texels per 64 byte cache line, tiles row-major: neighbours in both directions are close
+			BC1       = 2, // 4x4 texel blocks compressed to 8 bytes, opaque, see block_compression.hpp
+			BC3       = 3, // 4x4 texel blocks compressed to 16 bytes, with alpha
+		};
+
 		unsigned int *m_bitmap = nullptr;
 		unsigned int m_width;
 		unsigned int m_height;
+		layout_t m_layout = ROW_MAJOR;
+		texel_addressing_t m_addressing;
+
 		inline mipmap_t(unsigned int * b, unsigned int w, unsigned int h)
 			: m_bitmap(b)
 			, m_width(w)
 			, m_height(h)
+			, m_addressing{0, 0, w}
 		{}
 		~mipmap_t()
 		{
 			if (m_bitmap)
 				delete[] m_bitmap;
 		}
+
+		inline bool power_of_two() const { return (m_width & (m_width - 1)) == 0 && (m_height & (m_height - 1)) == 0; }
+		inline bool compressed() const { return m_layout == BC1 || m_layout == BC3; }
+		inline unsigned int blocks_x() const { return (m_width + 3) / 4; }
+		size_t bytes() const;
+
+		// not for compressed mipmaps, see block_cache_t
+		inline       unsigned int & texel(unsigned int x, unsigned int y)       { return m_bitmap[m_addressing.row(y) + m_addressing.column(x)]; }
+		inline const unsigned int & texel(unsigned int x, unsigned int y) const { return m_bitmap[m_addressing.row(y) + m_addressing.column(x)]; }
+
+		// rearranges or compresses the texels, tiled and compressed bitmaps are padded to whole tiles
+		void set_layout(layout_t layout);
+		// the 16 texels of a block of a compressed mipmap, in the order of the rows
+		void decode_block(unsigned int block, unsigned int texels[16]) const;
+	};
+
+	// The last blocks of compressed mipmaps decoded by a sampler, direct-mapped: a block goes in the entry of its position
+	// in an 8x8 block window, so that nearby blocks in both directions don't evict each other.
+	// Not shared between threads: each pixel shader clone has its own.
+	struct block_cache_t
+	{
+		static const int size = 64;
+
+		struct entry_t
+		{
+			const unsigned int * blocks = nullptr;
+			unsigned int block;
+			unsigned int texels[16];
+		};
+		entry_t entries[size];
+
+		inline unsigned int texel(const mipmap_t & mipmap, unsigned int x, unsigned int y)
+		{
+			unsigned int bx = x >> 2, by = y >> 2;
+			unsigned int block = by * mipmap.blocks_x() + bx;
+			entry_t & entry = entries[(by & 7) << 3 | (bx & 7)];
+			if (entry.blocks != mipmap.m_bitmap || entry.block != block)
+			{
+				mipmap.decode_block(block, entry.texels);
+				entry.blocks = mipmap.m_bitmap;
+				entry.block = block;
+			}
+			return entry.texels[(y & 3) << 2 | (x & 3)];
+		}
 	};
 
 	class texture_t
 	{
 	public:
+		// full chain, each level half the size of the previous one, down to 1x1
 		std::vector<std::shared_ptr<mipmap_t>> m_mipmaps;
 
 		texture_t(unsigned int rgb);
 		texture_t(unsigned * data, int w, int h);
 
 		void produce_mipmaps();
+		void set_layout(mipmap_t::layout_t layout);
+		size_t bytes() const;
+		// Resamples a texture whose sides are not powers of two up to the next powers of two, so that samplers
+		// wrap with masks instead of divisions. Not done if it would take more than max_growth times the texels.
+		bool resample_to_power_of_two(float max_growth = 2.0f);
+
+		// level with the nearest to 1 texel per pixel, for a surface covering texel_area level 0 texels on pixel_area pixels
+		inline const mipmap_t & mipmap(float texel_area, float pixel_area) const
+		{
+			if (m_mipmaps.size() == 1 || ! (texel_area > pixel_area))
+				return *m_mipmaps[0];
+			// each level divides the area by 4
+			float level = std::min(0.5f * std::log2(texel_area / pixel_area) + 0.5f, (float)(m_mipmaps.size() - 1));
+			return *m_mipmaps[(int)level];
+		}
 	};
 
 }
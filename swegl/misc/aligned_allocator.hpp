@@ -0,0 +1,41 @@
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+namespace swegl
+{
+
+// std::allocator with a stronger alignment, so that SIMD loops can use aligned loads from the start of a std::vector
+template<typename T, std::size_t Alignment>
+struct aligned_allocator
+{
+	using value_type = T;
+
+	template<typename U>
+	struct rebind
+	{
+		using other = aligned_allocator<U, Alignment>;
+	};
+
+	aligned_allocator() = default;
+	template<typename U>
+	aligned_allocator(const aligned_allocator<U, Alignment> &) {}
+
+	T * allocate(std::size_t n)
+	{
+		return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+	}
+	void deallocate(T * p, std::size_t)
+	{
+		::operator delete(p, std::align_val_t(Alignment));
+	}
+
+	template<typename U>
+	bool operator==(const aligned_allocator<U, Alignment> &) const { return true; }
+	template<typename U>
+	bool operator!=(const aligned_allocator<U, Alignment> &) const { return false; }
+};
+
+} // namespace
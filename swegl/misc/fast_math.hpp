@@ -0,0 +1,174 @@
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <smmintrin.h>
+
+// 0, 1 or 2: EXACT, REFINED or FAST, see math_accuracy_t
+#ifndef SWEGL_MATH_ACCURACY
+#define SWEGL_MATH_ACCURACY 1
+#endif
+
+namespace swegl
+{
+
+// Approximations for the math of per-pixel code, at 3 accuracies:
+// EXACT:   the standard functions, IEEE divisions and square roots: what the renderer did before
+// REFINED: hardware estimates refined by a Newton-Raphson step, polynomials of degree 5 to 7
+// FAST:    hardware estimates alone, polynomials of degree 3
+// The renderer uses the accuracy picked at compile time by SWEGL_MATH_ACCURACY, REFINED if not defined.
+// Each function takes the accuracy as a template parameter too, test_fast_math checks all 3 against math_error_bounds().
+enum class math_accuracy_t
+{
+	EXACT   = 0,
+	REFINED = 1,
+	FAST    = 2,
+};
+constexpr math_accuracy_t default_math_accuracy = math_accuracy_t(SWEGL_MATH_ACCURACY);
+
+// largest relative errors
+struct math_error_bounds_t
+{
+	float rsqrt, rcp;
+	float pow, pow_per_exponent, pow_per_log2; // pow(x,y): pow + |y| * pow_per_exponent + |log2(x^y)| * pow_per_log2, for results over 1e-30
+};
+constexpr math_error_bounds_t math_error_bounds(math_accuracy_t accuracy)
+{
+	switch (accuracy)
+	{
+		case math_accuracy_t::EXACT  : return {1.2e-7f, 6.0e-8f, 1.2e-7f, 0      , 0      };
+		case math_accuracy_t::REFINED: return {3.6e-7f, 2.4e-7f, 2.0e-7f, 2.5e-7f, 1.0e-7f};
+		default                      : return {3.7e-4f, 3.7e-4f, 1.3e-4f, 6.2e-4f, 1.0e-7f};
+	}
+}
+
+// 1/sqrt(x), x > 0
+template<math_accuracy_t A = default_math_accuracy>
+inline __m128 fast_rsqrt(__m128 x)
+{
+	if constexpr (A == math_accuracy_t::EXACT)
+		return _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(x));
+	__m128 y = _mm_rsqrt_ps(x);
+	if constexpr (A == math_accuracy_t::REFINED)
+		y = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), y), _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_mul_ps(x, y), y)));
+	return y;
+}
+template<math_accuracy_t A = default_math_accuracy>
+inline float fast_rsqrt(float x) { return _mm_cvtss_f32(fast_rsqrt<A>(_mm_set_ss(x))); }
+
+// 1/x, x != 0
+template<math_accuracy_t A = default_math_accuracy>
+inline __m128 fast_rcp(__m128 x)
+{
+	if constexpr (A == math_accuracy_t::EXACT)
+		return _mm_div_ps(_mm_set1_ps(1.0f), x);
+	__m128 y = _mm_rcp_ps(x);
+	if constexpr (A == math_accuracy_t::REFINED)
+		y = _mm_add_ps(y, _mm_mul_ps(y, _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(x, y))));
+	return y;
+}
+template<math_accuracy_t A = default_math_accuracy>
+inline float fast_rcp(float x) { return _mm_cvtss_f32(fast_rcp<A>(_mm_set_ss(x))); }
+
+// a/b, b != 0
+template<math_accuracy_t A = default_math_accuracy>
+inline float fast_div(float a, float b)
+{
+	if constexpr (A == math_accuracy_t::EXACT)
+		return a / b;
+	return a * fast_rcp<A>(b);
+}
+
+// x^y for x >= 0, as 2^(y*log2(x)) with polynomials for log2 of the mantissa and 2^ of the fraction, 0 for x = 0.
+// Exponents known at compile time are better off squaring, like the shaders' specular power of 32.
+template<math_accuracy_t A = default_math_accuracy>
+inline __m128 fast_pow(__m128 x, __m128 y)
+{
+	if constexpr (A == math_accuracy_t::EXACT)
+	{
+		alignas(16) float xs[4], ys[4];
+		_mm_store_ps(xs, x);
+		_mm_store_ps(ys, y);
+		for (int i=0 ; i<4 ; i++)
+			xs[i] = std::pow(xs[i], ys[i]);
+		return _mm_load_ps(xs);
+	}
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	// log2(x) = e + log2(m), m in [sqrt(1/2),sqrt(2)[
+	__m128i bits = _mm_castps_si128(x);
+	__m128i e = _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127));
+	__m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF)), _mm_castps_si128(one)));
+	__m128 big = _mm_cmpgt_ps(m, _mm_set1_ps(1.41421356f));
+	m = _mm_blendv_ps(m, _mm_mul_ps(m, _mm_set1_ps(0.5f)), big);
+	e = _mm_sub_epi32(e, _mm_castps_si128(big));
+	__m128 t = _mm_sub_ps(m, one);
+	__m128 p;
+	if constexpr (A == math_accuracy_t::REFINED)
+	{
+		p =                 _mm_set1_ps( 0.17063435f);
+		p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-0.27269789f));
+		p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps( 0.297262616f));
+		p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-0.358961855f));
+		p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps( 0.480465032f));
+		p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-0.721375871f));
+		p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps( 1.44269973f));
+	}
+	else
+	{
+		p =                 _mm_set1_ps( 0.445070064f);
+		p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-0.754081355f));
+		p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps( 1.44515208f));
+	}
+	__m128 log2_x = _mm_add_ps(_mm_cvtepi32_ps(e), _mm_mul_ps(p, t));
+
+	// 2^z = 2^i * 2^f, f in [0,1[, 0 under 2^-126
+	__m128 z = _mm_mul_ps(y, log2_x);
+	__m128 normal = _mm_and_ps(_mm_cmpge_ps(z, _mm_set1_ps(-126.0f)), _mm_cmpgt_ps(x, _mm_setzero_ps()));
+	z = _mm_min_ps(_mm_max_ps(z, _mm_set1_ps(-126.0f)), _mm_set1_ps(127.99f));
+	__m128 i = _mm_floor_ps(z);
+	__m128 f = _mm_sub_ps(z, i);
+	__m128 q;
+	if constexpr (A == math_accuracy_t::REFINED)
+	{
+		q =                 _mm_set1_ps(0.00188529746f);
+		q = _mm_add_ps(_mm_mul_ps(q, f), _mm_set1_ps(0.00897337854f));
+		q = _mm_add_ps(_mm_mul_ps(q, f), _mm_set1_ps(0.055835927f));
+		q = _mm_add_ps(_mm_mul_ps(q, f), _mm_set1_ps(0.240152808f));
+		q = _mm_add_ps(_mm_mul_ps(q, f), _mm_set1_ps(0.693152471f));
+	}
+	else
+	{
+		q =                 _mm_set1_ps(0.0781455759f);
+		q = _mm_add_ps(_mm_mul_ps(q, f), _mm_set1_ps(0.226173569f));
+		q = _mm_add_ps(_mm_mul_ps(q, f), _mm_set1_ps(0.695556858f));
+	}
+	q = _mm_add_ps(one, _mm_mul_ps(q, f));
+	__m128i scaled = _mm_add_epi32(_mm_castps_si128(q), _mm_slli_epi32(_mm_cvtps_epi32(i), 23));
+	return _mm_and_ps(_mm_castsi128_ps(scaled), normal);
+}
+template<math_accuracy_t A = default_math_accuracy>
+inline float fast_pow(float x, float y) { return _mm_cvtss_f32(fast_pow<A>(_mm_set_ss(x), _mm_set_ss(y))); }
+
+// 4 channels rounded to the nearest integer and clamped to [0,255], packed into the bytes of an int like pixel_colors.
+// Ties round away from 0 when EXACT like round(), to even otherwise.
+template<math_accuracy_t A = default_math_accuracy>
+inline int fast_to_u8(__m128 channels)
+{
+	if constexpr (A == math_accuracy_t::EXACT)
+	{
+		alignas(16) float c[4];
+		_mm_store_ps(c, channels);
+		int result = 0;
+		for (int i=3 ; i>=0 ; i--)
+			result = result << 8 | (int)std::round(std::clamp(c[i], 0.0f, 255.0f));
+		return result;
+	}
+	__m128i i = _mm_cvtps_epi32(channels);
+	i = _mm_packs_epi32(i, i);
+	i = _mm_packus_epi16(i, i);
+	return _mm_cvtsi128_si32(i);
+}
+
+} // namespace
@@ -0,0 +1,57 @@
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace swegl
+{
+
+// Threads started once and shared by everything that renders in parallel.
+// The thread calling run() works on its own job too, so jobs can be started from inside other jobs
+// (viewports rendered in parallel, each of them rasterizing its tiles in parallel) without deadlocking:
+// at worst, the caller does all the work itself.
+struct worker_pool_t
+{
+	worker_pool_t(int thread_count);
+	~worker_pool_t();
+
+	// calls f(i) for each i in [0,count[ on the calling thread and on idle workers, returns once they all returned
+	void run(int count, const std::function<void(int)> & f);
+
+	inline int thread_count() const { return m_threads.size(); }
+
+private:
+	struct job_t
+	{
+		const std::function<void(int)> * f;
+		int count;
+		std::atomic<int> next;
+		std::atomic<int> done;
+		int users; // workers holding a pointer to the job, guarded by m_mutex
+
+		job_t(const std::function<void(int)> & f, int count)
+			: f(&f), count(count), next(0), done(0), users(0)
+		{}
+	};
+
+	void work_on(job_t & job);
+	void worker();
+
+	std::vector<std::thread> m_threads;
+	std::deque<job_t*> m_jobs;
+	std::mutex m_mutex;
+	std::condition_variable m_job_available;
+	std::condition_variable m_job_done;
+	bool m_stopping;
+};
+
+// hardware_concurrency-1 workers: the thread calling run() makes the last one
+worker_pool_t & worker_pool();
+
+} // namespace
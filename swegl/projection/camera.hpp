@@ -7,6 +7,23 @@
 namespace swegl
 {
 
+	struct plane_t
+	{
+		float a, b, c, d; // a*x + b*y + c*z + d is the distance to the plane, positive on the inner side
+
+		inline float distance(const vertex_t & v) const { return a*v.x() + b*v.y() + c*v.z() + d; }
+	};
+
+	// The volume that can end up on screen, in world coordinates: in front of z-near and inside the 4 sides.
+	// There is no z-far.
+	struct frustum_t
+	{
+		plane_t planes[5];
+
+		bool sees_sphere(const vertex_t & center, float radius) const;
+		bool sees_box(const vertex_t & min, const vertex_t & max) const;
+	};
+
 	class camera_t
 	{
 	public:
@@ -21,6 +38,7 @@ namespace swegl
 		void rotate_z(float a);
 		void translate(float x, float y , float z);
 		inline vertex_t position() const { return m_center; };
+		frustum_t frustum() const;
 	};
 
 }
@@ -3,6 +3,7 @@
 
 #include <cmath>
 
+#include <swegl/misc/fast_math.hpp>
 #include <swegl/projection/matrix44.hpp>
 
 namespace swegl
@@ -79,12 +80,26 @@ public:
 
 	inline vector_t & normalize()
 	{
-		float l = len();
-		if (l != 0)
+		if constexpr (default_math_accuracy == math_accuracy_t::EXACT)
 		{
-			_x /= l;
-			_y /= l;
-			_z /= l;
+			float l = len();
+			if (l != 0)
+			{
+				_x /= l;
+				_y /= l;
+				_z /= l;
+			}
+		}
+		else
+		{
+			float l2 = len_squared();
+			if (l2 != 0)
+			{
+				float r = fast_rsqrt(l2);
+				_x *= r;
+				_y *= r;
+				_z *= r;
+			}
 		}
 		return *this;
 	}
@@ -3,6 +3,7 @@
 
 #include <tuple>
 #include <freon/Matrix.hpp>
+#include <swegl/misc/fast_math.hpp>
 
 namespace swegl
 {
@@ -31,12 +32,12 @@ struct interpolator_progress
 	inline void DisplaceStartingPoint(const float & move) {
 		topalpha += topstep * move;
 		bottomalpha += bottomstep * move;
-		ualpha = topalpha / bottomalpha;
+		ualpha = fast_div(topalpha, bottomalpha);
 	}
 	inline void Step() {
 		topalpha += topstep;
 		bottomalpha += bottomstep;
-		ualpha = topalpha / bottomalpha;
+		ualpha = fast_div(topalpha, bottomalpha);
 	}
 
 	inline float progress() const { return ualpha; }
@@ -91,12 +92,12 @@ struct interpolator_g
 	inline void DisplaceStartingPoint(const float & move) {
 		topalpha += topstep * move;
 		bottomalpha += bottomstep * move;
-		ualpha = topalpha / bottomalpha;
+		ualpha = fast_div(topalpha, bottomalpha);
 	}
 	inline void Step() {
 		topalpha += topstep;
 		bottomalpha += bottomstep;
-		ualpha = topalpha / bottomalpha;
+		ualpha = fast_div(topalpha, bottomalpha);
 	}
 
 	inline float progress() const { return ualpha; }
@@ -1,10 +1,14 @@
 
 #pragma once
 
+#include <memory>
 #include <numeric>
 #include <cmath>
+#include <cstdint>
+#include <smmintrin.h>
 
 #include "swegl/data/model.hpp"
+#include "swegl/misc/fast_math.hpp"
 #include "swegl/projection/points.hpp"
 #include "swegl/render/colors.hpp"
 #include "swegl/render/viewport.hpp"
@@ -12,31 +16,66 @@
 namespace swegl
 {
 
+// diffuse and specular light of point source lights at a point of the given normal, camera_vector towards the camera.
+// SIMD, width lights at a time
+float point_lights_intensity(const point_source_light_range_t & lights, const vertex_t & point, const normal_t & normal, const vector_t & camera_vector);
+// its diffuse and specular terms apart: only the specular one depends on the camera
+float point_lights_diffuse (const point_source_light_range_t & lights, const vertex_t & point, const normal_t & normal);
+float point_lights_specular(const point_source_light_range_t & lights, const vertex_t & point, const normal_t & normal, const vector_t & camera_vector);
+// ambient, sun and point source lights at a point of the given normal, seen from the viewport's camera, 1 for full light
+float light_intensity(const scene_t & scene, const viewport_t & viewport, const vertex_t & point, const normal_t & normal);
+
 struct pixel_shader_t
 {
+	// at most that many pixels per shade_span call, one bit each in the coverage mask
+	static const int span_size = 32;
+
 	const primitive_t * primitive;
 	const scene_t * scene;
 	const viewport_t * viewport;
 	pixel_colors color;
 	bool double_sided;
+	cached_face_t cached_face; // set by the renderer before each prepare_for_triangle()
 
 	virtual void prepare_for_primitive(const primitive_t & p, const scene_t & s, const viewport_t & vp);
-	virtual void prepare_for_triangle(vertex_idx, vertex_idx, vertex_idx, bool) {}
+	// the vertices may not belong to the primitive: near-plane clipping creates new ones
+	virtual void prepare_for_triangle(const transformed_vertex_t &, const transformed_vertex_t &, const transformed_vertex_t &, bool) {}
 	virtual void prepare_for_upper_triangle([[maybe_unused]] bool long_line_on_right) {}
 	virtual void prepare_for_lower_triangle([[maybe_unused]] bool long_line_on_right) {}
 	virtual void prepare_for_scanline([[maybe_unused]] float progress_left, [[maybe_unused]] float progress_right) {}
 	virtual int shade([[maybe_unused]] float progress) { return color.to_int(); }
+	// A run of count pixels of the current scanline, one virtual call for all of them: colors[i] for progress[i],
+	// for the pixels whose bit is set in coverage. The other colors are left undefined.
+	// Shaders that only override shade() get this loop over it.
+	virtual void shade_span(const float * progress, std::uint32_t coverage, [[maybe_unused]] int count, int * colors)
+	{
+		for (std::uint32_t bits = coverage ; bits ; bits &= bits - 1)
+		{
+			int i = __builtin_ctz(bits);
+			colors[i] = shade(progress[i]);
+		}
+	}
+
+	// per-thread copy for the tiled rasterizer, shaders keep per-triangle state
+	virtual std::shared_ptr<pixel_shader_t> clone() const { return std::make_shared<pixel_shader_t>(*this); }
+	// true to have the vertex stage fill transformed_vertex_t::light of the visible vertices
+	virtual bool lit_per_vertex() const { return false; }
 };
 
 struct pixel_shader_lights_flat : pixel_shader_t
 {
 	float light;
 
-	virtual void prepare_for_triangle(vertex_idx i0, vertex_idx i1, vertex_idx i2, bool inverted) override;
+	virtual void prepare_for_triangle(const transformed_vertex_t & mv0, const transformed_vertex_t & mv1, const transformed_vertex_t & mv2, bool inverted) override;
 	virtual int shade([[maybe_unused]] float progress) override
 	{
 		return light;
 	}
+	virtual void shade_span([[maybe_unused]] const float * progress, [[maybe_unused]] std::uint32_t coverage, int count, int * colors) override
+	{
+		std::fill(colors, colors + count, (int)light);
+	}
+	virtual std::shared_ptr<pixel_shader_t> clone() const override { return std::make_shared<pixel_shader_lights_flat>(*this); }
 };
 
 struct pixel_shader_lights_phong : pixel_shader_t
@@ -55,11 +94,42 @@ struct pixel_shader_lights_phong : pixel_shader_t
 	vector_t n;
 	vector_t ndir;
 
-	virtual void prepare_for_triangle(vertex_idx i0, vertex_idx i1, vertex_idx i2, bool inverted) override;
+	virtual void prepare_for_triangle(const transformed_vertex_t & mv0, const transformed_vertex_t & mv1, const transformed_vertex_t & mv2, bool inverted) override;
 	virtual void prepare_for_upper_triangle(bool long_line_on_right) override;
 	virtual void prepare_for_lower_triangle(bool long_line_on_right) override;
 	virtual void prepare_for_scanline(float progress_left, float progress_right) override;
 	virtual int shade(float progress) override;
+	virtual void shade_span(const float * progress, std::uint32_t coverage, int count, int * colors) override;
+	virtual std::shared_ptr<pixel_shader_t> clone() const override { return std::make_shared<pixel_shader_lights_phong>(*this); }
+};
+
+// Gouraud: the light of the vertices, interpolated across the triangle
+struct pixel_shader_lights_gouraud : pixel_shader_t
+{
+	float l0, l1, l2;
+	float lleft, lright;
+	float lleftdir, lrightdir;
+	float l;
+	float ldir;
+
+	virtual void prepare_for_triangle(const transformed_vertex_t & mv0, const transformed_vertex_t & mv1, const transformed_vertex_t & mv2, bool inverted) override;
+	virtual void prepare_for_upper_triangle(bool long_line_on_right) override;
+	virtual void prepare_for_lower_triangle(bool long_line_on_right) override;
+	virtual void prepare_for_scanline(float progress_left, float progress_right) override;
+	virtual int shade(float progress) override
+	{
+		return l + ldir*progress;
+	}
+	virtual void shade_span(const float * progress, std::uint32_t coverage, [[maybe_unused]] int count, int * colors) override
+	{
+		for (std::uint32_t bits = coverage ; bits ; bits &= bits - 1)
+		{
+			int i = __builtin_ctz(bits);
+			colors[i] = l + ldir*progress[i];
+		}
+	}
+	virtual std::shared_ptr<pixel_shader_t> clone() const override { return std::make_shared<pixel_shader_lights_gouraud>(*this); }
+	virtual bool lit_per_vertex() const override { return true; }
 };
 
 struct pixel_shader_texture : pixel_shader_t
@@ -77,16 +147,27 @@ struct pixel_shader_texture : pixel_shader_t
 	vec2f_t t_dir;
 
 	unsigned int default_bitmap = pixel_colors(128,128,128,255).to_int();
+	const texture_t * texture = nullptr; // the material's, mipmap level picked per triangle
 	unsigned int *tbitmap;
 	unsigned int twidth;
 	unsigned int theight;
+	texel_addressing_t taddressing;
+	bool tpower_of_two; // wrap with masks
+	const mipmap_t * tmipmap = nullptr; // only read block by block when compressed
+	bool tcompressed;
+	block_cache_t tcache;
 
 	virtual void prepare_for_primitive(const primitive_t & p, const scene_t & s, const viewport_t & vp) override;
-	virtual void prepare_for_triangle(vertex_idx i0, vertex_idx i1, vertex_idx i2, bool) override;
+	virtual void prepare_for_triangle(const transformed_vertex_t & mv0, const transformed_vertex_t & mv1, const transformed_vertex_t & mv2, bool) override;
 	virtual void prepare_for_upper_triangle(bool long_line_on_right) override;
 	virtual void prepare_for_lower_triangle(bool long_line_on_right) override;
 	virtual void prepare_for_scanline(float progress_left, float progress_right) override;
 	virtual int shade(float progress) override;
+	virtual void shade_span(const float * progress, std::uint32_t coverage, int count, int * colors) override;
+	virtual std::shared_ptr<pixel_shader_t> clone() const override { return std::make_shared<pixel_shader_texture>(*this); }
+
+	template<bool power_of_two, bool compressed> int sample(const vec2f_t & t);
+	template<bool power_of_two, bool compressed> void sample_span(const float * progress, std::uint32_t coverage, int * colors);
 };
 
 
@@ -105,19 +186,57 @@ struct pixel_shader_texture_bilinear : pixel_shader_t
 	vec2f_t t_dir;
 
 	unsigned int default_bitmap = pixel_colors(128,128,128,255).to_int();
+	const texture_t * texture = nullptr; // the material's, mipmap level picked per triangle
 	unsigned int *tbitmap;
 	int twidth;
 	int theight;
+	texel_addressing_t taddressing;
+	bool tpower_of_two; // wrap with masks
+	const mipmap_t * tmipmap = nullptr; // only read block by block when compressed
+	bool tcompressed;
+	block_cache_t tcache;
 
 	virtual void prepare_for_primitive(const primitive_t & p, const scene_t & s, const viewport_t & vp) override;
-	virtual void prepare_for_triangle(vertex_idx i0, vertex_idx i1, vertex_idx i2, bool) override;
+	virtual void prepare_for_triangle(const transformed_vertex_t & mv0, const transformed_vertex_t & mv1, const transformed_vertex_t & mv2, bool) override;
 	virtual void prepare_for_upper_triangle(bool long_line_on_right) override;
 	virtual void prepare_for_lower_triangle(bool long_line_on_right) override;
 	virtual void prepare_for_scanline(float progress_left, float progress_right) override;
 	virtual int shade(float progress) override;
+	virtual void shade_span(const float * progress, std::uint32_t coverage, int count, int * colors) override;
+	virtual std::shared_ptr<pixel_shader_t> clone() const override { return std::make_shared<pixel_shader_texture_bilinear>(*this); }
+
+	template<bool power_of_two, bool compressed> int sample(const vec2f_t & t);
+	template<bool power_of_two, bool compressed> void sample_span(const float * progress, std::uint32_t coverage, int * colors);
 };
 
 
+// a color lit by light, 65536 for 1: darker below, closer to white above, alpha untouched
+inline int apply_light(int color, int light_fixed)
+{
+	float light = light_fixed / 65536.0;
+	__m128 channels = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(color)));
+	__m128i lit;
+	if (light < 1)
+		lit = _mm_cvttps_epi32(_mm_mul_ps(channels, _mm_set1_ps(light)));
+	else if constexpr (default_math_accuracy == math_accuracy_t::EXACT)
+	{
+		light = sqrt(light);
+		light = sqrt(light);
+		__m128 darkness = _mm_div_ps(_mm_sub_ps(_mm_set1_ps(255), channels), _mm_set1_ps(light));
+		lit = _mm_sub_epi32(_mm_set1_epi32(255), _mm_cvttps_epi32(darkness));
+	}
+	else
+	{
+		// light^-1/4 = light^-1/2 * (light^-1/2)^-1/2
+		__m128 r = fast_rsqrt(_mm_set1_ps(light));
+		__m128 darkness = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(255), channels), _mm_mul_ps(r, fast_rsqrt(r)));
+		lit = _mm_sub_epi32(_mm_set1_epi32(255), _mm_cvttps_epi32(darkness));
+	}
+	lit = _mm_packus_epi32(lit, lit);
+	lit = _mm_packus_epi16(lit, lit);
+	return (_mm_cvtsi128_si32(lit) & 0x00FFFFFF) | (color & 0xFF000000);
+}
+
 template<typename L, typename T>
 struct pixel_shader_light_and_texture : pixel_shader_t
 {
@@ -132,10 +251,10 @@ struct pixel_shader_light_and_texture : pixel_shader_t
 		shader_texture.prepare_for_primitive(p, s, vp);
 	}
 
-	virtual void prepare_for_triangle(vertex_idx i0, vertex_idx i1, vertex_idx i2, bool inverted) override
+	virtual void prepare_for_triangle(const transformed_vertex_t & mv0, const transformed_vertex_t & mv1, const transformed_vertex_t & mv2, bool inverted) override
 	{
-		shader_flat_light.prepare_for_triangle(i0, i1, i2, inverted);
-		shader_texture.prepare_for_triangle(i0, i1, i2, inverted);
+		shader_flat_light.prepare_for_triangle(mv0, mv1, mv2, inverted);
+		shader_texture.prepare_for_triangle(mv0, mv1, mv2, inverted);
 	}
 
 	virtual void prepare_for_upper_triangle(bool long_line_on_right) override
@@ -158,23 +277,29 @@ struct pixel_shader_light_and_texture : pixel_shader_t
 
 	virtual int shade(float progress) override
 	{
-		int color = shader_texture.shade(progress);
-		float light = shader_flat_light.shade(progress) / 65536.0;
-		if (light < 1)
-		{
-			((unsigned char*)&color)[0] = ((unsigned char*)&color)[0] * light;
-			((unsigned char*)&color)[1] = ((unsigned char*)&color)[1] * light;
-			((unsigned char*)&color)[2] = ((unsigned char*)&color)[2] * light;
-		}
-		else
+		return apply_light(shader_texture.shade(progress), shader_flat_light.shade(progress));
+	}
+
+	// both halves called by their static type, not through the vtable
+	virtual void shade_span(const float * progress, std::uint32_t coverage, int count, int * colors) override
+	{
+		int lights[span_size];
+		shader_texture.T::shade_span(progress, coverage, count, colors);
+		shader_flat_light.L::shade_span(progress, coverage, count, lights);
+		for (std::uint32_t bits = coverage ; bits ; bits &= bits - 1)
 		{
-			light = sqrt(light);
-			light = sqrt(light);
-			((unsigned char*)&color)[0] = 255 - (unsigned char) ((255 - ((unsigned char*)&color)[0]) / light);
-			((unsigned char*)&color)[1] = 255 - (unsigned char) ((255 - ((unsigned char*)&color)[1]) / light);
-			((unsigned char*)&color)[2] = 255 - (unsigned char) ((255 - ((unsigned char*)&color)[2]) / light);
+			int i = __builtin_ctz(bits);
+			colors[i] = apply_light(colors[i], lights[i]);
 		}
-		return color;
+	}
+
+	virtual std::shared_ptr<pixel_shader_t> clone() const override
+	{
+		return std::make_shared<pixel_shader_light_and_texture<L,T>>(*this);
+	}
+	virtual bool lit_per_vertex() const override
+	{
+		return shader_flat_light.L::lit_per_vertex() || shader_texture.T::lit_per_vertex();
 	}
 };
 
@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <thread>
 #include <memory>
 
@@ -8,6 +9,7 @@
 
 #include <swegl/render/colors.hpp>
 #include <swegl/misc/lerp.hpp>
+#include <swegl/misc/worker_pool.hpp>
 
 namespace swegl
 {
@@ -16,7 +18,7 @@ struct post_shader_t
 {
 	int hardware_concurrency;
 	post_shader_t()
-		: hardware_concurrency(std::thread::hardware_concurrency())
+		: hardware_concurrency(std::max(1u, std::thread::hardware_concurrency()))
 	{}
 
 	void copy_first_transparency_layer_to_screen(int y_begin, int y_end, viewport_t & vp)
@@ -24,7 +26,7 @@ struct post_shader_t
 		int * pixel = (int*)&vp.m_transparency_layers[0].m_colors[y_begin*vp.m_w];
 		for (int j=y_begin ; j<y_end ; j++)
 		{
-			int * screen = &((int*)vp.m_screen->pixels)[(j+vp.m_y)*vp.m_screen->pitch/vp.m_screen->format->BytesPerPixel];
+			int * screen = &((int*)vp.m_screen->pixels)[(j+vp.m_y)*vp.m_screen->pitch/vp.m_screen->format->BytesPerPixel + vp.m_x];
 			for (int i=0 ; i<vp.m_w ; i++, pixel++,screen++)
 				*screen = *pixel;
 		}
@@ -35,15 +37,8 @@ struct post_shader_t
 		if (vp.m_got_transparency == false)
 			return;
 
-		std::vector<std::thread> vt;
-		vt.reserve(hardware_concurrency);
-
-		// translate z-buffer into blur factor
-		vt.clear();
-		for (int i=0 ; i<hardware_concurrency ; i++)
-			vt.emplace_back([&vp,i,this](){ copy_first_transparency_layer_to_screen(i*vp.m_h/hardware_concurrency, (i+1)*vp.m_h/hardware_concurrency, vp); });
-		for (auto & t : vt)
-			t.join();
+		// bands of rows on the shared workers: viewports rendered together post shade together
+		worker_pool().run(hardware_concurrency, [&vp,this](int i){ copy_first_transparency_layer_to_screen(i*vp.m_h/hardware_concurrency, (i+1)*vp.m_h/hardware_concurrency, vp); });
 	}
 };
 
@@ -78,7 +73,7 @@ struct post_shader_depth_box : public post_shader_t
 		float        * blur_factor_local = &blur_factor[y_begin*vp.m_w];
 		for (int y=y_begin ; y<y_end ; y++)
 		{
-			pixel_colors * dest_colors = & ((pixel_colors *) vp.m_screen->pixels)[(int)(y*vp.m_screen->pitch/vp.m_screen->format->BytesPerPixel)];
+			pixel_colors * dest_colors = & ((pixel_colors *) vp.m_screen->pixels)[(int)((y+vp.m_y)*vp.m_screen->pitch/vp.m_screen->format->BytesPerPixel) + vp.m_x];
 			for (int x=0 ; x<vp.m_w ; x++, ++source_colors, ++dest_colors, ++blur_factor_local)
 			{
 				int radius = *blur_factor_local;
@@ -96,7 +91,7 @@ struct post_shader_depth_box : public post_shader_t
 							if (! focused)
 							{
 								count++;
-								pixel_colors & p = source_colors[(j+vp.m_y)*vp.m_screen->pitch/4 + i+vp.m_x];
+								const pixel_colors & p = vp.m_transparency_layers[0].m_colors[j*vp.m_w + i];
 								b += p.o.b;
 								g += p.o.g;
 								r += p.o.r;
@@ -112,22 +107,11 @@ struct post_shader_depth_box : public post_shader_t
 
 	virtual void shade(viewport_t & vp) override
 	{
-		std::vector<std::thread> vt;
-		vt.reserve(hardware_concurrency);
-
 		// translate z-buffer into blur factor
-		vt.clear();
-		for (int i=0 ; i<hardware_concurrency ; i++)
-			vt.emplace_back([&vp,i,this](){ translate_z_to_blur_factor(i*vp.m_h/hardware_concurrency, (i+1)*vp.m_h/hardware_concurrency, vp); });
-		for (auto & t : vt)
-			t.join();
+		worker_pool().run(hardware_concurrency, [&vp,this](int i){ translate_z_to_blur_factor(i*vp.m_h/hardware_concurrency, (i+1)*vp.m_h/hardware_concurrency, vp); });
 
 		// render blurred image into temporary buffer
-		vt.clear();
-		for (int i=0 ; i<hardware_concurrency ; i++)
-			vt.emplace_back([&vp,i,this](){ do_blur(i*vp.m_h/hardware_concurrency, (i+1)*vp.m_h/hardware_concurrency, vp); });
-		for (auto & t : vt)
-			t.join();
+		worker_pool().run(hardware_concurrency, [&vp,this](int i){ do_blur(i*vp.m_h/hardware_concurrency, (i+1)*vp.m_h/hardware_concurrency, vp); });
 	}
 };
 
@@ -7,6 +7,7 @@
 #include <mutex>
 #include <cmath>
 #include <algorithm>
+#include <vector>
 
 #include <swegl/render/viewport.hpp>
 #include <swegl/data/model.hpp>
@@ -15,22 +16,21 @@
 namespace swegl
 {
 
-void _render(scene_t & scene, viewport_t & viewport);
+void _render(const scene_t & scene, viewport_t & viewport);
+// The depth of the viewport's visible triangles into its z-buffer and nothing else, by the depth-only rasterizer:
+// the z-prepass of viewport_t::set_z_prepass() alone. The scene must be in world coordinates, see render().
+void render_depth(const scene_t & scene, viewport_t & viewport);
+// The maps of the viewport's sun shadows, see sun_shadows_t. _render() draws them first for viewports that have some.
+void render_sun_shadows(const scene_t & scene, viewport_t & viewport);
 
-template<typename...T>
-void _render(scene_t & scene, viewport_t & viewport, T&...t)
-{
-	_render(scene, viewport);
-	_render(scene, t...);
-}
+// Viewports are rendered concurrently on the shared worker pool, they must not overlap on their screen.
+// What depends on the scene alone is computed once, each viewport transforms the vertices it sees, see bench_viewports
+void render(scene_t & scene, const std::vector<viewport_t*> & viewports);
 
 template<typename...T>
-void render(scene_t & scene, T&...t)
+void render(scene_t & scene, viewport_t & viewport, T&...t)
 {
-	// Transform scene into world coordinates with vertex shader ONCE for all viewports
-	vertex_shader_t::original_to_world(scene);
-
-	_render(scene, t...);
+	render(scene, std::vector<viewport_t*>{&viewport, &t...});
 }
 
 } // namespace
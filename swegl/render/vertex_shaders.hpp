@@ -13,78 +13,184 @@ namespace swegl
 
 struct vertex_shader_t
 {
+	// upper bound of how much m can lengthen a vector: sqrt of the largest eigenvalue of MtM, bounded by its largest row sum
+	// exact when m is a rotation times a scale
+	static inline float max_stretch(const matrix44_t & m)
+	{
+		float max_row_sum = 0;
+		for (int i=0 ; i<3 ; i++)
+		{
+			float row_sum = 0;
+			for (int j=0 ; j<3 ; j++)
+				row_sum += fabs(m[0][i]*m[0][j] + m[1][i]*m[1][j] + m[2][i]*m[2][j]);
+			max_row_sum = std::max(max_row_sum, row_sum);
+		}
+		return sqrt(max_row_sum);
+	}
+
 	static inline void original_to_world(scene_t & scene, node_t & node, const matrix44_t & parent_matrix)
 	{
-		node.original_to_world_matrix = parent_matrix * node.get_local_world_matrix();
-		//__gnu_parallel::for_each(node.mesh.vertices.begin(), node.mesh.vertices.end(), [&](auto & mv)
+		const matrix44_t matrix = parent_matrix * node.get_local_world_matrix();
+		bool moved = false;
+		for (int i=0 ; i<4 ; i++)
+			for (int j=0 ; j<4 ; j++)
+				moved |= matrix[i][j] != node.original_to_world_matrix[i][j];
+		if (moved)
+			node.version = ++scene.last_version;
+		node.original_to_world_matrix = matrix;
+		const float stretch = max_stretch(node.original_to_world_matrix);
+		// vertices are transformed by each viewport that sees their primitive, see world_to_viewport()
 		for (auto & primitive : node.primitives)
 		{
-			for (auto & mv : primitive.vertices)
-				mv.v_world = transform(mv.v, node.original_to_world_matrix);
+			primitive.bounds_world = primitive.bounds.radius < 0
+			                       ? bounding_sphere_t{}
+			                       : bounding_sphere_t{transform(primitive.bounds.center, node.original_to_world_matrix), primitive.bounds.radius * stretch};
+			primitive.diffuse_lights.resize(primitive);
 		}
 		for (auto child_idx : node.children_idx)
 			original_to_world(scene, scene.nodes[child_idx], node.original_to_world_matrix);
-		//);
 	}
 	static inline void original_to_world(scene_t & scene)
 	{
 		for (auto node_idx : scene.root_nodes)
 			original_to_world(scene, scene.nodes[node_idx], matrix44_t::Identity);
+		scene.bvh.refit(scene);
 	}
 
-	static inline void world_to_camera_or_frustum(node_t & node, const viewport_t & viewport)	
+	// primitives out of the viewport's frustum won't be transformed nor drawn
+	static inline void cull(const scene_t & scene, transformed_scene_t & transformed, const viewport_t & viewport)
 	{
-		//__gnu_parallel::for_each(node.mesh.vertices.begin(), node.mesh.vertices.end(), [&](auto & mv)
-		for (auto & primitive : node.primitives)
-			for (auto & mv : primitive.vertices)
+		transformed.resize(scene);
+		for (auto [node_idx, primitive_idx] : transformed.visible_primitives)
+			if (node_idx < (int)transformed.nodes.size() && primitive_idx < (int)transformed.nodes[node_idx].primitives.size())
 			{
-				mv.yes = false;
-				mv.v_viewport = transform(mv.v_world, viewport.camera().m_viewmatrix);
-				//if (mv.v_viewport.z() >= 0.001)
-					camera_to_frustum(mv, node, viewport);
+				transformed.nodes[node_idx].visible = false;
+				transformed.nodes[node_idx].primitives[primitive_idx].visible = false;
 			}
-		//);
+		transformed.visible_primitives.clear();
+		transformed.visible_nodes.clear();
+
+		scene.bvh.query(viewport.camera().frustum(), scene, transformed.visible_primitives);
+
+		for (auto [node_idx, primitive_idx] : transformed.visible_primitives)
+		{
+			transformed.nodes[node_idx].primitives[primitive_idx].visible = true;
+			if (transformed.visible_nodes.empty() || transformed.visible_nodes.back() != node_idx)
+			{
+				transformed.nodes[node_idx].visible = true;
+				transformed.visible_nodes.push_back(node_idx);
+			}
+		}
 	}
-	static inline void world_to_camera_or_frustum(scene_t & scene, const viewport_t & viewport)
+
+	// Level of detail of a visible primitive, from how big its error would look on screen at the nearest point of its bounds.
+	// Going coarser takes an error well under the viewport's threshold, going finer an error well over it:
+	// a primitive at the limit doesn't switch level every frame.
+	static inline int select_lod(const primitive_t & primitive, int current, const viewport_t & viewport)
 	{
-		for (auto & node : scene.nodes)
-			world_to_camera_or_frustum(node, viewport);
-	}
+		const int count = primitive.lods.size();
+		if (count == 0 || viewport.m_lod_pixel_error <= 0 || primitive.bounds.radius <= 0)
+			return -1;
+		const float stretch = primitive.bounds_world.radius / primitive.bounds.radius;
+		const float distance = (primitive.bounds_world.center - viewport.camera().position()).len() - primitive.bounds_world.radius;
+		if (distance <= 0)
+			return -1;
+		// roughly: x and y are divided by the depth, the viewport maps [-1,1] to its height
+		const float pixels_per_unit = stretch * viewport.m_h / 2 * viewport.camera().m_projectionmatrix[1][1] / distance;
+		auto coarsest_under = [&](float max_pixels)
+			{
+				int lod = -1;
+				for (int i=0 ; i<count && primitive.lods[i].error * pixels_per_unit <= max_pixels ; i++)
+					lod = i;
+				return lod;
+			};
 
-	static inline void world_to_viewport(mesh_vertex_t & mv, const node_t & node, const viewport_t & viewport)
+		current = std::min(current, count-1);
+		const float threshold = viewport.m_lod_pixel_error;
+		if (current >= 0 && primitive.lods[current].error * pixels_per_unit > threshold * (1 + viewport.m_lod_hysteresis))
+			return coarsest_under(threshold);
+		return std::max(current, coarsest_under(threshold * (1 - viewport.m_lod_hysteresis)));
+	}
+	static inline void select_lods(const scene_t & scene, transformed_scene_t & transformed, const viewport_t & viewport)
 	{
-		mv.v_viewport = transform(mv.v_world, viewport.camera().m_viewmatrix);
-		camera_to_frustum(mv, node, viewport);
-		frustum_to_viewport(mv, viewport);
+		for (auto [node_idx, primitive_idx] : transformed.visible_primitives)
+		{
+			transformed_primitive_t & transformed_primitive = transformed.nodes[node_idx].primitives[primitive_idx];
+			transformed_primitive.lod = select_lod(scene.nodes[node_idx].primitives[primitive_idx], transformed_primitive.lod, viewport);
+		}
 	}
 
-	static inline void camera_to_frustum(mesh_vertex_t & mv, const node_t & node, const viewport_t & viewport)
+	// vertex i of the streams all the way to viewport coordinates, the reference for transform_vertices()
+	static inline void transform_vertex(const vertex_streams_t & vertices, size_t i, const matrix44_t & model, const matrix44_t & normal_matrix, const viewport_t & viewport, transformed_vertex_t & tv)
 	{
-		mv.normal_world = rotate(mv.normal, scale(node.rotation, node.scale)).normalize();
+		const matrix44_t & n = normal_matrix;
+		tv.yes = false;
+		tv.v_world = transform(vertices.position(i), model);
+		tv.tex_coords = vertices.tex_coords(i);
+		// rotate() straight from the streams, normal_t normalizes
+		tv.normal_world = normal_t(n[0][0]*vertices.nx[i] + n[0][1]*vertices.ny[i] + n[0][2]*vertices.nz[i],
+		                           n[1][0]*vertices.nx[i] + n[1][1]*vertices.ny[i] + n[1][2]*vertices.nz[i],
+		                           n[2][0]*vertices.nx[i] + n[2][1]*vertices.ny[i] + n[2][2]*vertices.nz[i]);
+		world_to_viewport(tv, viewport);
+	}
+	// Same as transform_vertex() for vertices [begin,end[ into out[begin,end[, 4 vertices per SSE register,
+	// in one pass over the streams: world, camera, perspective divide and viewport mapping. Bit-identical to transform_vertex().
+	static void transform_vertices(const vertex_streams_t & vertices, size_t begin, size_t end,
+	                               const matrix44_t & model, const matrix44_t & normal_matrix,
+	                               const viewport_t & viewport,
+	                               transformed_vertex_t * out);
+	// vertices [begin,end[ through an orthographic matrix into out[begin,end[.v_viewport, for the depth-only rasterizer:
+	// x and y as they come, 1/(2-z) for z clamped to [0,1], see render_sun_shadows(). 4 vertices per SSE register
+	static void transform_vertices_orthographic(const vertex_streams_t & vertices, size_t begin, size_t end,
+	                                            const matrix44_t & matrix,
+	                                            transformed_vertex_t * out);
 
-		mv.v_viewport = transform(mv.v_viewport, viewport.camera().m_projectionmatrix);
-		if (mv.v_viewport.z() != 0)
+	// transformed_vertex_t::light of the visible vertices, for pixel shaders lit_per_vertex(), once the light clusters are built.
+	// count: drawn_vertex_count(), the vertices past it may still be marked visible by a finer level of detail of an earlier frame
+	static void light_vertices(const scene_t & scene, transformed_vertex_t * vertices, size_t count, const viewport_t & viewport, bool double_sided);
+
+	static inline void world_to_viewport(const node_t & node, transformed_node_t & transformed_node, const viewport_t & viewport)
+	{
+		const matrix44_t normal_matrix = scale(node.rotation, node.scale);
+		for (size_t p=0 ; p<node.primitives.size() ; p++)
 		{
-			mv.v_viewport.x() /= fabs(mv.v_viewport.z());
-			mv.v_viewport.y() /= fabs(mv.v_viewport.z());
+			const primitive_t & primitive = node.primitives[p];
+			transformed_primitive_t & transformed_primitive = transformed_node.primitives[p];
+			if ( ! transformed_primitive.visible)
+				continue;
+			transformed_primitive.vertices.resize(primitive.vertices.size());
+			transformed_primitive.specular_lights.resize(primitive);
+			// the vertices of a level of detail come first
+			transform_vertices(primitive.vertices, 0, drawn_vertex_count(primitive, transformed_primitive), node.original_to_world_matrix, normal_matrix, viewport, transformed_primitive.vertices.data());
 		}
 	}
-	static inline void frustum_to_viewport(node_t & node, const viewport_t & viewport)
+	static inline void world_to_viewport(const scene_t & scene, transformed_scene_t & transformed, const viewport_t & viewport)
 	{
-		//__gnu_parallel::for_each(node.primitives.begin(), node.primitives.end(), [&](auto & primitive) {
-		for (auto & primitive : node.primitives)
-			//__gnu_parallel::for_each(primitive.vertices.begin(), primitive.vertices.end(), [&](auto & mv) {
-				for (auto & mv : primitive.vertices)
-				{
-					if (mv.yes)
-						viewport.transform(mv);
-				}
-			//});
-		//});
+		cull(scene, transformed, viewport);
+		select_lods(scene, transformed, viewport);
+		for (int node_idx : transformed.visible_nodes)
+			world_to_viewport(scene.nodes[node_idx], transformed.nodes[node_idx], viewport);
+	}
+
+	static inline void world_to_viewport(transformed_vertex_t & tv, const viewport_t & viewport)
+	{
+		tv.v_viewport = transform(tv.v_world, viewport.camera().m_viewmatrix);
+		camera_to_frustum(tv, viewport);
+		frustum_to_viewport(tv, viewport);
+	}
+
+	static inline void camera_to_frustum(transformed_vertex_t & tv, const viewport_t & viewport)
+	{
+		tv.v_viewport = transform(tv.v_viewport, viewport.camera().m_projectionmatrix);
+		if (tv.v_viewport.z() != 0)
+		{
+			tv.v_viewport.x() /= fabs(tv.v_viewport.z());
+			tv.v_viewport.y() /= fabs(tv.v_viewport.z());
+		}
 	}
-	static inline void frustum_to_viewport(mesh_vertex_t & mv, const viewport_t & viewport)
+	static inline void frustum_to_viewport(transformed_vertex_t & tv, const viewport_t & viewport)
 	{
-		viewport.transform(mv);
+		viewport.transform(tv);
 	}
 };
 
@@ -2,6 +2,11 @@
 #pragma once
 
 #include <memory>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <algorithm>
 
 #include <SDL.h>
 
@@ -24,8 +29,188 @@ namespace swegl
 		transparency_layer_t(int w, int h);
 	};
 
+	// Farthest depth of each 8x8 block and each 64x64 block of a z-buffer.
+	// Drawing only marks blocks dirty, they are refreshed from the z-buffer when hidden() looks at them.
+	// Values are never nearer than the z-buffer they summarize, so rejections are always safe.
+	struct hierarchical_z_t
+	{
+		static const int block_size  = 8;
+		static const int coarse_size = 64;
+		static const int blocks_per_coarse = coarse_size / block_size;
+
+		int m_w, m_h;
+		int m_blocks_x, m_blocks_y;
+		int m_coarse_x, m_coarse_y;
+		std::vector<float>         m_block_max;
+		std::vector<unsigned char> m_block_dirty;
+		std::vector<float>         m_coarse_max;
+		std::vector<unsigned char> m_coarse_dirty;
+
+		std::atomic<size_t> m_rejected_triangles;
+		std::atomic<size_t> m_rejected_spans;
+
+		hierarchical_z_t(int w, int h);
+
+		void clear();
+
+		// is everything in [x_begin,x_end[ x [y_begin,y_end[ already nearer than z? (viewport coordinates)
+		bool hidden(int x_begin, int y_begin, int x_end, int y_end, float z, const float * zbuffer);
+		// same for one scanline, with block depths as of the last call to hidden()
+		inline bool span_hidden(int x_begin, int x_end, int y, float z) const
+		{
+			const float * block_max = &m_block_max[(y / block_size) * m_blocks_x];
+			for (int b = x_begin / block_size ; b <= (x_end-1) / block_size ; b++)
+				if (z < block_max[b])
+					return false;
+			return true;
+		}
+		inline void mark_drawn(int x_begin, int x_end, int y)
+		{
+			int row = y / block_size;
+			for (int b = x_begin / block_size ; b <= (x_end-1) / block_size ; b++)
+				m_block_dirty[row * m_blocks_x + b] = 1;
+			for (int c = x_begin / coarse_size ; c <= (x_end-1) / coarse_size ; c++)
+				m_coarse_dirty[(y / coarse_size) * m_coarse_x + c] = 1;
+		}
+
+	private:
+		float refresh_block(int bx, int by, const float * zbuffer);
+	};
+
+	// What the visibility pass of deferred shading keeps of the nearest triangle of a pixel,
+	// enough to replay the pixel shader calls the rasterizer would have made.
+	struct visibility_sample_t
+	{
+		static const std::uint32_t lower_half         = 1u << 31;
+		static const std::uint32_t long_line_on_right = 1u << 30;
+		static const std::uint32_t triangle_mask      = long_line_on_right - 1;
+
+		std::uint32_t triangle; // index into the frame's triangles, with the flags of the half being drawn
+		float progress_left, progress_right;
+		float progress;
+	};
+
+	// The point source lights that can reach each cluster of the view: a tile of tile_size pixels times a slice of depth,
+	// slices thin near the camera and thicker farther away. Built once per frame from the camera, before drawing,
+	// so that shaders go through the lights of the cluster of the point they light rather than through all of them.
+	struct light_clusters_t
+	{
+		static const int tile_size   = 64;
+		static const int slice_count = 16; // [0,near_z[, exponential slices up to far_z, then [far_z,infinity[
+		static constexpr float near_z = 0.1f;
+		static constexpr float far_z  = 100.0f;
+
+		int m_w, m_h;
+		int m_tiles_x, m_tiles_y;
+		float m_slice_z[slice_count+1];
+
+		bool m_clustered;
+		matrix44_t m_viewmatrix;
+		float m_x_scale, m_y_scale; // from camera coordinates divided by z to [-1,1]
+		std::vector<std::uint32_t> m_offsets; // the lights of cluster c are m_lights[m_offsets[c]] up to m_lights[m_offsets[c+1]]
+		std::vector<std::uint32_t> m_lights;  // indices into the scene's lights
+		std::vector<std::uint32_t> m_stream_offsets; // the same lights in m_streams, each cluster padded
+		point_source_light_streams_t m_streams;
+		const point_source_light_streams_t * m_all_lights = nullptr; // for points out of the view, or when not clustered
+		std::vector<std::pair<std::uint32_t,std::uint32_t>> m_pairs; // cluster and light, kept for its capacity
+
+		light_clusters_t(int w, int h);
+
+		void build(const point_source_light_streams_t & lights, const camera_t & camera, bool clustered);
+
+		// the lights that may reach a point in world coordinates, a superset of those that do
+		inline point_source_light_range_t lights(const vertex_t & v) const
+		{
+			if (m_clustered)
+			{
+				const auto & m = m_viewmatrix;
+				float z = m[2][0]*v.x() + m[2][1]*v.y() + m[2][2]*v.z() + m[2][3];
+				if (z > 0)
+				{
+					float x = m[0][0]*v.x() + m[0][1]*v.y() + m[0][2]*v.z() + m[0][3];
+					float y = m[1][0]*v.x() + m[1][1]*v.y() + m[1][2]*v.z() + m[1][3];
+					float px = (1 + m_x_scale * x / z) * m_w / 2;
+					float py = (1 - m_y_scale * y / z) * m_h / 2;
+					if (px >= 0 && px < m_w && py >= 0 && py < m_h)
+					{
+						int slice = std::upper_bound(m_slice_z + 1, m_slice_z + slice_count, z) - (m_slice_z + 1);
+						int cluster = (slice * m_tiles_y + (int)py / tile_size) * m_tiles_x + (int)px / tile_size;
+						return m_streams.range(m_stream_offsets[cluster], m_stream_offsets[cluster+1]);
+					}
+				}
+			}
+			return m_all_lights->all();
+		}
+	};
+
+	struct viewport_t;
+
+	// Shadows of the sun: for each texel of a map, the depth of what the sun lights first, seen from the sun through an
+	// orthographic projection. The view is split by depth up to m_distance into cascades that each get a map of the same
+	// size: near cascades cover less of the world, with smaller texels. Drawn every frame by the depth-only rasterizer,
+	// before the viewport's triangles, see render_sun_shadows().
+	struct sun_shadows_t
+	{
+		struct cascade_t
+		{
+			float m_z_end = 0;                  // the cascade is used for camera depths up to m_z_end, 0: not drawn
+			matrix44_t m_matrix;                // world to map: x and y in texels, z in [0,1] across the scene from the sun's side
+			float m_texel;                      // size of a texel in world coordinates
+			frustum_t m_frustum;                // where the casters that may shade the cascade are
+			float m_normal_offset;              // points are looked up off their surface and a bit nearer to the sun
+			float m_depth_bias;                 // than they are, not to shade themselves
+			std::unique_ptr<viewport_t> m_map;  // the rasterizer's target
+			const float * m_zbuffer = nullptr;  // the map's: 1/(2-z) of the caster nearest to the sun at each texel, see render_sun_shadows()
+		};
+
+		int m_size = 0; // texels on each side of a map, 0: no shadows
+		float m_distance = 0;
+		std::vector<cascade_t> m_cascades;
+		matrix44_t m_viewmatrix; // the camera's, to pick cascades
+
+		void resize(int size, int cascade_count, float distance);
+		// the cascades around the slices of the camera's view, their depth across the scene's bounds
+		void fit(const scene_t & scene, const camera_t & camera);
+
+		// how much of the sun reaches a point in world coordinates, from 0 in the shadow to 1, by percentage-closer filtering:
+		// the fraction of the 3x3 texels around it where nothing is nearer to the sun
+		inline float lit(const vertex_t & point, const normal_t & normal) const
+		{
+			const auto & m = m_viewmatrix;
+			float z = m[2][0]*point.x() + m[2][1]*point.y() + m[2][2]*point.z() + m[2][3];
+			for (const cascade_t & cascade : m_cascades)
+			{
+				if (z >= cascade.m_z_end)
+					continue;
+				vertex_t p = transform(point + normal * cascade.m_normal_offset, cascade.m_matrix);
+				float depth = 1 / (2 - std::clamp(p.z() - cascade.m_depth_bias, 0.0f, 1.0f));
+				int x0 = (int)std::floor(p.x() + 0.5f) - 1;
+				int y0 = (int)std::floor(p.y() + 0.5f) - 1;
+				int lit = 0;
+				if (x0 >= 0 && y0 >= 0 && x0+3 <= m_size && y0+3 <= m_size)
+					for (int y=y0 ; y<y0+3 ; y++)
+					{
+						const float * row = &cascade.m_zbuffer[y*m_size + x0];
+						lit += (row[0] >= depth) + (row[1] >= depth) + (row[2] >= depth);
+					}
+				else
+					for (int y=y0 ; y<y0+3 ; y++)
+						for (int x=x0 ; x<x0+3 ; x++)
+							lit += x < 0 || y < 0 || x >= m_size || y >= m_size || cascade.m_zbuffer[y*m_size + x] >= depth;
+				return lit / 9.0f;
+			}
+			return 1;
+		}
+	};
+
 	struct viewport_t
 	{
+		enum rasterizer_t
+		{
+			SCANLINE  = 0, // steps the triangle's edges, one pixel at a time
+			HALFSPACE = 1, // SSE edge functions, 4 pixels at a time
+		};
+
 		int                                     m_x, m_y        ;
 		int                                     m_w, m_h        ;
 		SDL_Surface                            *m_screen        ;
@@ -36,18 +221,70 @@ namespace swegl
 		post_shader_t                          *m_post_shader   ;
 		std::vector<transparency_layer_t>       m_transparency_layers;
 		bool                                    m_got_transparency   ;
+		int                                     m_tile_size          ; // 0: rasterize on the calling thread
+		int                                     m_thread_count       ;
+		rasterizer_t                            m_rasterizer         ;
+		hierarchical_z_t                        m_hierarchical_z     ;
+		bool                                    m_use_hierarchical_z ;
+		light_clusters_t                        m_light_clusters     ;
+		bool                                    m_use_light_clusters ;
+		bool                                    m_cache_face_lights  ;
+		std::uint32_t                           m_camera_version     ; // see scene_t::last_version
+		vertex_t                                m_camera_version_position;
+		std::vector<visibility_sample_t>        m_visibility         ;
+		bool                                    m_deferred_shading   ;
+		bool                                    m_z_prepass          ;
+		sun_shadows_t                           m_sun_shadows        ;
+		float                                   m_lod_pixel_error    ; // 0: always full detail
+		float                                   m_lod_hysteresis     ;
+		transformed_scene_t                     m_transformed_scene  ;
 
 		viewport_t(int x, int y, int w, int h
 		          ,SDL_Surface *screen
 		          ,std::shared_ptr<swegl:: pixel_shader_t> & pixel_shader
 		          ,int transparency_layer_count
 		          );
+		// depth only, for the depth-only rasterizer: no screen, pixel shader nor transparency layers
+		viewport_t(int w, int h);
 
 		void flatten();
 		void flatten(transparency_layer_t & front, transparency_layer_t & back);
 		void flatten(transparency_layer_t & front);
 
 		inline void set_post_shader(post_shader_t & post_shader) { m_post_shader = & post_shader; }
+		inline void set_rasterizer(rasterizer_t rasterizer) { m_rasterizer = rasterizer; }
+		// off by default: keeping the blocks' depths costs more than it saves unless many triangles are hidden
+		// behind others drawn before them, see bench_raster
+		inline void set_hierarchical_z(bool enabled) { m_use_hierarchical_z = enabled; }
+		inline void set_light_clusters(bool enabled) { m_use_light_clusters = enabled; }
+		// keep the flat shader's light of each triangle from frame to frame, see face_light_t
+		inline void set_face_light_cache(bool enabled) { m_cache_face_lights = enabled; }
+		// shade each visible pixel once, after all triangles are rasterized.
+		// not available with transparency layers: whether a pixel hides what's behind depends on its shaded alpha
+		inline void set_deferred_shading(bool enabled)
+		{
+			m_deferred_shading = enabled && ! m_got_transparency;
+			m_visibility.resize(m_deferred_shading ? m_w * m_h : 0);
+		}
+		// draw the depth of all triangles first, then shade only the nearest: each pixel is shaded once, like deferred shading
+		// but without keeping the triangles, for the price of rasterizing twice. Not with transparency layers either
+		inline void set_z_prepass(bool enabled) { m_z_prepass = enabled && ! m_got_transparency; }
+		// shadows of the sun in cascade_count maps of size x size texels, over the view up to distance. size 0: none
+		inline void set_sun_shadows(int size, int cascade_count = 1, float distance = 50) { m_sun_shadows.resize(size, cascade_count, distance); }
+		// draw the coarsest level of detail whose error stays under pixel_error pixels on screen.
+		// a level changes once its error is off by more than the hysteresis fraction, not to flicker back and forth
+		inline void set_level_of_detail(float pixel_error, float hysteresis = 0.25f)
+		{
+			m_lod_pixel_error = std::max(0.0f, pixel_error);
+			m_lod_hysteresis = std::clamp(hysteresis, 0.0f, 0.9f);
+		}
+		inline void set_tiled_rendering(int tile_size, int thread_count)
+		{
+			// tiles must own whole hierarchical z blocks
+			const int align = hierarchical_z_t::coarse_size;
+			m_tile_size = (tile_size + align - 1) / align * align;
+			m_thread_count = std::max(1, thread_count);
+		}
 
 
 		      float * zbuffer()       { return m_zbuffer.get(); }
@@ -57,8 +294,9 @@ namespace swegl
 		const camera_t & camera() const { return m_camera; }
 
 		void clear();
+		void clear_depth();
 		vertex_t transform(const vertex_t & v) const;
-		void     transform(mesh_vertex_t & v) const;
+		void     transform(transformed_vertex_t & v) const;
 	};
 
 }